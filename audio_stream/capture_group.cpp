@@ -0,0 +1,411 @@
+#include "capture_group.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include "clock.h"
+#include "log.h"
+
+// Drift loop. The buffered level is smoothed over ~20 chunks; the
+// proportional term would close a level error in P_SECONDS and the integral
+// (the drift estimate) settles over I_SECONDS. USB audio crystals are within
+// a few hundred ppm of each other, so anything past MAX_DRIFT is a fault.
+static const double LEVEL_SMOOTHING = 0.05;
+static const double P_SECONDS = 2.0;
+static const double I_SECONDS = 10.0;
+static const double MAX_DRIFT = 0.005;
+
+struct CaptureGroup::Member {
+    std::string device;
+    snd_pcm_t* pcm;
+    unsigned int rate;
+    bool linked;
+    bool hw_synced;
+    double nominal;            // Device rate over the master's
+    std::vector<int16_t> fifo; // Captured, not yet output; `count` samples at the front
+    long count;
+    double phase;              // Fractional read position into fifo
+    double error;              // Smoothed level error, frames
+    double drift;              // Integral term: clock ratio - 1
+    double unread;             // Captured by the device but not yet read, in fractional frames
+    uint64_t last_data_ns;
+    std::atomic<double> drift_ppm;
+    std::atomic<unsigned long> slips;
+
+    Member() : pcm(nullptr), rate(0), linked(false), hw_synced(false), nominal(1.0), count(0), phase(0),
+               error(0), drift(0), unread(0), last_data_ns(0), drift_ppm(0), slips(0) {}
+
+    // Drops `n` samples from the front
+    void consume(long n) {
+        n = std::min(n, count);
+        std::memmove(fifo.data(), fifo.data() + n, (count - n) * sizeof(int16_t));
+        count -= n;
+    }
+
+    // Inserts `n` samples of silence at the front
+    void pad(long n) {
+        n = std::min(n, static_cast<long>(fifo.size()) - count);
+        std::memmove(fifo.data() + n, fifo.data(), count * sizeof(int16_t));
+        std::fill(fifo.begin(), fifo.begin() + n, 0);
+        count += n;
+    }
+};
+
+// Opens and configures one mono S16 capture PCM
+static snd_pcm_t* open_pcm(const std::string& device, unsigned int& sample_rate, unsigned int period_size,
+                           unsigned int n_periods) {
+    snd_pcm_t* capture_handle;
+    snd_pcm_hw_params_t* hw_params;
+    int err;
+
+    if ((err = snd_pcm_open(&capture_handle, device.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+        LOG_ERROR("Cannot open audio device %s: %s", device.c_str(), snd_strerror(err));
+        return nullptr;
+    }
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_hw_params_any(capture_handle, hw_params);
+
+    if ((err = snd_pcm_hw_params_set_access(capture_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+        LOG_ERROR("Cannot set access type: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+
+    if ((err = snd_pcm_hw_params_set_format(capture_handle, hw_params, SND_PCM_FORMAT_S16_LE)) < 0) {
+        LOG_ERROR("Cannot set sample format: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+
+    unsigned int actual_rate = sample_rate;
+    if ((err = snd_pcm_hw_params_set_rate_near(capture_handle, hw_params, &actual_rate, 0)) < 0) {
+        LOG_ERROR("Cannot set sample rate: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+    if (actual_rate != sample_rate) {
+        LOG_INFO("Warning: Actual sample rate of %s is %u Hz", device.c_str(), actual_rate);
+        sample_rate = actual_rate;
+    }
+
+    if ((err = snd_pcm_hw_params_set_channels(capture_handle, hw_params, 1)) < 0) {
+        LOG_ERROR("Cannot set channel count: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+
+    if ((err = snd_pcm_hw_params_set_period_size(capture_handle, hw_params, period_size, 0)) < 0) {
+        LOG_ERROR("Cannot set period size: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+
+    if ((err = snd_pcm_hw_params_set_periods(capture_handle, hw_params, n_periods, 0)) < 0) {
+        LOG_ERROR("Cannot set periods: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+
+    if ((err = snd_pcm_hw_params(capture_handle, hw_params)) < 0) {
+        LOG_ERROR("Cannot set parameters: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+
+    // Timestamp pointer updates on CLOCK_MONOTONIC, which places the device
+    // between period interrupts for the drift loop
+    snd_pcm_sw_params_t* sw_params;
+    snd_pcm_sw_params_alloca(&sw_params);
+    if (snd_pcm_sw_params_current(capture_handle, sw_params) < 0 ||
+        snd_pcm_sw_params_set_tstamp_mode(capture_handle, sw_params, SND_PCM_TSTAMP_ENABLE) < 0 ||
+        snd_pcm_sw_params_set_tstamp_type(capture_handle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC) < 0 ||
+        snd_pcm_sw_params(capture_handle, sw_params) < 0) {
+        LOG_INFO("ALSA %s: no monotonic timestamps, drift is measured per pointer update", device.c_str());
+    }
+
+    snd_pcm_uframes_t actual_buffer_size;
+    snd_pcm_hw_params_get_buffer_size(hw_params, &actual_buffer_size);
+    LOG_INFO("ALSA %s buffer size: %lu frames", device.c_str(), actual_buffer_size);
+    LOG_INFO("ALSA %s period size: %u frames", device.c_str(), period_size);
+    LOG_INFO("ALSA %s sample rate: %u Hz", device.c_str(), sample_rate);
+
+    if ((err = snd_pcm_prepare(capture_handle)) < 0) {
+        LOG_ERROR("Cannot prepare audio interface: %s", snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+    return capture_handle;
+}
+
+static int pcm_card(snd_pcm_t* pcm) {
+    snd_pcm_info_t* info;
+    snd_pcm_info_alloca(&info);
+    return snd_pcm_info(pcm, info) < 0 ? -1 : snd_pcm_info_get_card(info);
+}
+
+CaptureGroup::CaptureGroup() : sample_rate_(0), period_size_(0), cushion_(0), failed_(0) {}
+
+CaptureGroup::~CaptureGroup() {
+    close();
+}
+
+bool CaptureGroup::open(const std::vector<std::string>& devices, unsigned int& sample_rate,
+                        unsigned int period_size, unsigned int n_periods) {
+    close();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < devices.size(); ++i) {
+        std::unique_ptr<Member> member(new Member());
+        member->device = devices[i];
+        member->rate = i == 0 ? sample_rate : sample_rate_;
+        member->pcm = open_pcm(devices[i], member->rate, period_size, n_periods);
+        if (!member->pcm) {
+            close_locked();
+            return false;
+        }
+        if (i == 0) sample_rate = sample_rate_ = member->rate;
+        members_.push_back(std::move(member));
+    }
+    period_size_ = period_size;
+    cushion_ = members_.size() > 1 ? 2 * static_cast<long>(period_size) : 0;
+
+    snd_pcm_t* master = members_[0]->pcm;
+    int master_card = pcm_card(master);
+    for (size_t i = 1; i < members_.size(); ++i) {
+        Member& m = *members_[i];
+        int err = snd_pcm_link(master, m.pcm);
+        m.linked = err == 0;
+        m.hw_synced = m.linked && master_card >= 0 && pcm_card(m.pcm) == master_card && m.rate == sample_rate_;
+        m.nominal = static_cast<double>(m.rate) / sample_rate_;
+        if (m.hw_synced) {
+            LOG_INFO("Audio %s linked to %s on the same card, no drift correction", m.device.c_str(),
+                     members_[0]->device.c_str());
+        } else {
+            LOG_INFO("Audio %s %s, correcting drift against %s", m.device.c_str(),
+                     m.linked ? "linked (separate clock)" : "not linkable, started separately",
+                     members_[0]->device.c_str());
+        }
+    }
+    return true;
+}
+
+void CaptureGroup::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    close_locked();
+}
+
+void CaptureGroup::close_locked() {
+    if (members_.empty()) return;
+    LOG_INFO("Stopping and closing ALSA capture");
+    for (size_t i = 0; i < members_.size(); ++i) {
+        Member& m = *members_[i];
+        if (m.linked) snd_pcm_unlink(m.pcm);
+        snd_pcm_drop(m.pcm);
+        snd_pcm_close(m.pcm);
+    }
+    members_.clear();
+    failed_ = 0;
+}
+
+// Starts the master (and with it every linked device), then the others as
+// close behind as we can, and primes every channel with the cushion
+bool CaptureGroup::start_all() {
+    int err = snd_pcm_start(members_[0]->pcm);
+    if (err < 0) {
+        failed_ = 0;
+        return false;
+    }
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < members_.size(); ++i) {
+        Member& m = *members_[i];
+        if (i > 0 && snd_pcm_state(m.pcm) == SND_PCM_STATE_PREPARED && snd_pcm_start(m.pcm) < 0) {
+            failed_ = i;
+            return false;
+        }
+        m.count = 0;
+        m.phase = 0;
+        m.error = 0;
+        m.last_data_ns = now;
+        m.pad(cushion_);
+    }
+    return true;
+}
+
+void CaptureGroup::restart() {
+    for (size_t i = 0; i < members_.size(); ++i) snd_pcm_drop(members_[i]->pcm);
+    for (size_t i = 0; i < members_.size(); ++i) snd_pcm_prepare(members_[i]->pcm);
+}
+
+long CaptureGroup::fill(Member& m, long frames, int stall_ms) {
+    if (&m == members_[0].get()) {
+        long got = 0;
+        while (got < frames) {
+            long err = snd_pcm_wait(m.pcm, stall_ms);
+            if (err == 0) err = -ETIMEDOUT;
+            if (err > 0) err = snd_pcm_readi(m.pcm, m.fifo.data() + m.count, frames - got);
+            if (err < 0) return err;
+            m.count += err;
+            got += err;
+        }
+        return got;
+    }
+
+    // The others deliver on their own clock; take whatever they have
+    snd_pcm_sframes_t avail = snd_pcm_avail(m.pcm);
+    if (avail < 0) return avail;
+    uint64_t now = monotonic_ns();
+    if (avail == 0) {
+        return now - m.last_data_ns >= stall_ms * 1000000ull ? -ETIMEDOUT : 0;
+    }
+    long room = static_cast<long>(m.fifo.size()) - m.count;
+    if (avail > room) {
+        m.consume(avail - room);
+        m.slips += avail - room;
+    }
+    long err = snd_pcm_readi(m.pcm, m.fifo.data() + m.count, avail);
+    if (err < 0) return err;
+    m.count += err;
+    m.last_data_ns = now;
+    return err;
+}
+
+void CaptureGroup::measure() {
+    snd_pcm_status_t* status;
+    snd_pcm_status_alloca(&status);
+    std::vector<uint64_t>& stamps = status_ns_;
+    for (size_t i = 0; i < members_.size(); ++i) {
+        Member& m = *members_[i];
+        snd_htimestamp_t ts;
+        stamps[i] = 0;
+        m.unread = 0;
+        if (snd_pcm_status(m.pcm, status) < 0) continue;
+        snd_pcm_status_get_htstamp(status, &ts);
+        m.unread = snd_pcm_status_get_avail(status);
+        stamps[i] = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+    // The pointer moves at least once a period, so an older stamp is stale
+    uint64_t now = monotonic_ns();
+    double max_s = static_cast<double>(period_size_) / sample_rate_;
+    for (size_t i = 0; i < members_.size(); ++i) {
+        if (stamps[i] == 0 || stamps[i] >= now) continue;
+        members_[i]->unread += std::min((now - stamps[i]) / 1e9, max_s) * members_[i]->rate;
+    }
+}
+
+void CaptureGroup::resample(Member& m, int16_t* out, size_t stride, long frames, double master_level) {
+    double ratio = m.nominal;
+    if (&m != members_[0].get() && !m.hw_synced) {
+        // Level left once this chunk is taken, against the master's at the
+        // same instant (its cushion plus what it has captured but not
+        // delivered); both include the position since the last pointer update
+        double e = m.count + m.unread - m.phase - frames * m.nominal - master_level * m.nominal;
+        if (std::fabs(e) > 2 * cushion_) {
+            // Far off (a device hiccup, not drift): realign at once
+            long n = std::lround(std::fabs(e));
+            if (e > 0) m.consume(n);
+            else m.pad(n);
+            m.slips += n;
+            m.error = e = 0;
+        }
+        m.error += (e - m.error) * LEVEL_SMOOTHING;
+        double p = m.error / (sample_rate_ * P_SECONDS);
+        m.drift += p * frames / sample_rate_ / I_SECONDS;
+        m.drift = std::max(-MAX_DRIFT, std::min(MAX_DRIFT, m.drift));
+        ratio = m.nominal * (1.0 + m.drift + p);
+        m.drift_ppm = m.drift * 1e6;
+    }
+
+    const int16_t* s = m.fifo.data();
+    long used;
+    if (ratio == 1.0 && m.phase == 0) {
+        long n = std::min(frames, m.count);
+        for (long f = 0; f < n; ++f) out[f * stride] = s[f];
+        for (long f = n; f < frames; ++f) out[f * stride] = n ? s[n - 1] : 0;
+        used = frames;
+    } else {
+        // Linear interpolation: cheap, and at ratios within a fraction of a
+        // percent of 1 its images sit far above the band of interest
+        double pos = m.phase;
+        long last = m.count - 1;
+        for (long f = 0; f < frames; ++f, pos += ratio) {
+            long i = static_cast<long>(pos);
+            double frac = pos - i;
+            if (i < last) out[f * stride] = static_cast<int16_t>(std::lrint(s[i] + frac * (s[i + 1] - s[i])));
+            else out[f * stride] = last >= 0 ? s[last] : 0;
+        }
+        used = static_cast<long>(pos);
+        m.phase = pos - used;
+    }
+    if (used > m.count) {
+        // Ran dry: the held samples stand in for the missing ones
+        m.slips += used - m.count;
+        m.phase = 0;
+    }
+    m.consume(used);
+}
+
+long CaptureGroup::read(int16_t* out, long frames, int stall_ms) {
+    if (members_.empty()) return -ENODEV;
+    failed_ = 0;
+    snd_pcm_t* master = members_[0]->pcm;
+
+    if (members_.size() == 1) {
+        // Watchdog: a running card that delivers no period within stall_ms
+        // has stopped (unplugged, firmware hang); a plain snd_pcm_readi
+        // would block forever
+        long err = 1;
+        if (snd_pcm_state(master) == SND_PCM_STATE_RUNNING) {
+            err = snd_pcm_wait(master, stall_ms);
+            if (err == 0) err = -ETIMEDOUT;
+        }
+        if (err > 0) err = snd_pcm_readi(master, out, frames);
+        return err;
+    }
+
+    // The largest backlog: the cushion, a full ALSA buffer behind and a
+    // chunk at a fast device's rate; sized once per chunk length
+    size_t need = cushion_ + static_cast<size_t>(frames * 2 + 8 * period_size_);
+    for (size_t i = 0; i < members_.size(); ++i) {
+        if (members_[i]->fifo.size() < need) members_[i]->fifo.resize(need);
+    }
+    status_ns_.resize(members_.size());
+
+    if (snd_pcm_state(master) == SND_PCM_STATE_PREPARED && !start_all()) return -EIO;
+    for (size_t i = 0; i < members_.size(); ++i) {
+        long err = fill(*members_[i], frames, stall_ms);
+        if (err < 0) {
+            failed_ = i;
+            return err;
+        }
+    }
+    measure();
+    double master_level = members_[0]->count - frames + members_[0]->unread;
+    for (size_t i = 0; i < members_.size(); ++i) {
+        resample(*members_[i], out + i, members_.size(), frames, master_level);
+    }
+    return frames;
+}
+
+int CaptureGroup::recover(int err) {
+    if (members_.empty()) return err;
+    int rc = snd_pcm_recover(members_[failed_]->pcm, err, 1);
+    if (rc == 0 && members_.size() > 1) restart();
+    return rc;
+}
+
+std::vector<CaptureGroup::DeviceStats> CaptureGroup::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<DeviceStats> result;
+    for (size_t i = 0; i < members_.size(); ++i) {
+        const Member& m = *members_[i];
+        DeviceStats s;
+        s.device = m.device;
+        s.hw_synced = i == 0 || m.hw_synced;
+        s.drift_ppm = m.drift_ppm;
+        s.slips = m.slips;
+        result.push_back(s);
+    }
+    return result;
+}
@@ -0,0 +1,85 @@
+#ifndef NLX_AUDIO_CAPTURE_GROUP_H
+#define NLX_AUDIO_CAPTURE_GROUP_H
+
+#include <alsa/asoundlib.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One or more ALSA capture PCMs (mono S16 each) read as a single
+// sample-aligned stream with one interleaved channel per device.
+//
+// The first device is the clock master. The others are tied to it with
+// snd_pcm_link so all start on the same trigger; a linked device on the
+// master's own card shares its sample clock and is copied through as is.
+// Any other device runs on its own crystal, so its clock drifts against the
+// master by some tens of ppm. For those the buffered-sample level, refined
+// with the ALSA pointer timestamps to below a period, is compared with the
+// master's every chunk, and a PI loop steers a linear-interpolation
+// resampler to hold it, which keeps the channels aligned indefinitely; the
+// loop's integral term is the drift estimate. Every channel, the master's
+// included, is delayed by the same small cushion (two periods) that absorbs
+// the devices' period jitter.
+//
+// With a single device, reads go straight to the PCM as before: no cushion,
+// no copies.
+class CaptureGroup {
+public:
+    CaptureGroup();
+    ~CaptureGroup();
+
+    // Opens and prepares every device at the master's rate (updated to what
+    // the hardware gave). Returns false and leaves nothing open on failure.
+    bool open(const std::vector<std::string>& devices, unsigned int& sample_rate, unsigned int period_size,
+              unsigned int n_periods);
+    void close();
+    bool is_open() const { return !members_.empty(); }
+
+    // Channels per frame: one per device
+    unsigned int channels() const { return static_cast<unsigned int>(members_.size()); }
+
+    // Reads `frames` interleaved frames into `out`, starting the devices if
+    // needed. The master blocks for at most stall_ms; a stalled master or
+    // other device yields -ETIMEDOUT. Returns the frame count, or a negative
+    // ALSA error from whichever device failed.
+    long read(int16_t* out, long frames, int stall_ms);
+
+    // snd_pcm_recover on the device that failed the last read. With several
+    // devices all of them are then restarted together so they realign.
+    int recover(int err);
+
+    // Per-device health, safe to read from another thread
+    struct DeviceStats {
+        std::string device;
+        bool hw_synced;   // Linked on the master's card: same clock, no resampling
+        double drift_ppm; // Device clock relative to the master's
+        unsigned long slips; // Samples dropped or repeated after a gross misalignment
+    };
+    std::vector<DeviceStats> stats() const;
+
+private:
+    CaptureGroup(const CaptureGroup&);
+    CaptureGroup& operator=(const CaptureGroup&);
+
+    struct Member;
+
+    void close_locked();
+    bool start_all();
+    void restart();
+    long fill(Member& member, long frames, int stall_ms);
+    void measure();
+    void resample(Member& member, int16_t* out, size_t stride, long frames, double master_level);
+
+    mutable std::mutex mutex_; // Guards members_ against stats() during open/close
+    std::vector<std::unique_ptr<Member> > members_;
+    unsigned int sample_rate_;
+    unsigned int period_size_;
+    long cushion_;   // Frames every channel is delayed by
+    size_t failed_;  // Member whose error the last read returned
+    std::vector<uint64_t> status_ns_; // Scratch for measure()
+};
+
+#endif
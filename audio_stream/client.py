@@ -1,5 +1,6 @@
 import sys
 import socket
+import ssl
 import numpy as np
 from PyQt5.QtWidgets import (QApplication, QMainWindow, QWidget, QVBoxLayout,
                              QHBoxLayout, QLabel, QLineEdit, QPushButton, QComboBox, QCheckBox)
@@ -11,6 +12,29 @@ import wave
 from datetime import datetime
 import logging
 import threading
+import os
+
+# Native receive core from native_client (`make python` there); the
+# pure-Python path below is used when it has not been built
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "native_client"))
+try:
+    import nlxclient
+except ImportError:
+    nlxclient = None
+
+# TLS for servers started with --tls-cert. The server certificate is checked
+# against $NLX_TLS_CA when set; otherwise the link is encrypted but the
+# server is not authenticated.
+TLS_CA = os.environ.get("NLX_TLS_CA", "")
+
+def tls_wrap(sock, host):
+    if TLS_CA:
+        context = ssl.create_default_context(cafile=TLS_CA)
+    else:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+        context.check_hostname = False
+        context.verify_mode = ssl.CERT_NONE
+    return context.wrap_socket(sock, server_hostname=host)
 
 # Setup logging
 logging.basicConfig(level=logging.DEBUG, format='%(asctime)s - %(levelname)s - %(message)s')
@@ -28,10 +52,11 @@ class StreamThread(QThread):
     data_received = pyqtSignal(np.ndarray)
     error_occurred = pyqtSignal(str)
 
-    def __init__(self, host, port, sample_rate, play_audio=True):
+    def __init__(self, host, port, sample_rate, play_audio=True, tls=False):
         super().__init__()
         self.host = host
         self.port = port
+        self.tls = tls
         self.sample_rate = sample_rate
         self.play_audio = play_audio
         self.running = True
@@ -40,6 +65,7 @@ class StreamThread(QThread):
         self.p = None
         self.stream = None
         self.sock = None
+        self.native = None
         self.lock = threading.Lock()
         if sample_rate < 22050:
             logging.warning(f"Low sample rate ({sample_rate} Hz) may cause delays. Consider matching server rate (e.g., 44100 Hz).")
@@ -143,7 +169,10 @@ class StreamThread(QThread):
         with self.lock:
             logging.debug("Synchronizing stream")
             # Flush socket buffer
-            if self.sock is not None:
+            if self.native is not None:
+                dropped = self.native.flush()
+                logging.debug(f"Socket buffer flushed ({dropped} bytes)")
+            elif self.sock is not None:
                 try:
                     self.sock.setblocking(False)
                     while True:
@@ -175,11 +204,53 @@ class StreamThread(QThread):
                 logging.debug("Recording buffer cleared for sync")
 
     def run(self):
+        if nlxclient is not None:
+            self.run_native()
+        else:
+            self.run_python()
+
+    def run_native(self):
+        logging.debug("StreamThread started (native)")
+        try:
+            native = nlxclient.AudioStream(self.host, self.port, chunk=FRAMES_PER_BUFFER, tls=self.tls, tls_ca=TLS_CA)
+            with self.lock:
+                self.native = native
+                if not self.running:
+                    native.stop()
+            logging.debug(f"Connected to {self.host}:{self.port}")
+
+            # Blocks in C++ without the GIL until a whole chunk arrived;
+            # stop() unblocks it and read() returns None
+            while self.running:
+                samples = native.read()
+                if samples is None:
+                    break
+                self.handle_samples(samples, None)
+        except Exception as e:
+            logging.error(f"StreamThread error: {e}")
+            self.error_occurred.emit(str(e))
+        finally:
+            self.cleanup()
+
+    def handle_samples(self, samples, data):
+        with self.lock:
+            if self.play_audio and self.stream is not None and self.running:
+                try:
+                    self.stream.write(data if data is not None else samples.tobytes())
+                except Exception as e:
+                    logging.error(f"Error writing to stream: {e}")
+            if self.recording:
+                self.recorded_samples.append(samples.copy())
+        self.data_received.emit(samples)
+
+    def run_python(self):
         logging.debug("StreamThread started")
         try:
             self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
             self.sock.settimeout(SOCKET_TIMEOUT)
             self.sock.connect((self.host, self.port))
+            if self.tls:
+                self.sock = tls_wrap(self.sock, self.host)
             logging.debug(f"Connected to {self.host}:{self.port}")
 
             while self.running:
@@ -196,15 +267,7 @@ class StreamThread(QThread):
                 if len(samples) != FRAMES_PER_BUFFER:
                     continue
 
-                with self.lock:
-                    if self.play_audio and self.stream is not None and self.running:
-                        try:
-                            self.stream.write(data)
-                        except Exception as e:
-                            logging.error(f"Error writing to stream: {e}")
-                    if self.recording:
-                        self.recorded_samples.append(samples.copy())
-                self.data_received.emit(samples)
+                self.handle_samples(samples, data)
 
             self.sock.close()
             self.sock = None
@@ -218,6 +281,7 @@ class StreamThread(QThread):
     def cleanup(self):
         logging.debug("StreamThread cleanup started")
         with self.lock:
+            self.native = None
             if self.sock is not None:
                 try:
                     self.sock.close()
@@ -247,6 +311,8 @@ class StreamThread(QThread):
     def stop(self):
         with self.lock:
             self.running = False
+            if self.native is not None:
+                self.native.stop()
             if self.sock is not None:
                 try:
                     self.sock.close()
@@ -328,6 +394,7 @@ class AudioClient(QMainWindow):
         self.sample_rate_combo.setCurrentText("44100")
         self.play_audio_check = QCheckBox("Play Audio")
         self.play_audio_check.setChecked(True)
+        self.tls_check = QCheckBox("TLS")
         self.connect_button = QPushButton("Connect")
         self.record_button = QPushButton("Record")
         self.sync_button = QPushButton("Sync")
@@ -339,6 +406,7 @@ class AudioClient(QMainWindow):
         input_layout.addWidget(QLabel("Sample Rate:"))
         input_layout.addWidget(self.sample_rate_combo)
         input_layout.addWidget(self.play_audio_check)
+        input_layout.addWidget(self.tls_check)
         input_layout.addWidget(self.connect_button)
         input_layout.addWidget(self.record_button)
         input_layout.addWidget(self.sync_button)
@@ -436,7 +504,8 @@ class AudioClient(QMainWindow):
             return
 
         logging.debug(f"Starting new stream: {host}:{port}, sample_rate={self.sample_rate}")
-        self.stream_thread = StreamThread(host, port, self.sample_rate, self.play_audio_check.isChecked())
+        self.stream_thread = StreamThread(host, port, self.sample_rate, self.play_audio_check.isChecked(),
+                                          self.tls_check.isChecked())
         self.stream_thread.data_received.connect(self.waveform.update_plot)
         self.stream_thread.error_occurred.connect(self.handle_error)
         self.stream_thread.start()
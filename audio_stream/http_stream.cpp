@@ -0,0 +1,308 @@
+#include "http_stream.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "clock.h"
+#include "log.h"
+
+static const int REQUEST_TIMEOUT_MS = 2000;
+static const size_t MAX_PENDING = 16;
+static const size_t WAV_HEADER_SIZE = 44;
+
+static void put_le16(uint8_t* p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+// RIFF/WAVE header for S16_LE PCM of unknown length: players read until
+// the connection ends
+static void wav_header(uint8_t* p, unsigned int sample_rate, unsigned int channels) {
+    memcpy(p, "RIFF", 4);
+    put_le32(p + 4, 0xffffffffu);
+    memcpy(p + 8, "WAVEfmt ", 8);
+    put_le32(p + 16, 16);
+    put_le16(p + 20, 1); // PCM
+    put_le16(p + 22, static_cast<uint16_t>(channels));
+    put_le32(p + 24, sample_rate);
+    put_le32(p + 28, sample_rate * channels * 2);
+    put_le16(p + 32, static_cast<uint16_t>(channels * 2));
+    put_le16(p + 34, 16);
+    memcpy(p + 36, "data", 4);
+    put_le32(p + 40, 0xffffffffu);
+}
+
+// Sends all of a short response on a fresh socket; false if it did not fit
+static bool send_all(int fd, const void* data, size_t len) {
+    return send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT) == static_cast<ssize_t>(len);
+}
+
+HttpAudioStream::HttpAudioStream()
+    : listen_fd_(-1), sample_rate_(0), channels_(0), chunk_bytes_(0), count_(0), dropped_(0) {}
+
+HttpAudioStream::~HttpAudioStream() {
+    close_all();
+}
+
+bool HttpAudioStream::listen(int port, unsigned int sample_rate, unsigned int channels, size_t chunk_bytes) {
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    chunk_bytes_ = chunk_bytes;
+    pending_.reserve(MAX_PENDING);
+    listeners_.reserve(MAX_LISTENERS);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("HTTP socket creation failed: %s", strerror(errno));
+        return false;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || ::listen(fd, 8) < 0) {
+        LOG_ERROR("HTTP listener on port %d failed: %s", port, strerror(errno));
+        close(fd);
+        return false;
+    }
+    listen_fd_ = fd;
+    LOG_INFO("HTTP listening on port %d: GET /live.wav (%u Hz, %u channel(s))", port, sample_rate, channels);
+    return true;
+}
+
+void HttpAudioStream::poll(int timeout_ms) {
+    // Listeners the capture thread gave up on are removed here, so it never
+    // frees memory itself
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = listeners_.size(); i-- > 0;) {
+            if (listeners_[i].fd >= 0) continue;
+            LOG_INFO("HTTP listener %s disconnected", listeners_[i].ip.c_str());
+            listeners_.erase(listeners_.begin() + i);
+        }
+        count_ = listeners_.size();
+    }
+
+    struct pollfd pfds[1 + MAX_PENDING];
+    nfds_t n = 0;
+    pfds[n].fd = listen_fd_;
+    pfds[n].events = POLLIN;
+    ++n;
+    for (size_t i = 0; i < pending_.size(); ++i, ++n) {
+        pfds[n].fd = pending_[i].fd;
+        pfds[n].events = POLLIN;
+    }
+    int ready = ::poll(pfds, n, timeout_ms);
+    if (ready < 0) return;
+
+    uint64_t now = monotonic_ns();
+    for (size_t i = pending_.size(); i-- > 0;) {
+        bool done;
+        if (pfds[1 + i].revents) {
+            done = !read_request(pending_[i]);
+        } else {
+            done = now >= pending_[i].deadline_ns;
+            if (done) LOG_ERROR("HTTP request from %s timed out", pending_[i].ip.c_str());
+        }
+        if (done) pending_.erase(pending_.begin() + i);
+    }
+    if (pfds[0].revents & POLLIN) accept_pending();
+}
+
+void HttpAudioStream::accept_pending() {
+    while (pending_.size() < MAX_PENDING) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept4(listen_fd_, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) LOG_ERROR("HTTP accept failed: %s", strerror(errno));
+            return;
+        }
+        pending_.push_back(Pending());
+        Pending& pending = pending_.back();
+        pending.fd = fd;
+        pending.deadline_ns = monotonic_ns() + REQUEST_TIMEOUT_MS * 1000000ull;
+        pending.len = 0;
+        pending.ip = inet_ntoa(addr.sin_addr);
+    }
+}
+
+bool HttpAudioStream::read_request(Pending& pending) {
+    ssize_t n = recv(pending.fd, pending.request + pending.len, sizeof(pending.request) - 1 - pending.len, 0);
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+        close(pending.fd);
+        return false;
+    }
+    pending.len += n;
+    pending.request[pending.len] = '\0';
+    if (!strstr(pending.request, "\r\n\r\n") && !strstr(pending.request, "\n\n")) {
+        if (pending.len < sizeof(pending.request) - 1) return true;
+        static const char too_large[] = "HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\n\r\n";
+        send_all(pending.fd, too_large, sizeof(too_large) - 1);
+        close(pending.fd);
+        return false;
+    }
+
+    // Request line: <method> <path> HTTP/<version>; a query string is ignored
+    char method[16], path[256], version[16];
+    if (sscanf(pending.request, "%15s %255s HTTP/%15s", method, path, version) != 3) {
+        static const char bad[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+        send_all(pending.fd, bad, sizeof(bad) - 1);
+        close(pending.fd);
+        return false;
+    }
+    char* query = strchr(path, '?');
+    if (query) *query = '\0';
+    answer(pending, strcmp(version, "1.0") != 0, path, method);
+    return false;
+}
+
+void HttpAudioStream::answer(Pending& pending, bool http11, const char* path, const char* method) {
+    const char* status = nullptr;
+    if (strcmp(path, "/live.wav") != 0) status = "404 Not Found";
+    else if (strcmp(method, "GET") != 0) status = "405 Method Not Allowed";
+    else if (count_ >= MAX_LISTENERS) status = "503 Service Unavailable";
+    if (status) {
+        char response[128];
+        int len = snprintf(response, sizeof(response), "HTTP/1.%d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                           http11 ? 1 : 0, status);
+        send_all(pending.fd, response, len);
+        LOG_INFO("HTTP %s %s from %s: %s", method, path, pending.ip.c_str(), status);
+        close(pending.fd);
+        return;
+    }
+
+    // Headers and the WAV header (as the first chunk) in one send
+    char response[512];
+    int len = snprintf(response, sizeof(response),
+                       "HTTP/1.%d 200 OK\r\n"
+                       "Content-Type: audio/wav\r\n"
+                       "Cache-Control: no-cache, no-store\r\n"
+                       "%s"
+                       "Connection: close\r\n\r\n",
+                       http11 ? 1 : 0, http11 ? "Transfer-Encoding: chunked\r\n" : "");
+    if (http11) len += snprintf(response + len, sizeof(response) - len, "%zx\r\n", WAV_HEADER_SIZE);
+    wav_header(reinterpret_cast<uint8_t*>(response + len), sample_rate_, channels_);
+    len += WAV_HEADER_SIZE;
+    if (http11) len += snprintf(response + len, sizeof(response) - len, "\r\n");
+    if (!send_all(pending.fd, response, len)) {
+        LOG_ERROR("HTTP response to %s failed: %s", pending.ip.c_str(), strerror(errno));
+        close(pending.fd);
+        return;
+    }
+
+    Listener listener;
+    listener.fd = pending.fd;
+    listener.chunked = http11;
+    listener.rest.reserve(chunk_bytes_ + 16); // Chunk size line, payload and CRLF
+    listener.rest_offset = 0;
+    listener.ip = pending.ip;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listeners_.push_back(std::move(listener));
+        count_ = listeners_.size();
+    }
+    LOG_INFO("HTTP listener %s on /live.wav%s", pending.ip.c_str(), http11 ? "" : " (HTTP/1.0)");
+}
+
+bool HttpAudioStream::flush_rest(Listener& listener) {
+    size_t left = listener.rest.size() - listener.rest_offset;
+    ssize_t n = send(listener.fd, listener.rest.data() + listener.rest_offset, left, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    listener.rest_offset += n;
+    if (listener.rest_offset == listener.rest.size()) {
+        listener.rest.clear();
+        listener.rest_offset = 0;
+    }
+    return true;
+}
+
+void HttpAudioStream::broadcast(const int16_t* samples, size_t bytes) {
+    if (count_ == 0) return;
+    char size_line[16];
+    int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", bytes);
+    static const char crlf[] = "\r\n";
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < listeners_.size(); ++i) {
+        Listener& listener = listeners_[i];
+        if (listener.fd < 0) continue;
+        bool ok = true;
+        if (!listener.rest.empty()) ok = flush_rest(listener);
+        if (ok && !listener.rest.empty()) {
+            ++dropped_;
+            continue;
+        }
+
+        struct iovec iov[3];
+        int iovcnt = 0;
+        if (listener.chunked) {
+            iov[iovcnt].iov_base = size_line;
+            iov[iovcnt++].iov_len = size_len;
+        }
+        iov[iovcnt].iov_base = const_cast<int16_t*>(samples);
+        iov[iovcnt++].iov_len = bytes;
+        if (listener.chunked) {
+            iov[iovcnt].iov_base = const_cast<char*>(crlf);
+            iov[iovcnt++].iov_len = 2;
+        }
+        size_t total = 0;
+        for (int k = 0; k < iovcnt; ++k) total += iov[k].iov_len;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n = ok ? sendmsg(listener.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) : -1;
+        if (n < 0 && ok && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            ++dropped_;
+            continue;
+        }
+        if (n < 0) {
+            // Closed here, removed by the main loop
+            close(listener.fd);
+            listener.fd = -1;
+            continue;
+        }
+        if (static_cast<size_t>(n) == total) continue;
+
+        // Keep the unsent end; it goes out before the next chunk
+        for (int k = 0; k < iovcnt; ++k) {
+            const uint8_t* base = static_cast<const uint8_t*>(iov[k].iov_base);
+            size_t skip = std::min(static_cast<size_t>(n), iov[k].iov_len);
+            listener.rest.insert(listener.rest.end(), base + skip, base + iov[k].iov_len);
+            n -= skip;
+        }
+        listener.rest_offset = 0;
+    }
+}
+
+void HttpAudioStream::close_all() {
+    for (size_t i = 0; i < pending_.size(); ++i) close(pending_[i].fd);
+    pending_.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < listeners_.size(); ++i) {
+        if (listeners_[i].fd >= 0) close(listeners_[i].fd);
+    }
+    listeners_.clear();
+    count_ = 0;
+    if (listen_fd_ >= 0) close(listen_fd_);
+    listen_fd_ = -1;
+}
@@ -0,0 +1,87 @@
+#ifndef NLX_AUDIO_HTTP_STREAM_H
+#define NLX_AUDIO_HTTP_STREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Live capture over plain HTTP: "GET /live.wav" is answered with a WAV
+// header (sizes set to the maximum, as for a stream of unknown length)
+// followed by the PCM as it is captured, chunk-encoded for HTTP/1.1 and
+// delimited by the connection for HTTP/1.0. curl, ffplay and browsers play
+// it directly.
+//
+// No thread is dedicated to HTTP. Accepting and reading requests is a step
+// of the server's main loop (poll()); the capture thread hands every chunk
+// to broadcast(), which costs one non-blocking sendmsg per listener. A
+// listener whose socket is full misses chunks rather than delaying capture.
+// After a partial send, the rest of that chunk goes out first, so the
+// chunk framing stays intact.
+class HttpAudioStream {
+public:
+    static const size_t MAX_LISTENERS = 32;
+
+    HttpAudioStream();
+    ~HttpAudioStream();
+
+    // Opens the non-blocking listener. The format goes into the WAV header;
+    // chunk_bytes is the largest broadcast() payload.
+    bool listen(int port, unsigned int sample_rate, unsigned int channels, size_t chunk_bytes);
+    bool enabled() const { return listen_fd_ >= 0; }
+
+    // Main loop step: accepts connections and answers complete requests,
+    // waiting up to timeout_ms for activity
+    void poll(int timeout_ms);
+
+    // Capture thread: sends one chunk of interleaved S16_LE samples to every
+    // listener
+    void broadcast(const int16_t* samples, size_t bytes);
+
+    size_t listeners() const { return count_; }
+    uint64_t dropped_chunks() const { return dropped_; }
+
+    void close_all();
+
+private:
+    HttpAudioStream(const HttpAudioStream&);
+    HttpAudioStream& operator=(const HttpAudioStream&);
+
+    // Connection whose request has not arrived yet
+    struct Pending {
+        int fd;
+        uint64_t deadline_ns;
+        size_t len;
+        char request[1024];
+        std::string ip;
+    };
+
+    struct Listener {
+        int fd;
+        bool chunked;
+        std::vector<uint8_t> rest; // Unsent end of a partly sent chunk
+        size_t rest_offset;
+        std::string ip;
+    };
+
+    void accept_pending();
+    // Returns false once the connection is done with (answered or failed)
+    bool read_request(Pending& pending);
+    void answer(Pending& pending, bool http11, const char* path, const char* method);
+    bool flush_rest(Listener& listener);
+
+    int listen_fd_;
+    unsigned int sample_rate_;
+    unsigned int channels_;
+    size_t chunk_bytes_;
+    std::vector<Pending> pending_; // Main loop only
+
+    std::mutex mutex_; // Guards listeners_ between the main loop and the capture thread
+    std::vector<Listener> listeners_;
+    std::atomic<size_t> count_;
+    std::atomic<uint64_t> dropped_;
+};
+
+#endif
@@ -6,79 +6,215 @@
 #include <iostream>
 #include <cstring>
 #include <ctime>
+#include <algorithm>
 #include <vector>
 #include <thread>
 #include <atomic>
 #include <csignal>
 #include <getopt.h>
+#include <cstdio>
+
+#include "clock.h"
+#include "log.h"
+#include "alloc_check.h"
+#include "synthetic_audio.h"
+#include "socket_activation.h"
+#include "rt_profile.h"
+#include "tls.h"
+#include "capture_group.h"
+#include "http_stream.h"
 
 std::atomic<bool> running(true);
 std::atomic<bool> cleaned_up(false); // Prevent double cleanup
-snd_pcm_t* global_capture_handle = nullptr;
+std::atomic<int> active_clients(0);
+CaptureGroup capture_group;
+HttpAudioStream http_stream;
 int global_server_fd = -1;
 
-void log_message(const std::string& message) {
-    time_t now = time(nullptr);
-    char time_str[26];
-    ctime_r(&now, time_str);
-    time_str[strlen(time_str) - 1] = '\0'; // Remove newline
-    std::cout << "[" << time_str << "] " << message << std::endl;
+// Set while the capture thread serves only HTTP listeners; a TCP client
+// then asks it to stop (capture_handover) and starts a thread of its own
+std::atomic<bool> http_only_capture(false);
+std::atomic<bool> capture_handover(false);
+
+// Device configuration, kept so a client thread can reopen the cards in place
+struct CaptureParams {
+    std::vector<std::string> devices;
+    unsigned int sample_rate;
+    unsigned int period_size;
+    unsigned int n_periods;
+};
+CaptureParams capture_params;
+
+// Device recoveries since startup, reported in the logs
+std::atomic<unsigned long> recoveries(0);
+std::atomic<unsigned long long> recovery_max_ms(0);
+
+static const int REOPEN_BACKOFF_MIN_MS = 100;
+static const int REOPEN_BACKOFF_MAX_MS = 2000;
+static const int RECOVER_ATTEMPTS = 3; // snd_pcm_recover tries before reopening the device
+static const int TLS_HANDSHAKE_MS = 5000;
+
+bool setup_capture(const std::vector<std::string>& devices, unsigned int& sample_rate,
+                   unsigned int period_size, unsigned int n_periods);
+void close_capture();
+
+// Non-blocking send of one chunk; returns false once the client is gone
+static bool send_chunk(int client_socket, const int16_t* data, unsigned int bytes) {
+    ssize_t sent = send(client_socket, data, bytes, 0);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true; // Drop the chunk rather than block capture
+        }
+        LOG_ERROR("Failed to send data to client: %s", strerror(errno));
+        return false;
+    } else if (sent != static_cast<ssize_t>(bytes)) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Incomplete send: %zd bytes", sent);
+    }
+    return true;
 }
 
-void handle_client(int client_socket, snd_pcm_t* capture_handle, unsigned int buffer_size, const std::string& client_ip) {
-    log_message("Client connected from " + client_ip);
+// Hands a chunk to the TCP client, if any, and to the HTTP listeners. When
+// the client goes, capture carries on for the listeners; false once nobody
+// is left.
+static bool deliver(int& client_socket, const int16_t* data, unsigned int bytes) {
+    if (client_socket >= 0 && !send_chunk(client_socket, data, bytes)) {
+        close(client_socket);
+        client_socket = -1;
+    }
+    http_stream.broadcast(data, bytes);
+    if (client_socket >= 0) return true;
+    if (http_stream.listeners() == 0) return false;
+    http_only_capture = true;
+    return true;
+}
 
-    std::vector<int16_t> buffer(buffer_size / 2); // buffer_size is in bytes, samples are 2 bytes
-    int retries = 0;
-    const int max_retries = 5;
+// Streams capture to one client, one interleaved channel per device, and to
+// the HTTP listeners; client_socket is -1 when only they are listening. ALSA
+// errors are recovered in place: first with snd_pcm_recover, then by
+// reopening the devices with backoff. While the
+// card is gone the client gets silence at the stream's own pace, so it stays
+// connected and in sync.
+void handle_client(int client_socket, SyntheticAudio* synthetic, unsigned int buffer_size, int stall_ms,
+                   const TlsServer* tls, const std::string& client_ip) {
+    // This thread reads the card, so it carries the capture role
+    rt_profile_apply("capture");
+    if (client_socket >= 0) LOG_INFO("Client connected from %s", client_ip.c_str());
+    else LOG_INFO("Capturing for HTTP listeners");
+    http_only_capture = client_socket < 0;
+
+    // buffer_size is in bytes of one channel, samples are 2 bytes
+    const long chunk = buffer_size / 2;
+    const uint64_t chunk_ns = chunk * 1000000000ull / capture_params.sample_rate;
+    const unsigned int channels = synthetic ? 1 : capture_params.devices.size();
+    buffer_size *= channels;
+    std::vector<int16_t> buffer(chunk * channels);
+    rt_prefault(buffer.data(), buffer_size);
+    unsigned long overruns = 0;
+    AllocCheck alloc_check("audio period", 50, 500);
+
+    bool lost = false;       // Device failed; streaming silence until it is back
+    uint64_t lost_ns = 0;    // When the outage started
+    uint64_t silence_ns = 0; // Due time of the next silence chunk
+    uint64_t reopen_ns = 0;  // Earliest time of the next reopen attempt
+    int backoff_ms = REOPEN_BACKOFF_MIN_MS;
+    int failures = 0;
+
+    // Handshake while the socket still blocks; afterwards the kernel
+    // encrypts and send_chunk is unchanged
+    std::string tls_error;
+    if (client_socket >= 0 && tls && !tls->accept(client_socket, TLS_HANDSHAKE_MS, tls_error)) {
+        LOG_ERROR("TLS with %s: %s", client_ip.c_str(), tls_error.c_str());
+        close(client_socket);
+        --active_clients;
+        return;
+    }
 
     // Set client socket to non-blocking
-    fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+    if (client_socket >= 0) fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
 
     while (running) {
-        // Check running before blocking call
-        if (!running) break;
+        if (http_only_capture && capture_handover) break;
+        long err;
+        if (synthetic) {
+            err = synthetic->read(buffer.data(), chunk);
+        } else {
+            // A stalled card (unplugged, firmware hang) gives -ETIMEDOUT
+            // after stall_ms instead of blocking forever
+            err = capture_group.read(buffer.data(), chunk, stall_ms);
+        }
 
-        int err = snd_pcm_readi(capture_handle, buffer.data(), buffer_size / 2);
-        if (err == -EPIPE || err == -EOVERFLOW) {
-            log_message("Audio buffer overflow detected, attempting recovery");
-            snd_pcm_recover(capture_handle, err, true);
-            retries++;
-            if (retries >= max_retries) {
-                log_message("Max retries reached, terminating client thread");
-                break;
+        if (err == chunk) {
+            if (lost) {
+                unsigned long long ms = (monotonic_ns() - lost_ns) / 1000000;
+                ++recoveries;
+                if (ms > recovery_max_ms) recovery_max_ms = ms;
+                LOG_INFO("Audio capture recovered after %llu ms (%lu recoveries, max %llu ms)", ms,
+                         recoveries.load(), recovery_max_ms.load());
+                lost = false;
             }
+            failures = 0;
+            if (!deliver(client_socket, buffer.data(), buffer_size)) break;
+            alloc_check.iteration();
             continue;
-        } else if (err < 0) {
-            log_message("Failed to read audio: " + std::string(snd_strerror(err)));
-            retries++;
-            if (retries >= max_retries) {
-                log_message("Max retries reached, terminating client thread");
-                break;
-            }
+        } else if (err >= 0) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Short read: %ld frames", err);
             continue;
-        } else if (err != static_cast<int>(buffer_size / 2)) {
-            log_message("Short read: " + std::to_string(err) + " frames");
+        }
+
+        if (err == -EPIPE || err == -EOVERFLOW) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Audio buffer overflow detected, attempting recovery");
+            ++overruns;
+            if (synthetic || capture_group.recover(err) == 0) continue;
+        } else if (synthetic) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to read audio: %s", snd_strerror(err));
             continue;
         }
 
-        retries = 0; // Reset retries on successful read
+        uint64_t now = monotonic_ns();
+        if (!lost) {
+            LOG_ERROR("Audio capture failed: %s, recovering in place", snd_strerror(err));
+            lost = true;
+            lost_ns = silence_ns = reopen_ns = now;
+            backoff_ms = REOPEN_BACKOFF_MIN_MS;
+        }
 
-        // Non-blocking send
-        ssize_t sent = send(client_socket, buffer.data(), buffer_size, 0);
-        if (sent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                continue; // Retry if non-blocking send would block
+        // Cheap recovery first; a stall or a vanished device needs a reopen
+        if (capture_group.is_open() && err != -ETIMEDOUT && err != -ENODEV && ++failures < RECOVER_ATTEMPTS &&
+            capture_group.recover(static_cast<int>(err)) == 0) {
+            continue;
+        }
+
+        if (now >= reopen_ns) {
+            close_capture();
+            unsigned int rate = capture_params.sample_rate;
+            bool reopened = setup_capture(capture_params.devices, rate, capture_params.period_size,
+                                          capture_params.n_periods);
+            reopen_ns = monotonic_ns() + backoff_ms * 1000000ull;
+            backoff_ms = std::min(backoff_ms * 2, REOPEN_BACKOFF_MAX_MS);
+            if (reopened) {
+                failures = 0;
+                continue;
             }
-            log_message("Failed to send data to client: " + std::string(strerror(errno)));
-            break;
-        } else if (sent != static_cast<ssize_t>(buffer_size)) {
-            log_message("Incomplete send: " + std::to_string(sent) + " bytes");
         }
+
+        // Bridge the gap with silence, paced like the real stream; after a
+        // long stall restart the pacing instead of bursting to catch up
+        now = monotonic_ns();
+        if (silence_ns + chunk_ns < now) silence_ns = now;
+        std::fill(buffer.begin(), buffer.end(), 0);
+        if (!deliver(client_socket, buffer.data(), buffer_size)) break;
+        silence_ns += chunk_ns;
+        struct timespec due;
+        due.tv_sec = silence_ns / 1000000000ull;
+        due.tv_nsec = silence_ns % 1000000000ull;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr);
     }
 
-    close(client_socket);
-    log_message("Client thread terminated and disconnected from " + client_ip);
+    if (client_socket >= 0) close(client_socket);
+    LOG_INFO("Client thread terminated and disconnected from %s (%lu overruns, %lu device recoveries)",
+             http_only_capture ? "HTTP listeners" : client_ip.c_str(), overruns, recoveries.load());
+    http_only_capture = false;
+    --active_clients;
 }
 
 void list_alsa_devices() {
@@ -91,16 +227,16 @@ void list_alsa_devices() {
     snd_ctl_card_info_alloca(&info);
     snd_pcm_info_alloca(&pcminfo);
 
-    log_message("Listing ALSA capture devices:");
+    LOG_INFO("Listing ALSA capture devices:");
     while (snd_card_next(&card) >= 0 && card >= 0) {
         std::string card_name = "hw:" + std::to_string(card);
         if ((err = snd_ctl_open(&ctl, card_name.c_str(), 0)) < 0) {
-            log_message("Cannot open card " + card_name + ": " + snd_strerror(err));
+            LOG_ERROR("Cannot open card %s: %s", card_name.c_str(), snd_strerror(err));
             continue;
         }
 
         if ((err = snd_ctl_card_info(ctl, info)) < 0) {
-            log_message("Cannot get info for card " + card_name + ": " + snd_strerror(err));
+            LOG_ERROR("Cannot get info for card %s: %s", card_name.c_str(), snd_strerror(err));
             snd_ctl_close(ctl);
             continue;
         }
@@ -135,32 +271,111 @@ void list_alsa_devices() {
     }
 }
 
+void close_capture() {
+    capture_group.close();
+}
+
 void cleanup_resources() {
     if (!cleaned_up) {
         cleaned_up = true;
-        log_message("Cleaning up resources");
+        LOG_INFO("Cleaning up resources");
         if (global_server_fd >= 0) {
-            log_message("Closing server socket");
+            LOG_INFO("Closing server socket");
             close(global_server_fd);
             global_server_fd = -1;
         }
-        if (global_capture_handle) {
-            log_message("Stopping and closing ALSA capture");
-            snd_pcm_drop(global_capture_handle);
-            snd_pcm_close(global_capture_handle);
-            global_capture_handle = nullptr;
-        }
+        http_stream.close_all();
+        close_capture();
+    }
+}
+
+// Open and configure the ALSA capture devices into capture_group
+bool setup_capture(const std::vector<std::string>& devices, unsigned int& sample_rate,
+                   unsigned int period_size, unsigned int n_periods) {
+    return capture_group.open(devices, sample_rate, period_size, n_periods);
+}
+
+// Rewrite a key=value snapshot of the capture health; per-device keys get
+// a devN_ prefix
+void write_stats_file(const std::string& path) {
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 60000, "Cannot write stats file %s: %s", tmp.c_str(), strerror(errno));
+        return;
+    }
+    fprintf(f, "recoveries=%lu\n", recoveries.load());
+    fprintf(f, "recovery_max_ms=%llu\n", recovery_max_ms.load());
+    std::vector<CaptureGroup::DeviceStats> devices = capture_group.stats();
+    for (size_t i = 0; i < devices.size(); ++i) {
+        fprintf(f, "dev%zu_device=%s\n", i, devices[i].device.c_str());
+        fprintf(f, "dev%zu_hw_synced=%d\n", i, devices[i].hw_synced ? 1 : 0);
+        fprintf(f, "dev%zu_drift_ppm=%.2f\n", i, devices[i].drift_ppm);
+        fprintf(f, "dev%zu_slips=%lu\n", i, devices[i].slips);
+    }
+    if (http_stream.enabled()) {
+        fprintf(f, "http_listeners=%zu\n", http_stream.listeners());
+        fprintf(f, "http_dropped_chunks=%llu\n", static_cast<unsigned long long>(http_stream.dropped_chunks()));
     }
+    fclose(f);
+    rename(tmp.c_str(), path.c_str());
+}
+
+// Create, bind and listen on the server socket into global_server_fd
+bool create_listener(int port) {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        LOG_ERROR("Socket creation failed: %s", strerror(errno));
+        cleanup_resources();
+        return false;
+    }
+    global_server_fd = server_fd;
+
+    // Set server socket to non-blocking
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+
+    int opt = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        LOG_ERROR("Setsockopt failed: %s", strerror(errno));
+        cleanup_resources();
+        return false;
+    }
+
+    struct sockaddr_in address;
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        LOG_ERROR("Bind failed: %s", strerror(errno));
+        cleanup_resources();
+        return false;
+    }
+
+    if (listen(server_fd, 3) < 0) {
+        LOG_ERROR("Listen failed: %s", strerror(errno));
+        cleanup_resources();
+        return false;
+    }
+
+    LOG_INFO("Server listening on port %d", port);
+    return true;
 }
 
 int main(int argc, char* argv[]) {
     int port = 40918;
+    int http_port = 0; // Also serve GET /live.wav here; 0: off
     unsigned int sample_rate = 44100;
     unsigned int buffer_size = 1024 * 2; // Bytes (1024 samples * 2 bytes)
     unsigned int period_size = 256; // ALSA period size (frames)
     unsigned int n_periods = 4; // Number of periods in buffer
-    std::string device = "hw:0,0";
+    std::vector<std::string> devices; // hw:0,0 unless given; several are merged into one stream
     bool list_devices = false;
+    int idle_timeout_s = 0; // Open ALSA per session and close it after this long without clients
+    unsigned int marker_ms = 0; // Synthetic source only: latency marker interval
+    int stall_ms = 1000; // No period for this long counts as a device failure
+    std::string tls_cert, tls_key;
+    std::string stats_path;
 
     // Parse command-line arguments
     static struct option long_options[] = {
@@ -168,6 +383,17 @@ int main(int argc, char* argv[]) {
         {"sample-rate", required_argument, 0, 's'},
         {"device", required_argument, 0, 'd'},
         {"list-device", no_argument, 0, 'l'},
+        {"period-size", required_argument, 0, 'P'},
+        {"periods", required_argument, 0, 'n'},
+        {"markers", required_argument, 0, 'm'},
+        {"chunk", required_argument, 0, 'c'},
+        {"idle-timeout", required_argument, 0, 'i'},
+        {"stall-timeout", required_argument, 0, 'T'},
+        {"rt-profile", required_argument, 0, 'R'},
+        {"tls-cert", required_argument, 0, 'C'},
+        {"tls-key", required_argument, 0, 'K'},
+        {"stats-file", required_argument, 0, 'F'},
+        {"http-port", required_argument, 0, 'H'},
         {0, 0, 0, 0}
     };
 
@@ -181,14 +407,61 @@ int main(int argc, char* argv[]) {
                 sample_rate = std::stoi(optarg);
                 break;
             case 'd':
-                device = optarg;
+                devices.push_back(optarg);
                 break;
             case 'l':
                 list_devices = true;
                 break;
+            case 'P':
+                period_size = std::stoi(optarg);
+                break;
+            case 'n':
+                n_periods = std::stoi(optarg);
+                break;
+            case 'm':
+                marker_ms = std::stoi(optarg);
+                break;
+            case 'c':
+                buffer_size = std::stoi(optarg) * 2;
+                break;
+            case 'i':
+                idle_timeout_s = std::stoi(optarg);
+                break;
+            case 'T':
+                stall_ms = std::stoi(optarg);
+                break;
+            case 'C':
+                tls_cert = optarg;
+                break;
+            case 'K':
+                tls_key = optarg;
+                break;
+            case 'F':
+                stats_path = optarg;
+                break;
+            case 'H':
+                http_port = std::stoi(optarg);
+                break;
+            case 'R': {
+                std::string error;
+                if (!rt_profile_parse(optarg, error)) {
+                    std::cerr << "Invalid --rt-profile: " << error << std::endl;
+                    return 1;
+                }
+                break;
+            }
             default:
                 std::cerr << "Usage: " << argv[0]
-                << " [--port <port>] [--sample-rate <rate>] [--device <device>] [--list-device]" << std::endl;
+                << " [--port <port>] [--sample-rate <rate>] [--device <device>|synthetic]..."
+                << " [--list-device]"
+                << " [--period-size <frames>] [--periods <n>] [--chunk <frames>] [--markers <ms>]"
+                << " [--idle-timeout <s>] [--stall-timeout <ms>]"
+                << " [--rt-profile <role>=<fifo|rr|other>[:prio][@cpus],...[,mlock]]"
+                << " [--tls-cert <pem> --tls-key <pem>] [--stats-file <file>] [--http-port <port>]\n"
+                << "Repeat --device to capture several cards as one stream with a channel per device,\n"
+                << "clock drift between them corrected; --stats-file exports the drift estimates.\n"
+                << "--http-port also serves the stream as http://<host>:<port>/live.wav (plain HTTP)."
+                << std::endl;
                 return 1;
         }
     }
@@ -198,124 +471,70 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
-    // Setup ALSA
-    snd_pcm_t* capture_handle;
-    snd_pcm_hw_params_t* hw_params;
-    int err;
-
-    if ((err = snd_pcm_open(&capture_handle, device.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-        log_message("Cannot open audio device " + device + ": " + snd_strerror(err));
-        return 1;
-    }
-    global_capture_handle = capture_handle;
-
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(capture_handle, hw_params);
-
-    if ((err = snd_pcm_hw_params_set_access(capture_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-        log_message("Cannot set access type: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
-    }
-
-    if ((err = snd_pcm_hw_params_set_format(capture_handle, hw_params, SND_PCM_FORMAT_S16_LE)) < 0) {
-        log_message("Cannot set sample format: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
-    }
-
-    unsigned int actual_rate = sample_rate;
-    if ((err = snd_pcm_hw_params_set_rate_near(capture_handle, hw_params, &actual_rate, 0)) < 0) {
-        log_message("Cannot set sample rate: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
-    }
-    if (actual_rate != sample_rate) {
-        log_message("Warning: Actual sample rate is " + std::to_string(actual_rate) + " Hz");
-        sample_rate = actual_rate;
-    }
-
-    if ((err = snd_pcm_hw_params_set_channels(capture_handle, hw_params, 1)) < 0) {
-        log_message("Cannot set channel count: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
-    }
-
-    if ((err = snd_pcm_hw_params_set_period_size(capture_handle, hw_params, period_size, 0)) < 0) {
-        log_message("Cannot set period size: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
-    }
-
-    if ((err = snd_pcm_hw_params_set_periods(capture_handle, hw_params, n_periods, 0)) < 0) {
-        log_message("Cannot set periods: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
-    }
-
-    if ((err = snd_pcm_hw_params(capture_handle, hw_params)) < 0) {
-        log_message("Cannot set parameters: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
-    }
-
-    snd_pcm_uframes_t actual_buffer_size;
-    snd_pcm_hw_params_get_buffer_size(hw_params, &actual_buffer_size);
-    log_message("ALSA buffer size: " + std::to_string(actual_buffer_size) + " frames");
-    log_message("ALSA period size: " + std::to_string(period_size) + " frames");
-    log_message("ALSA sample rate: " + std::to_string(sample_rate) + " Hz");
-
-    if ((err = snd_pcm_prepare(capture_handle)) < 0) {
-        log_message("Cannot prepare audio interface: " + std::string(snd_strerror(err)));
-        cleanup_resources();
-        return 1;
+    TlsServer tls;
+    if (!tls_cert.empty() || !tls_key.empty()) {
+        std::string error;
+        if (!tls.load(tls_cert, tls_key.empty() ? tls_cert : tls_key, error)) {
+            LOG_ERROR("%s", error.c_str());
+            return 1;
+        }
+        LOG_INFO("TLS enabled with %s (kernel TLS)", tls_cert.c_str());
     }
 
-    // Setup socket
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        log_message("Socket creation failed: " + std::string(strerror(errno)));
-        cleanup_resources();
+    // Setup capture
+    if (devices.empty()) devices.push_back("hw:0,0");
+    std::string device = devices[0];
+    bool use_synthetic = device == "synthetic";
+    if (use_synthetic && devices.size() > 1) {
+        LOG_ERROR("The synthetic source cannot be combined with other devices");
         return 1;
     }
-    global_server_fd = server_fd;
-
-    // Set server socket to non-blocking
-    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
-
-    opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        log_message("Setsockopt failed: " + std::string(strerror(errno)));
-        cleanup_resources();
+    capture_params.devices = devices;
+    capture_params.period_size = period_size;
+    capture_params.n_periods = n_periods;
+    SyntheticAudio synthetic(sample_rate);
+    if (use_synthetic) {
+        // Model the same period/buffer configuration a card would get
+        synthetic.set_buffering(period_size, n_periods);
+        synthetic.set_markers(marker_ms);
+        LOG_INFO("Using synthetic audio source at %u Hz, period %u x %u", sample_rate, period_size, n_periods);
+        if (marker_ms) LOG_INFO("Injecting latency markers every %u ms", marker_ms);
+    } else if (idle_timeout_s > 0) {
+        LOG_INFO("ALSA device %s%s opens on the first client, closes after %d s idle", device.c_str(),
+                 devices.size() > 1 ? " and the others" : "", idle_timeout_s);
+    } else if (!setup_capture(devices, sample_rate, period_size, n_periods)) {
         return 1;
     }
 
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        log_message("Bind failed: " + std::string(strerror(errno)));
-        cleanup_resources();
+    capture_params.sample_rate = sample_rate;
+    rt_profile_lock_memory();
+
+    // Setup socket; under systemd socket activation the listener is passed in
+    int server_fd = activated_listen_fd();
+    bool socket_activated = server_fd >= 0;
+    if (socket_activated) {
+        global_server_fd = server_fd;
+        fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+        LOG_INFO("Using socket-activated listener");
+    } else if (!create_listener(port)) {
         return 1;
     }
-
-    if (listen(server_fd, 3) < 0) {
-        log_message("Listen failed: " + std::string(strerror(errno)));
+    server_fd = global_server_fd;
+    unsigned int channels = use_synthetic ? 1 : static_cast<unsigned int>(devices.size());
+    if (http_port > 0 && !http_stream.listen(http_port, capture_params.sample_rate, channels, buffer_size * channels)) {
         cleanup_resources();
         return 1;
     }
 
-    log_message("Server listening on port " + std::to_string(port));
-
-    // Signal handler for clean shutdown
+    // Signal handler for clean shutdown; the accept loop notices within 100 ms
+    // and cleans up outside signal context
     signal(SIGINT, [](int) {
         running = false;
-        log_message("Received SIGINT, shutting down...");
-        cleanup_resources();
     });
 
+    std::chrono::steady_clock::time_point last_active = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point next_stats = last_active;
+    std::chrono::steady_clock::time_point next_drift_log = last_active + std::chrono::seconds(60);
     while (running) {
         struct sockaddr_in client_addr;
         socklen_t addr_len = sizeof(client_addr);
@@ -323,11 +542,50 @@ int main(int argc, char* argv[]) {
         if (client_socket < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 if (!running) break;
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (http_stream.enabled()) http_stream.poll(100);
+                else std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+                // HTTP listeners alone keep capture running
+                if (http_stream.listeners() > 0 && active_clients == 0 &&
+                    (use_synthetic || capture_group.is_open() ||
+                     setup_capture(devices, capture_params.sample_rate, period_size, n_periods))) {
+                    ++active_clients;
+                    std::thread(handle_client, -1, use_synthetic ? &synthetic : nullptr, buffer_size, stall_ms,
+                                nullptr, std::string()).detach();
+                }
+
+                // Idle handling: release the card, or when socket-activated
+                // exit and let systemd hold the port until the next client
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if (!stats_path.empty() && now >= next_stats) {
+                    next_stats = now + std::chrono::seconds(10);
+                    write_stats_file(stats_path);
+                }
+                if (devices.size() > 1 && now >= next_drift_log) {
+                    next_drift_log = now + std::chrono::seconds(60);
+                    std::vector<CaptureGroup::DeviceStats> stats = capture_group.stats();
+                    for (size_t i = 1; i < stats.size(); ++i) {
+                        LOG_INFO("Audio %s: drift %.1f ppm%s, %lu samples slipped", stats[i].device.c_str(),
+                                 stats[i].drift_ppm, stats[i].hw_synced ? " (hardware-linked)" : "",
+                                 stats[i].slips);
+                    }
+                }
+                if (active_clients > 0) {
+                    last_active = now;
+                } else if (idle_timeout_s > 0 && now - last_active >= std::chrono::seconds(idle_timeout_s)) {
+                    if (socket_activated) {
+                        LOG_INFO("Idle for %d s, exiting until the next connection", idle_timeout_s);
+                        break;
+                    }
+                    if (capture_group.is_open()) {
+                        LOG_INFO("Idle for %d s, releasing ALSA device", idle_timeout_s);
+                        close_capture();
+                    }
+                }
                 continue;
             }
             if (running) {
-                log_message("Accept failed: " + std::string(strerror(errno)));
+                LOG_ERROR("Accept failed: %s", strerror(errno));
             }
             continue;
         }
@@ -338,18 +596,38 @@ int main(int argc, char* argv[]) {
         // Close previous connection if any
         static std::thread client_thread;
         if (client_thread.joinable()) {
-            log_message("Closed previous connection from " + client_ip);
+            LOG_INFO("Closed previous connection from %s", client_ip.c_str());
             running = false; // Signal previous thread to exit
             client_thread.join();
             running = true;
         }
 
+        // The card has one reader: take it over from a capture thread that
+        // serves only HTTP listeners, which this client's thread serves too
+        if (http_only_capture && active_clients > 0) {
+            capture_handover = true;
+            for (int i = 0; i < 2000 && active_clients > 0; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            capture_handover = false;
+        }
+
+        // Open the card on demand when it is released while idle
+        if (!use_synthetic && !capture_group.is_open() &&
+            !setup_capture(devices, capture_params.sample_rate, period_size, n_periods)) {
+            close(client_socket);
+            continue;
+        }
+
         // Start new client thread
-        client_thread = std::thread(handle_client, client_socket, capture_handle, buffer_size, client_ip);
+        ++active_clients;
+        client_thread = std::thread(handle_client, client_socket, use_synthetic ? &synthetic : nullptr,
+                                    buffer_size, stall_ms, tls.enabled() ? &tls : nullptr, client_ip);
         client_thread.detach();
     }
 
+    LOG_INFO("Shutting down...");
     cleanup_resources();
-    log_message("Server shutdown complete");
-    return 0;
+    LOG_INFO("Server shutdown complete");
+    return alloc_check_failed() ? 2 : 0;
 }
@@ -0,0 +1,186 @@
+import sys
+import socket
+import struct
+import collections
+import time
+import cv2
+import numpy as np
+import pyaudio
+from PyQt5.QtWidgets import (QApplication, QMainWindow, QWidget, QVBoxLayout,
+                             QHBoxLayout, QLabel, QLineEdit, QPushButton)
+from PyQt5.QtGui import QImage, QPixmap
+from PyQt5.QtCore import Qt, QThread, pyqtSignal
+
+# Mux packet header: magic, type, flags, pts (ns), length -- see common/mux.h
+HEADER = struct.Struct("!2sBBQI")
+INFO = struct.Struct("!IHHHHH")
+TYPE_INFO, TYPE_VIDEO, TYPE_AUDIO = ord('I'), ord('V'), ord('A')
+FLAG_DISCONTINUITY = 0x02
+
+# Without audio for this long, frames are shown as soon as they arrive
+AUDIO_IDLE_NS = 500_000_000
+
+
+def recv_exact(sock, size):
+    buf = bytearray(size)
+    view = memoryview(buf)
+    got = 0
+    while got < size:
+        n = sock.recv_into(view[got:], size - got)
+        if n == 0:
+            raise ConnectionError("Connection closed by server")
+        got += n
+    return buf
+
+
+class StreamThread(QThread):
+    frame_received = pyqtSignal(np.ndarray)
+    status_changed = pyqtSignal(str)
+    error_occurred = pyqtSignal(str)
+
+    def __init__(self, host, port):
+        super().__init__()
+        self.host = host
+        self.port = port
+        self.running = True
+
+    def run(self):
+        p = pyaudio.PyAudio()
+        stream = None
+        sock = None
+        try:
+            sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            sock.connect((self.host, self.port))
+
+            frames = collections.deque()
+            audio_clock = None      # pts (ns) of the sample now leaving the speaker
+            last_audio_wall = 0
+            sample_rate = 44100
+
+            while self.running:
+                magic, ptype, flags, pts, length = HEADER.unpack(recv_exact(sock, HEADER.size))
+                if magic != b"NX":
+                    raise ConnectionError("Bad packet header")
+                payload = recv_exact(sock, length)
+
+                if ptype == TYPE_INFO:
+                    sample_rate, channels, bits, width, height, fps = INFO.unpack(payload)
+                    stream = p.open(format=pyaudio.paInt16, channels=channels,
+                                    rate=sample_rate, output=True, frames_per_buffer=1024)
+                    self.status_changed.emit(f"{width}x{height}@{fps} + {sample_rate} Hz")
+                elif ptype == TYPE_AUDIO and stream is not None:
+                    if flags & FLAG_DISCONTINUITY:
+                        frames.clear()
+                    # Blocking write paces this thread at the audio rate
+                    stream.write(bytes(payload))
+                    end_pts = pts + len(payload) // 2 * 1_000_000_000 // sample_rate
+                    audio_clock = end_pts - int(stream.get_output_latency() * 1e9)
+                    last_audio_wall = time.monotonic_ns()
+                elif ptype == TYPE_VIDEO:
+                    frames.append((pts, payload))
+
+                # Present every frame whose time has come on the audio clock
+                audio_live = time.monotonic_ns() - last_audio_wall < AUDIO_IDLE_NS
+                while frames and (not audio_live or frames[0][0] <= audio_clock):
+                    _, jpeg = frames.popleft()
+                    frame = cv2.imdecode(np.frombuffer(jpeg, dtype=np.uint8), cv2.IMREAD_COLOR)
+                    if frame is not None:
+                        self.frame_received.emit(cv2.cvtColor(frame, cv2.COLOR_BGR2RGB))
+                while len(frames) > 30:
+                    frames.popleft()
+        except Exception as e:
+            if self.running:
+                self.error_occurred.emit(str(e))
+        finally:
+            if sock is not None:
+                sock.close()
+            if stream is not None:
+                stream.stop_stream()
+                stream.close()
+            p.terminate()
+
+    def stop(self):
+        self.running = False
+
+
+class AVClient(QMainWindow):
+    def __init__(self):
+        super().__init__()
+        self.setWindowTitle("A/V Stream Client")
+        self.setGeometry(100, 100, 800, 600)
+
+        main_widget = QWidget()
+        self.setCentralWidget(main_widget)
+        main_layout = QVBoxLayout(main_widget)
+
+        input_layout = QHBoxLayout()
+        self.host_input = QLineEdit("127.0.0.1")
+        self.port_input = QLineEdit("40919")
+        self.connect_button = QPushButton("Connect")
+        input_layout.addWidget(QLabel("Host:"))
+        input_layout.addWidget(self.host_input)
+        input_layout.addWidget(QLabel("Port:"))
+        input_layout.addWidget(self.port_input)
+        input_layout.addWidget(self.connect_button)
+        main_layout.addLayout(input_layout)
+
+        self.video_label = QLabel()
+        self.video_label.setAlignment(Qt.AlignCenter)
+        main_layout.addWidget(self.video_label)
+
+        self.status_label = QLabel("Disconnected")
+        self.status_label.setAlignment(Qt.AlignCenter)
+        main_layout.addWidget(self.status_label)
+
+        self.stream_thread = None
+        self.connect_button.clicked.connect(self.toggle_stream)
+
+    def toggle_stream(self):
+        if self.stream_thread:
+            self.stop_stream()
+            return
+
+        host = self.host_input.text()
+        try:
+            port = int(self.port_input.text())
+        except ValueError:
+            self.status_label.setText("Error: Invalid port number")
+            return
+
+        self.stream_thread = StreamThread(host, port)
+        self.stream_thread.frame_received.connect(self.update_frame)
+        self.stream_thread.status_changed.connect(self.status_label.setText)
+        self.stream_thread.error_occurred.connect(self.handle_error)
+        self.stream_thread.start()
+        self.connect_button.setText("Disconnect")
+        self.status_label.setText("Connecting...")
+
+    def stop_stream(self):
+        if self.stream_thread:
+            self.stream_thread.stop()
+            self.stream_thread.wait()
+            self.stream_thread = None
+        self.video_label.clear()
+        self.connect_button.setText("Connect")
+        self.status_label.setText("Disconnected")
+
+    def update_frame(self, frame):
+        h, w, c = frame.shape
+        image = QImage(frame.data, w, h, w * c, QImage.Format_RGB888)
+        self.video_label.setPixmap(QPixmap.fromImage(image).scaled(
+            self.video_label.size(), Qt.KeepAspectRatio, Qt.SmoothTransformation))
+
+    def handle_error(self, error_msg):
+        self.stop_stream()
+        self.status_label.setText(f"Error: {error_msg}")
+
+    def closeEvent(self, event):
+        self.stop_stream()
+        event.accept()
+
+
+if __name__ == "__main__":
+    app = QApplication(sys.argv)
+    window = AVClient()
+    window.show()
+    sys.exit(app.exec_())
@@ -0,0 +1,506 @@
+#include <opencv2/opencv.hpp>
+#include <alsa/asoundlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <getopt.h>
+#include <iostream>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include "clock.h"
+#include "mux.h"
+#include "log.h"
+
+// Global state
+std::atomic<bool> running(true);
+std::atomic<int> active_clients(0);
+
+// One captured unit (an encoded frame or a PCM chunk) stamped on CLOCK_MONOTONIC
+struct Packet {
+    uint64_t seq;
+    uint64_t pts_ns;
+    std::vector<uint8_t> data;
+};
+typedef std::shared_ptr<const Packet> PacketPtr;
+
+// Fixed-size history of packets indexed by sequence number. Readers keep their
+// own cursor; a cursor that falls behind the oldest slot has lost data.
+class PacketRing {
+public:
+    explicit PacketRing(size_t capacity) : slots_(capacity), head_(0) {}
+
+    void push(const std::shared_ptr<Packet>& packet) {
+        packet->seq = head_;
+        slots_[head_ % slots_.size()] = packet;
+        ++head_;
+    }
+
+    PacketPtr get(uint64_t seq) const {
+        if (seq >= head_ || seq < oldest()) return PacketPtr();
+        return slots_[seq % slots_.size()];
+    }
+
+    uint64_t head() const { return head_; }
+    uint64_t oldest() const { return head_ > slots_.size() ? head_ - slots_.size() : 0; }
+
+private:
+    std::vector<PacketPtr> slots_;
+    uint64_t head_;
+};
+
+// Both capture threads publish here; every client thread waits on the same
+// condition variable so a muxed client wakes for either stream.
+struct Hub {
+    std::mutex mutex;
+    std::condition_variable cond;
+    PacketRing video;
+    PacketRing audio;
+    MuxInfo info;
+
+    Hub() : video(4), audio(64) { memset(&info, 0, sizeof(info)); }
+
+    void publish(PacketRing& ring, const std::shared_ptr<Packet>& packet) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ring.push(packet);
+        }
+        cond.notify_all();
+    }
+};
+
+enum ClientKind { CLIENT_VIDEO, CLIENT_AUDIO, CLIENT_MUX };
+
+// Send every iovec completely; blocking socket with SO_SNDTIMEO
+bool send_all(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (iovcnt > 0 && static_cast<size_t>(sent) >= iov->iov_len) {
+            sent -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+bool send_packet(int fd, ClientKind kind, uint8_t type, const Packet& packet, bool discontinuity) {
+    uint8_t header[MUX_HEADER_SIZE];
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if (kind == CLIENT_MUX) {
+        mux_write_header(header, type, (type == MUX_TYPE_VIDEO ? MUX_FLAG_KEYFRAME : 0) |
+                         (discontinuity ? MUX_FLAG_DISCONTINUITY : 0),
+                         packet.pts_ns, packet.data.size());
+        iov[iovcnt].iov_base = header;
+        iov[iovcnt].iov_len = MUX_HEADER_SIZE;
+        ++iovcnt;
+    } else if (kind == CLIENT_VIDEO) {
+        // Legacy video framing: 4-byte big-endian size, then JPEG
+        uint32_t size = htonl(packet.data.size());
+        memcpy(header, &size, sizeof(size));
+        iov[iovcnt].iov_base = header;
+        iov[iovcnt].iov_len = sizeof(size);
+        ++iovcnt;
+    }
+    iov[iovcnt].iov_base = const_cast<uint8_t*>(packet.data.data());
+    iov[iovcnt].iov_len = packet.data.size();
+    ++iovcnt;
+    return send_all(fd, iov, iovcnt);
+}
+
+void handle_client(int client_socket, ClientKind kind, Hub& hub, std::string client_ip) {
+    int flag = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    struct timeval timeout = {2, 0};
+    setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    bool want_video = kind != CLIENT_AUDIO;
+    bool want_audio = kind != CLIENT_VIDEO;
+    uint64_t next_video, next_audio;
+    {
+        std::lock_guard<std::mutex> lock(hub.mutex);
+        next_video = hub.video.head() > 0 ? hub.video.head() - 1 : 0;
+        next_audio = hub.audio.head();
+    }
+
+    bool ok = true;
+    if (kind == CLIENT_MUX) {
+        uint8_t info[MUX_HEADER_SIZE + MUX_INFO_SIZE];
+        mux_write_header(info, MUX_TYPE_INFO, 0, monotonic_ns(), MUX_INFO_SIZE);
+        mux_write_info(info + MUX_HEADER_SIZE, hub.info);
+        struct iovec iov = {info, sizeof(info)};
+        ok = send_all(client_socket, &iov, 1);
+    }
+
+    bool audio_gap = false;
+    while (ok && running) {
+        PacketPtr video, audio;
+        {
+            std::unique_lock<std::mutex> lock(hub.mutex);
+            hub.cond.wait_for(lock, std::chrono::milliseconds(100), [&] {
+                return !running || (want_video && hub.video.head() > next_video) ||
+                       (want_audio && hub.audio.head() > next_audio);
+            });
+            if (want_video && hub.video.head() > next_video + 1) {
+                next_video = hub.video.head() - 1; // Always show the newest frame
+            }
+            if (want_audio && next_audio < hub.audio.oldest()) {
+                next_audio = hub.audio.oldest();
+                audio_gap = true;
+            }
+            if (want_video) video = hub.video.get(next_video);
+            if (want_audio) audio = hub.audio.get(next_audio);
+        }
+
+        // Interleave in presentation order
+        if (video && audio) {
+            if (video->pts_ns <= audio->pts_ns) audio.reset();
+            else video.reset();
+        }
+        if (video) {
+            ok = send_packet(client_socket, kind, MUX_TYPE_VIDEO, *video, false);
+            ++next_video;
+        } else if (audio) {
+            ok = send_packet(client_socket, kind, MUX_TYPE_AUDIO, *audio, audio_gap);
+            audio_gap = false;
+            ++next_audio;
+        }
+    }
+
+    close(client_socket);
+    --active_clients;
+    LOG_INFO("Client disconnected from %s", client_ip.c_str());
+}
+
+// Capture, stamp and encode frames until shutdown
+void video_capture_loop(cv::VideoCapture& cap, Hub& hub, int quality) {
+    std::vector<int> encode_params = {cv::IMWRITE_JPEG_QUALITY, quality};
+    cv::Mat frame;
+
+    while (running) {
+        if (!cap.grab()) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to grab frame");
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        uint64_t now = monotonic_ns();
+        if (!cap.retrieve(frame) || frame.empty()) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to retrieve frame");
+            continue;
+        }
+
+        // V4L2 reports the driver's buffer timestamp, which is CLOCK_MONOTONIC for
+        // nearly all drivers. Trust it when it is plausible, else use grab time.
+        std::shared_ptr<Packet> packet = std::make_shared<Packet>();
+        packet->pts_ns = now;
+        double pos_msec = cap.get(cv::CAP_PROP_POS_MSEC);
+        if (pos_msec > 0) {
+            uint64_t driver_ns = static_cast<uint64_t>(pos_msec * 1e6);
+            if (driver_ns <= now && now - driver_ns < 1000000000ull) packet->pts_ns = driver_ns;
+        }
+
+        cv::imencode(".jpg", frame, packet->data, encode_params);
+        hub.publish(hub.video, packet);
+    }
+}
+
+// Read fixed-size PCM chunks; pts is the capture time of the first sample
+void audio_capture_loop(snd_pcm_t* capture_handle, Hub& hub, unsigned int sample_rate,
+                        unsigned int chunk_frames) {
+    int retries = 0;
+    const int max_retries = 5;
+
+    while (running) {
+        std::shared_ptr<Packet> packet = std::make_shared<Packet>();
+        packet->data.resize(chunk_frames * sizeof(int16_t));
+        snd_pcm_sframes_t err = snd_pcm_readi(capture_handle, packet->data.data(), chunk_frames);
+        uint64_t now = monotonic_ns();
+        if (err == -EPIPE || err == -EOVERFLOW) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Audio buffer overflow detected, attempting recovery");
+            snd_pcm_recover(capture_handle, err, true);
+        } else if (err < 0) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to read audio: %s", snd_strerror(err));
+            if (snd_pcm_recover(capture_handle, err, true) < 0 && ++retries >= max_retries) {
+                LOG_ERROR("Max retries reached, stopping audio capture");
+                running = false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        if (err != static_cast<snd_pcm_sframes_t>(chunk_frames)) continue;
+        retries = 0;
+
+        // Frames still queued in the ALSA buffer were captured after our chunk
+        snd_pcm_sframes_t delay = 0;
+        if (snd_pcm_delay(capture_handle, &delay) < 0 || delay < 0) delay = 0;
+        uint64_t span_ns = static_cast<uint64_t>(chunk_frames + delay) * 1000000000ull / sample_rate;
+        packet->pts_ns = now > span_ns ? now - span_ns : 0;
+        hub.publish(hub.audio, packet);
+    }
+}
+
+snd_pcm_t* open_audio(const std::string& device, unsigned int& sample_rate,
+                      unsigned int period_size, unsigned int n_periods) {
+    snd_pcm_t* capture_handle;
+    snd_pcm_hw_params_t* hw_params;
+    int err;
+
+    if ((err = snd_pcm_open(&capture_handle, device.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+        LOG_ERROR("Cannot open audio device %s: %s", device.c_str(), snd_strerror(err));
+        return nullptr;
+    }
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_hw_params_any(capture_handle, hw_params);
+
+    unsigned int actual_rate = sample_rate;
+    if ((err = snd_pcm_hw_params_set_access(capture_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(capture_handle, hw_params, SND_PCM_FORMAT_S16_LE)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_near(capture_handle, hw_params, &actual_rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(capture_handle, hw_params, 1)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_size(capture_handle, hw_params, period_size, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_periods(capture_handle, hw_params, n_periods, 0)) < 0 ||
+        (err = snd_pcm_hw_params(capture_handle, hw_params)) < 0 ||
+        (err = snd_pcm_prepare(capture_handle)) < 0) {
+        LOG_ERROR("Cannot configure audio device %s: %s", device.c_str(), snd_strerror(err));
+        snd_pcm_close(capture_handle);
+        return nullptr;
+    }
+    if (actual_rate != sample_rate) {
+        LOG_INFO("Warning: Actual sample rate is %u Hz", actual_rate);
+        sample_rate = actual_rate;
+    }
+    return capture_handle;
+}
+
+int open_listener(const std::string& host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    int sock_opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+        LOG_ERROR("Invalid host: %s", host.c_str());
+        close(fd);
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        LOG_ERROR("Bind/listen failed on port %d: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Signal handler
+void signal_handler(int sig) {
+    running = false;
+}
+
+// Print usage
+void print_usage(const char* prog_name) {
+    std::cerr << "Usage: " << prog_name
+              << " [options]\n"
+              << "Options:\n"
+              << "  --device <device>        Video device (default: /dev/video8)\n"
+              << "  --width <width>          Frame width (default: 320)\n"
+              << "  --height <height>        Frame height (default: 240)\n"
+              << "  --fps <fps>              Frames per second (default: 30)\n"
+              << "  --quality <q>            JPEG quality (default: 70)\n"
+              << "  --audio-device <dev>     ALSA capture device (default: hw:0,0)\n"
+              << "  --sample-rate <rate>     Audio sample rate (default: 44100)\n"
+              << "  --host <host>            Host address (default: 0.0.0.0)\n"
+              << "  --video-port <port>      Video-only port, 0 to disable (default: 40917)\n"
+              << "  --audio-port <port>      Audio-only port, 0 to disable (default: 40918)\n"
+              << "  --mux-port <port>        Interleaved A/V port (default: 40919)\n"
+              << "  --help                   Show this help\n";
+}
+
+int main(int argc, char* argv[]) {
+    // Default parameters
+    std::string device = "/dev/video8";
+    int fwidth = 320, fheight = 240, fps = 30, quality = 70;
+    std::string audio_device = "hw:0,0";
+    unsigned int sample_rate = 44100;
+    unsigned int period_size = 256; // ALSA period size (frames)
+    unsigned int n_periods = 4;     // Number of periods in buffer
+    unsigned int chunk_frames = 1024;
+    std::string host = "0.0.0.0";
+    int video_port = 40917, audio_port = 40918, mux_port = 40919;
+
+    static struct option long_options[] = {
+        {"device", required_argument, 0, 'd'},
+        {"width", required_argument, 0, 'w'},
+        {"height", required_argument, 0, 'h'},
+        {"fps", required_argument, 0, 'f'},
+        {"quality", required_argument, 0, 'q'},
+        {"audio-device", required_argument, 0, 'a'},
+        {"sample-rate", required_argument, 0, 's'},
+        {"host", required_argument, 0, 'H'},
+        {"video-port", required_argument, 0, 'V'},
+        {"audio-port", required_argument, 0, 'A'},
+        {"mux-port", required_argument, 0, 'M'},
+        {"help", no_argument, 0, 'x'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        try {
+            switch (opt) {
+                case 'd': device = optarg; break;
+                case 'w': fwidth = std::stoi(optarg); break;
+                case 'h': fheight = std::stoi(optarg); break;
+                case 'f': fps = std::stoi(optarg); break;
+                case 'q': quality = std::stoi(optarg); break;
+                case 'a': audio_device = optarg; break;
+                case 's': sample_rate = std::stoi(optarg); break;
+                case 'H': host = optarg; break;
+                case 'V': video_port = std::stoi(optarg); break;
+                case 'A': audio_port = std::stoi(optarg); break;
+                case 'M': mux_port = std::stoi(optarg); break;
+                case 'x': print_usage(argv[0]); return 0;
+                default: print_usage(argv[0]); return -1;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid argument: " << e.what() << "\n";
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // Initialize video capture
+    cv::VideoCapture cap(device, cv::CAP_V4L2);
+    if (!cap.isOpened()) {
+        LOG_ERROR("Failed to open video device: %s", device.c_str());
+        return -1;
+    }
+    cap.set(cv::CAP_PROP_FRAME_WIDTH, fwidth);
+    cap.set(cv::CAP_PROP_FRAME_HEIGHT, fheight);
+    cap.set(cv::CAP_PROP_FPS, fps);
+    cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+    LOG_INFO("Video: %dx%d@%dfps", fwidth, fheight, fps);
+
+    // Initialize audio capture
+    snd_pcm_t* capture_handle = open_audio(audio_device, sample_rate, period_size, n_periods);
+    if (!capture_handle) return -1;
+    LOG_INFO("Audio: %s @ %u Hz", audio_device.c_str(), sample_rate);
+
+    Hub hub;
+    hub.info.sample_rate = sample_rate;
+    hub.info.channels = 1;
+    hub.info.bits_per_sample = 16;
+    hub.info.width = fwidth;
+    hub.info.height = fheight;
+    hub.info.fps = fps;
+
+    // Setup signal handling
+    struct sigaction sa;
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    // One listener per output; a zero port disables it
+    const int ports[3] = {video_port, audio_port, mux_port};
+    const ClientKind kinds[3] = {CLIENT_VIDEO, CLIENT_AUDIO, CLIENT_MUX};
+    std::vector<struct pollfd> pfds;
+    std::vector<ClientKind> pfd_kinds;
+    for (int i = 0; i < 3; ++i) {
+        if (ports[i] <= 0) continue;
+        int fd = open_listener(host, ports[i]);
+        if (fd < 0) {
+            for (size_t j = 0; j < pfds.size(); ++j) close(pfds[j].fd);
+            snd_pcm_close(capture_handle);
+            return -1;
+        }
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        pfds.push_back(pfd);
+        pfd_kinds.push_back(kinds[i]);
+    }
+    LOG_INFO("Server: %s video:%d audio:%d mux:%d", host.c_str(), video_port, audio_port, mux_port);
+
+    std::thread video_thread(video_capture_loop, std::ref(cap), std::ref(hub), quality);
+    std::thread audio_thread(audio_capture_loop, capture_handle, std::ref(hub), sample_rate, chunk_frames);
+
+    // Main loop with poll
+    while (running) {
+        int ret = poll(pfds.data(), pfds.size(), 100);
+        if (ret <= 0) continue;
+
+        for (size_t i = 0; i < pfds.size(); ++i) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            struct sockaddr_in client_addr;
+            socklen_t client_len = sizeof(client_addr);
+            int client_fd = accept(pfds[i].fd, (struct sockaddr*)&client_addr, &client_len);
+            if (client_fd < 0) {
+                if (running) LOG_ERROR("Accept failed: %s", strerror(errno));
+                continue;
+            }
+
+            char client_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+            static const char* kind_names[3] = {"video", "audio", "mux"};
+            LOG_INFO("New %s client: %s", kind_names[pfd_kinds[i]], client_ip);
+
+            ++active_clients;
+            std::thread client_thread(handle_client, client_fd, pfd_kinds[i], std::ref(hub),
+                                      std::string(client_ip));
+            client_thread.detach();
+        }
+    }
+
+    // Cleanup
+    LOG_INFO("Shutting down...");
+    hub.cond.notify_all();
+    video_thread.join();
+    audio_thread.join();
+    for (int i = 0; i < 50 && active_clients > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    for (size_t i = 0; i < pfds.size(); ++i) close(pfds[i].fd);
+    snd_pcm_drop(capture_handle);
+    snd_pcm_close(capture_handle);
+    cap.release();
+    LOG_INFO("Shutdown complete");
+    return 0;
+}
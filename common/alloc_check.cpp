@@ -0,0 +1,110 @@
+#include "alloc_check.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <atomic>
+
+// Interposes the glibc allocator for ALLOC_CHECK builds. Counters are plain
+// initial-exec TLS so touching them never allocates.
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+namespace {
+
+__thread uint64_t thread_count = 0;
+__thread uint64_t thread_codec_count = 0;
+__thread int codec_depth = 0;
+
+std::atomic<bool> failed(false);
+
+inline void note_allocation() {
+    if (codec_depth > 0) ++thread_codec_count;
+    else ++thread_count;
+}
+
+} // namespace
+
+extern "C" {
+
+void* malloc(size_t size) {
+    note_allocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    note_allocation();
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    note_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    note_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    note_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+    note_allocation();
+    void* ptr = __libc_memalign(alignment, size);
+    if (!ptr) return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+
+} // extern "C"
+
+uint64_t alloc_check_thread_count() { return thread_count; }
+uint64_t alloc_check_thread_codec_count() { return thread_codec_count; }
+void alloc_check_codec_enter() { ++codec_depth; }
+void alloc_check_codec_leave() { --codec_depth; }
+bool alloc_check_failed() { return failed.load(); }
+
+AllocCheck::AllocCheck(const char* name, uint64_t warmup, uint64_t report_every)
+    : name_(name), warmup_(warmup), report_every_(report_every), iterations_(0),
+      last_count_(0), last_codec_(0) {}
+
+void AllocCheck::iteration() {
+    ++iterations_;
+    if (iterations_ < warmup_) return;
+
+    uint64_t count = alloc_check_thread_count();
+    uint64_t codec = alloc_check_thread_codec_count();
+    if (iterations_ == warmup_) {
+        last_count_ = count;
+        last_codec_ = codec;
+        LOG_INFO("Alloc check [%s]: warm-up done after %llu iterations", name_,
+                 static_cast<unsigned long long>(warmup_));
+        return;
+    }
+    if ((iterations_ - warmup_) % report_every_ != 0) return;
+
+    // Snapshot before logging; the log call itself must not allocate either
+    // Codec allocations count against the run like any other
+    uint64_t delta = count - last_count_;
+    uint64_t codec_delta = codec - last_codec_;
+    last_count_ = count;
+    last_codec_ = codec;
+    if (delta + codec_delta > 0) {
+        failed = true;
+        LOG_ERROR("Alloc check [%s]: FAIL, %llu allocations in last %llu iterations (%llu of them in the codec)",
+                  name_, static_cast<unsigned long long>(delta + codec_delta),
+                  static_cast<unsigned long long>(report_every_), static_cast<unsigned long long>(codec_delta));
+    } else {
+        LOG_INFO("Alloc check [%s]: ok, 0 allocations in last %llu iterations", name_,
+                 static_cast<unsigned long long>(report_every_));
+    }
+}
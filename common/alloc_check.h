@@ -0,0 +1,65 @@
+#ifndef NLX_COMMON_ALLOC_CHECK_H
+#define NLX_COMMON_ALLOC_CHECK_H
+
+#include <cstdint>
+
+// Steady-state heap allocation verification.
+//
+// Building with `make ALLOC_CHECK=1` defines NLX_ALLOC_CHECK and links
+// alloc_check.cpp, which interposes malloc and friends (and therefore
+// operator new) and counts calls per thread. Hot loops call
+// AllocCheck::iteration() once per frame or period; after warm-up any
+// allocation on that thread is reported and marks the run as failed.
+// Allocations made inside an AllocCheckCodec scope (library internals we
+// cannot control, such as the per-image pools of TurboJPEG's crop transform)
+// are attributed to the codec in the report, but fail the run all the same:
+// the path is not allocation-free while they happen.
+//
+// In normal builds every type here is an empty inline no-op.
+
+#ifdef NLX_ALLOC_CHECK
+
+uint64_t alloc_check_thread_count();
+uint64_t alloc_check_thread_codec_count();
+void alloc_check_codec_enter();
+void alloc_check_codec_leave();
+bool alloc_check_failed();
+
+class AllocCheck {
+public:
+    AllocCheck(const char* name, uint64_t warmup, uint64_t report_every);
+    void iteration();
+
+private:
+    const char* name_;
+    uint64_t warmup_;
+    uint64_t report_every_;
+    uint64_t iterations_;
+    uint64_t last_count_;
+    uint64_t last_codec_;
+};
+
+class AllocCheckCodec {
+public:
+    AllocCheckCodec() { alloc_check_codec_enter(); }
+    ~AllocCheckCodec() { alloc_check_codec_leave(); }
+};
+
+#else
+
+inline bool alloc_check_failed() { return false; }
+
+class AllocCheck {
+public:
+    AllocCheck(const char*, uint64_t, uint64_t) {}
+    void iteration() {}
+};
+
+class AllocCheckCodec {
+public:
+    AllocCheckCodec() {}
+};
+
+#endif
+
+#endif
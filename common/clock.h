@@ -0,0 +1,16 @@
+#ifndef NLX_COMMON_CLOCK_H
+#define NLX_COMMON_CLOCK_H
+
+#include <cstdint>
+#include <ctime>
+
+// Single time base for every capture source: CLOCK_MONOTONIC in nanoseconds.
+// V4L2 buffer timestamps and ALSA delays are converted onto this clock so that
+// audio and video presentation times are directly comparable.
+inline uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "delta_codec.h"
+
+#include <lz4.h>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static const size_t HEADER_BYTES = 16;
+static const uint8_t TYPE_KEY = 0;
+static const uint8_t TYPE_DELTA = 1;
+static const uint32_t MAX_DIMENSION = 16384;
+
+// out = a ^ b, 16 bytes per instruction where the target has vectors
+static void xor_bytes(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(x, y));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) vst1q_u8(out + i, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+#endif
+    for (; i < n; ++i) out[i] = a[i] ^ b[i];
+}
+
+// BGR <-> RGB in place
+static void swap_red_blue(uint8_t* row, int width) {
+    for (int x = 0; x < width; ++x, row += 3) {
+        uint8_t b = row[0];
+        row[0] = row[2];
+        row[2] = b;
+    }
+}
+
+static void put_header(uint8_t* p, uint8_t type, int width, int height) {
+    memcpy(p, "nlxd", 4);
+    p[4] = type;
+    p[5] = p[6] = p[7] = 0;
+    for (int i = 0; i < 4; ++i) {
+        p[8 + i] = static_cast<uint8_t>(static_cast<uint32_t>(width) >> (24 - 8 * i));
+        p[12 + i] = static_cast<uint8_t>(static_cast<uint32_t>(height) >> (24 - 8 * i));
+    }
+}
+
+bool delta_check(const uint8_t* data, size_t size) {
+    return size > HEADER_BYTES && memcmp(data, "nlxd", 4) == 0;
+}
+
+bool delta_peek_size(const uint8_t* data, size_t size, int* width, int* height) {
+    if (!delta_check(data, size)) return false;
+    uint32_t w = 0, h = 0;
+    for (int i = 0; i < 4; ++i) {
+        w = (w << 8) | data[8 + i];
+        h = (h << 8) | data[12 + i];
+    }
+    if (w == 0 || h == 0 || w > MAX_DIMENSION || h > MAX_DIMENSION) return false;
+    *width = static_cast<int>(w);
+    *height = static_cast<int>(h);
+    return true;
+}
+
+DeltaEncoder::DeltaEncoder(int keyframe_interval)
+    : keyframe_interval_(keyframe_interval > 0 ? keyframe_interval : 1), width_(0), height_(0), since_key_(-1),
+      key_size_(0), lz4_state_(LZ4_sizeofState()) {}
+
+size_t DeltaEncoder::max_size(int width, int height) {
+    return HEADER_BYTES + LZ4_compressBound(width * height * 3);
+}
+
+size_t DeltaEncoder::compress(const uint8_t* src, size_t bytes, uint8_t* out, size_t capacity) {
+    int size = LZ4_compress_fast_extState(lz4_state_.data(), reinterpret_cast<const char*>(src),
+                                          reinterpret_cast<char*>(out + HEADER_BYTES), static_cast<int>(bytes),
+                                          static_cast<int>(capacity - HEADER_BYTES), 1);
+    return size > 0 ? HEADER_BYTES + size : 0;
+}
+
+size_t DeltaEncoder::encode(const uint8_t* bgr, int width, int height, size_t stride, uint8_t* out,
+                            size_t capacity) {
+    if (width <= 0 || height <= 0 || capacity < max_size(width, height)) return 0;
+    size_t row = static_cast<size_t>(width) * 3;
+    size_t bytes = row * height;
+
+    bool key = since_key_ < 0 || width != width_ || height != height_ || since_key_ + 1 >= keyframe_interval_;
+    if (!key) {
+        for (int y = 0; y < height; ++y) xor_bytes(bgr + y * stride, &key_[y * row], &residual_[y * row], row);
+        size_t size = compress(residual_.data(), bytes, out, capacity);
+        // A delta as large as a keyframe means the scene changed: start over
+        if (size > 0 && size < key_size_) {
+            put_header(out, TYPE_DELTA, width, height);
+            ++since_key_;
+            return size;
+        }
+    }
+
+    if (key_.size() < bytes) {
+        key_.resize(bytes);
+        residual_.resize(bytes);
+    }
+    for (int y = 0; y < height; ++y) memcpy(&key_[y * row], bgr + y * stride, row);
+    size_t size = compress(key_.data(), bytes, out, capacity);
+    if (size == 0) {
+        since_key_ = -1;
+        return 0;
+    }
+    put_header(out, TYPE_KEY, width, height);
+    width_ = width;
+    height_ = height;
+    since_key_ = 0;
+    key_size_ = size;
+    return size;
+}
+
+DeltaDecoder::DeltaDecoder() : width_(0), height_(0), have_key_(false) {}
+
+bool DeltaDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t stride, bool bgr) {
+    int width, height;
+    if (!delta_peek_size(data, size, &width, &height)) return false;
+    size_t row = static_cast<size_t>(width) * 3;
+    size_t bytes = row * height;
+    const char* payload = reinterpret_cast<const char*>(data + HEADER_BYTES);
+    int payload_size = static_cast<int>(size - HEADER_BYTES);
+
+    if (data[4] == TYPE_KEY) {
+        if (key_.size() < bytes) {
+            key_.resize(bytes);
+            residual_.resize(bytes);
+        }
+        have_key_ = LZ4_decompress_safe(payload, reinterpret_cast<char*>(key_.data()), payload_size,
+                                        static_cast<int>(bytes)) == static_cast<int>(bytes);
+        if (!have_key_) return false;
+        width_ = width;
+        height_ = height;
+        for (int y = 0; y < height; ++y) memcpy(out + y * stride, &key_[y * row], row);
+    } else if (data[4] == TYPE_DELTA) {
+        if (!have_key_ || width != width_ || height != height_) return false;
+        if (LZ4_decompress_safe(payload, reinterpret_cast<char*>(residual_.data()), payload_size,
+                                static_cast<int>(bytes)) != static_cast<int>(bytes)) {
+            return false;
+        }
+        for (int y = 0; y < height; ++y) xor_bytes(&key_[y * row], &residual_[y * row], out + y * stride, row);
+    } else {
+        return false;
+    }
+
+    if (!bgr) {
+        for (int y = 0; y < height; ++y) swap_red_blue(out + y * stride, width);
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef NLX_COMMON_DELTA_CODEC_H
+#define NLX_COMMON_DELTA_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Exact raw frames for static cameras at a fraction of the raw bandwidth.
+// A keyframe is the packed BGR image; every following frame is sent as its
+// XOR against that keyframe, which is zero wherever the scene did not
+// change. Both are compressed with LZ4, which turns the zero runs into a few
+// bytes and costs far less CPU than JPEG. Deltas refer to the keyframe, not
+// to the previous frame, so a receiver may miss any of them.
+//
+// A frame is a 16-byte header ("nlxd", type, 3 reserved bytes, big-endian
+// width and height) followed by the LZ4 block. The magic tells it apart
+// from JPEG and QOI frames on the same stream.
+
+// True if `data` starts like a delta-stream frame
+bool delta_check(const uint8_t* data, size_t size);
+
+// Reads the resolution from the header; false if this is not a delta frame
+bool delta_peek_size(const uint8_t* data, size_t size, int* width, int* height);
+
+// One per stream: holds the current keyframe. Buffers grow with the
+// resolution and are reused, so steady-state encoding does not allocate.
+class DeltaEncoder {
+public:
+    // A keyframe every `keyframe_interval` frames bounds how long a changed
+    // scene keeps costing large deltas
+    explicit DeltaEncoder(int keyframe_interval);
+
+    // Worst-case encoded size for a frame of this resolution
+    static size_t max_size(int width, int height);
+
+    // Encodes packed BGR pixels (`stride` bytes per row) into `out`, which
+    // must hold at least max_size(width, height) bytes. The first frame, a
+    // resolution change, the interval, and a delta that would be larger
+    // than a keyframe all make a keyframe. Returns the size, 0 on failure.
+    size_t encode(const uint8_t* bgr, int width, int height, size_t stride, uint8_t* out, size_t capacity);
+
+    bool last_was_keyframe() const { return since_key_ == 0; }
+
+private:
+    DeltaEncoder(const DeltaEncoder&);
+    DeltaEncoder& operator=(const DeltaEncoder&);
+
+    size_t compress(const uint8_t* src, size_t bytes, uint8_t* out, size_t capacity);
+
+    int keyframe_interval_;
+    int width_;
+    int height_;
+    int since_key_;       // Frames encoded since the keyframe; -1 before the first
+    size_t key_size_;     // Its encoded size
+    std::vector<uint8_t> key_;      // Packed BGR of the keyframe
+    std::vector<uint8_t> residual_; // Frame XOR keyframe
+    std::vector<char> lz4_state_;
+};
+
+// One per stream, fed every frame in order from the first keyframe on
+class DeltaDecoder {
+public:
+    DeltaDecoder();
+
+    // Decodes into caller memory of at least height rows of `stride` bytes,
+    // packed RGB or (with `bgr`) BGR. Returns false on a malformed frame or
+    // a delta without its keyframe.
+    bool decode(const uint8_t* data, size_t size, uint8_t* out, size_t stride, bool bgr);
+
+private:
+    DeltaDecoder(const DeltaDecoder&);
+    DeltaDecoder& operator=(const DeltaDecoder&);
+
+    int width_;
+    int height_;
+    bool have_key_;
+    std::vector<uint8_t> key_;
+    std::vector<uint8_t> residual_;
+};
+
+#endif
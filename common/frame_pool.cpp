@@ -0,0 +1,78 @@
+#include "frame_pool.h"
+#include "log.h"
+
+#include <chrono>
+#include <cstdlib>
+
+FramePool::FramePool(const char* name, size_t count, size_t buffer_bytes)
+    : name_(name), count_(count), buffer_bytes_(buffer_bytes), memory_(nullptr),
+      buffers_(new FrameBuffer[count]), peak_in_use_(0), acquired_(0), exhausted_(0) {
+    // Cache-line aligned rows keep SIMD conversions and memcpy on the fast path
+    size_t stride = (buffer_bytes + 63) & ~static_cast<size_t>(63);
+    void* memory = nullptr;
+    if (count > 0 && posix_memalign(&memory, 64, stride * count) != 0) memory = nullptr;
+    memory_ = static_cast<uint8_t*>(memory);
+    if (!memory_) {
+        LOG_ERROR("Pool %s: failed to allocate %zu x %zu bytes", name_, count, buffer_bytes);
+        count_ = 0;
+    }
+
+    free_.reserve(count_);
+    for (size_t i = 0; i < count_; ++i) {
+        FrameBuffer& buf = buffers_[i];
+        buf.data_ = memory_ + i * stride;
+        buf.capacity_ = buffer_bytes;
+        buf.pool_ = this;
+        free_.push_back(&buf);
+    }
+    LOG_INFO("Pool %s: %zu buffers of %zu bytes", name_, count_, buffer_bytes_);
+}
+
+FramePool::~FramePool() {
+    size_t busy = in_use();
+    if (busy > 0) LOG_ERROR("Pool %s destroyed with %zu buffers still referenced", name_, busy);
+    free(memory_);
+}
+
+FrameRef FramePool::acquire(int wait_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (free_.empty() && wait_ms > 0) {
+        cond_.wait_for(lock, std::chrono::milliseconds(wait_ms), [this] { return !free_.empty(); });
+    }
+    if (free_.empty()) {
+        ++exhausted_;
+        return FrameRef();
+    }
+
+    FrameBuffer* buf = free_.back();
+    free_.pop_back();
+    ++acquired_;
+    size_t used = count_ - free_.size();
+    if (used > peak_in_use_) peak_in_use_ = used;
+    lock.unlock();
+
+    buf->format = FRAME_EMPTY;
+    buf->size = 0;
+    buf->refs_.store(1, std::memory_order_relaxed);
+    return FrameRef(buf);
+}
+
+void FramePool::recycle(FrameBuffer* buf) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(buf);
+    }
+    cond_.notify_one();
+}
+
+size_t FramePool::in_use() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_ - free_.size();
+}
+
+void FramePool::log_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LOG_INFO("Pool %s: %zu buffers, %zu in use (peak %zu), %llu acquired, %llu exhausted", name_, count_,
+             count_ - free_.size(), peak_in_use_, static_cast<unsigned long long>(acquired_),
+             static_cast<unsigned long long>(exhausted_));
+}
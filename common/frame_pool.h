@@ -0,0 +1,137 @@
+#ifndef NLX_COMMON_FRAME_POOL_H
+#define NLX_COMMON_FRAME_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Fixed-size pools of frame buffers with atomic reference counts.
+//
+// All buffer memory is allocated once when the pool is built. A FrameRef is
+// an intrusive handle: copying it adds a reference, destroying it drops one,
+// and the last reference returns the buffer to its pool instead of the heap.
+// One captured or encoded frame can therefore be held by the encoder, any
+// number of client senders and the recorder at once without copies.
+
+class FramePool;
+
+enum FrameFormat {
+    FRAME_EMPTY = 0,
+    FRAME_BGR,  // Packed 8-bit BGR, `stride` bytes per row
+    FRAME_JPEG, // Complete JPEG image of `size` bytes
+    FRAME_QOI,  // Complete lossless QOI image of `size` bytes (qoi_codec.h)
+    FRAME_DELTA, // Keyframe or delta of a raw stream, `size` bytes (delta_codec.h)
+};
+
+class FrameBuffer {
+public:
+    uint8_t* data() const { return data_; }
+    size_t capacity() const { return capacity_; }
+
+    // Metadata of the frame currently stored; set by whoever filled it
+    FrameFormat format;
+    size_t size;
+    int width;
+    int height;
+    size_t stride;
+    uint64_t seq;    // Capture sequence number
+    uint64_t pts_ns; // Capture time, CLOCK_MONOTONIC
+
+    void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void release();
+    int use_count() const { return refs_.load(std::memory_order_relaxed); }
+
+private:
+    friend class FramePool;
+    FrameBuffer() : format(FRAME_EMPTY), size(0), width(0), height(0), stride(0), seq(0), pts_ns(0),
+                    data_(nullptr), capacity_(0), pool_(nullptr), refs_(0) {}
+    FrameBuffer(const FrameBuffer&);
+    FrameBuffer& operator=(const FrameBuffer&);
+
+    uint8_t* data_;
+    size_t capacity_;
+    FramePool* pool_;
+    std::atomic<int> refs_;
+};
+
+class FrameRef {
+public:
+    FrameRef() : buf_(nullptr) {}
+    FrameRef(const FrameRef& other) : buf_(other.buf_) {
+        if (buf_) buf_->add_ref();
+    }
+    FrameRef(FrameRef&& other) : buf_(other.buf_) { other.buf_ = nullptr; }
+    ~FrameRef() { reset(); }
+
+    FrameRef& operator=(FrameRef other) {
+        FrameBuffer* tmp = buf_;
+        buf_ = other.buf_;
+        other.buf_ = tmp;
+        return *this;
+    }
+
+    void reset() {
+        if (buf_) {
+            buf_->release();
+            buf_ = nullptr;
+        }
+    }
+
+    FrameBuffer* get() const { return buf_; }
+    FrameBuffer* operator->() const { return buf_; }
+    FrameBuffer& operator*() const { return *buf_; }
+    explicit operator bool() const { return buf_ != nullptr; }
+
+private:
+    friend class FramePool;
+    explicit FrameRef(FrameBuffer* buf) : buf_(buf) {} // Adopts one reference
+
+    FrameBuffer* buf_;
+};
+
+class FramePool {
+public:
+    FramePool(const char* name, size_t count, size_t buffer_bytes);
+    ~FramePool();
+
+    // Takes a free buffer, waiting up to wait_ms when the pool is exhausted.
+    // Returns an empty ref (and counts an exhaustion) if none became free.
+    FrameRef acquire(int wait_ms);
+
+    size_t count() const { return count_; }
+    size_t buffer_bytes() const { return buffer_bytes_; }
+    size_t in_use() const;
+
+    // One summary line: size, current/peak use and exhaustion count
+    void log_stats() const;
+
+private:
+    friend class FrameBuffer;
+    FramePool(const FramePool&);
+    FramePool& operator=(const FramePool&);
+
+    void recycle(FrameBuffer* buf);
+
+    const char* name_;
+    size_t count_;
+    size_t buffer_bytes_;
+    uint8_t* memory_;
+    std::unique_ptr<FrameBuffer[]> buffers_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<FrameBuffer*> free_; // Reserved to count_, never reallocates
+    size_t peak_in_use_;
+    uint64_t acquired_;
+    uint64_t exhausted_;
+};
+
+inline void FrameBuffer::release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) pool_->recycle(this);
+}
+
+#endif
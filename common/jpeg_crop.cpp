@@ -0,0 +1,59 @@
+#include "jpeg_crop.h"
+#include "alloc_check.h"
+#include "log.h"
+
+#include <turbojpeg.h>
+#include <algorithm>
+#include <cstring>
+
+JpegCropper::JpegCropper() : handle_(tjInitTransform()) {
+    if (!handle_) LOG_ERROR("tjInitTransform failed: %s", tjGetErrorStr());
+}
+
+JpegCropper::~JpegCropper() {
+    if (handle_) tjDestroy(static_cast<tjhandle>(handle_));
+}
+
+const char* JpegCropper::error() const {
+    return tjGetErrorStr();
+}
+
+size_t JpegCropper::crop(const uint8_t* jpeg, size_t size, int& x, int& y, int& width, int& height, uint8_t* out,
+                         size_t capacity) {
+    tjhandle handle = static_cast<tjhandle>(handle_);
+    int image_w, image_h, subsamp, colorspace;
+    if (!handle || tjDecompressHeader3(handle, jpeg, size, &image_w, &image_h, &subsamp, &colorspace) != 0) return 0;
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 || x >= image_w || y >= image_h) return 0;
+
+    // Snap the corner to the MCU grid, keeping the far edge where it was
+    int mcu_w = tjMCUWidth[subsamp], mcu_h = tjMCUHeight[subsamp];
+    int right = std::min(x + width, image_w), bottom = std::min(y + height, image_h);
+    x -= x % mcu_w;
+    y -= y % mcu_h;
+    width = right - x;
+    height = bottom - y;
+    if (capacity < tjBufSize(width, height, subsamp)) return 0;
+
+    tjtransform transform;
+    memset(&transform, 0, sizeof(transform));
+    transform.r.x = x;
+    transform.r.y = y;
+    transform.r.w = width;
+    transform.r.h = height;
+    transform.op = TJXOP_NONE;
+    transform.options = TJXOPT_CROP;
+
+    unsigned char* dst = out;
+    unsigned long dst_size = capacity;
+    int err;
+    {
+        // libjpeg's per-image memory pools are outside our control
+        AllocCheckCodec codec;
+        err = tjTransform(handle, jpeg, size, 1, &dst, &dst_size, &transform, TJFLAG_NOREALLOC);
+    }
+    if (err != 0) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "tjTransform failed: %s", tjGetErrorStr());
+        return 0;
+    }
+    return dst_size;
+}
@@ -0,0 +1,35 @@
+#ifndef NLX_COMMON_JPEG_CROP_H
+#define NLX_COMMON_JPEG_CROP_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Lossless JPEG cropping, as jpegtran -crop does: TurboJPEG's transformer
+// copies the DCT coefficients of the blocks inside the crop into a new
+// file, so nothing is decoded or re-quantized and the crop is exactly the
+// pixels of the original. The cost is a fraction of a decode. The crop's
+// top-left corner has to fall on an MCU boundary (8 or 16 pixels, by the
+// chroma subsampling); crop() moves it up and left to the nearest one and
+// widens the crop to still cover the requested area.
+class JpegCropper {
+public:
+    JpegCropper();
+    ~JpegCropper();
+
+    // Crops `jpeg` to x, y, width, height (clipped to the image) into `out`,
+    // which must hold JpegEncoder::max_size of the source resolution.
+    // Returns the size, 0 on failure; the region is updated to the one
+    // actually cropped.
+    size_t crop(const uint8_t* jpeg, size_t size, int& x, int& y, int& width, int& height, uint8_t* out,
+                size_t capacity);
+
+    const char* error() const;
+
+private:
+    JpegCropper(const JpegCropper&);
+    JpegCropper& operator=(const JpegCropper&);
+
+    void* handle_;
+};
+
+#endif
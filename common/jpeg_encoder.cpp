@@ -0,0 +1,277 @@
+#include "jpeg_encoder.h"
+#include "log.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+// Arena chunk size; larger requests get a chunk of their own
+static const size_t ARENA_CHUNK = 256 * 1024;
+// libjpeg-turbo aligns its buffers to 32 bytes for the SIMD routines
+static const size_t ARENA_ALIGN = 64;
+
+namespace {
+
+// Bump allocator over chunks that outlive the image: reset() rewinds to the
+// first chunk, so the same sequence of requests (another frame of the same
+// resolution) is served from memory it already holds. A request that does
+// not fit moves on to the next chunk, and only past the last one is a new
+// chunk allocated.
+class Arena {
+public:
+    Arena() : current_(0), used_(0) {}
+
+    ~Arena() {
+        for (size_t i = 0; i < chunks_.size(); ++i) free(chunks_[i].data);
+    }
+
+    void* alloc(size_t size) {
+        size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        for (; current_ < chunks_.size(); ++current_, used_ = 0) {
+            Chunk& chunk = chunks_[current_];
+            if (used_ + size <= chunk.size) {
+                void* ptr = chunk.data + used_;
+                used_ += size;
+                return ptr;
+            }
+        }
+        void* data = nullptr;
+        size_t chunk_size = std::max(size, ARENA_CHUNK);
+        if (posix_memalign(&data, ARENA_ALIGN, chunk_size) != 0) return nullptr;
+        Chunk chunk = {static_cast<uint8_t*>(data), chunk_size};
+        chunks_.push_back(chunk);
+        used_ = size;
+        return data;
+    }
+
+    void reset() {
+        current_ = 0;
+        used_ = 0;
+    }
+
+private:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    struct Chunk {
+        uint8_t* data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks_;
+    size_t current_; // Chunk being filled
+    size_t used_;    // Bytes of it handed out
+};
+
+} // namespace
+
+// Everything libjpeg's callbacks reach through cinfo.client_data
+struct JpegEncoderState {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr error;
+    jpeg_destination_mgr destination;
+    jpeg_memory_mgr memory;
+    jpeg_memory_mgr* library_memory; // Restored for jpeg_destroy_compress
+    Arena permanent;                 // Tables and component info, set up once
+    Arena image;                     // Rewound when libjpeg frees JPOOL_IMAGE
+    uint8_t* out;
+    size_t capacity;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+static JpegEncoderState& state_of(j_common_ptr cinfo) {
+    return *static_cast<JpegEncoderState*>(cinfo->client_data);
+}
+
+// libjpeg errors are fatal to the image: unwind to the setjmp in the caller
+static void on_error(j_common_ptr cinfo) {
+    JpegEncoderState& state = state_of(cinfo);
+    (*cinfo->err->format_message)(cinfo, state.message);
+    longjmp(state.jump, 1);
+}
+
+static void on_message(j_common_ptr cinfo) {
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    LOG_EVERY_MS(LOG_LEVEL_INFO, 10000, "libjpeg: %s", message);
+}
+
+// The destination is the caller's buffer, sized for the worst case up front
+static void init_destination(j_compress_ptr cinfo) {
+    JpegEncoderState& state = state_of(reinterpret_cast<j_common_ptr>(cinfo));
+    cinfo->dest->next_output_byte = state.out;
+    cinfo->dest->free_in_buffer = state.capacity;
+}
+
+static boolean empty_output_buffer(j_compress_ptr cinfo) {
+    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+    return FALSE;
+}
+
+static void term_destination(j_compress_ptr) {}
+
+// The memory manager: every request is served from the encoder's arenas
+static void* alloc_small(j_common_ptr cinfo, int pool_id, size_t size) {
+    JpegEncoderState& state = state_of(cinfo);
+    if (pool_id != JPOOL_PERMANENT && pool_id != JPOOL_IMAGE) ERREXIT1(cinfo, JERR_BAD_POOL_ID, pool_id);
+    void* ptr = (pool_id == JPOOL_IMAGE ? state.image : state.permanent).alloc(size);
+    if (!ptr) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    return ptr;
+}
+
+// libjpeg-turbo pads sample rows to 64 samples, which its SIMD routines may
+// read and write up to; the rows here are padded alike
+static JSAMPARRAY alloc_sarray(j_common_ptr cinfo, int pool_id, JDIMENSION samples_per_row, JDIMENSION num_rows) {
+    size_t row_size = (static_cast<size_t>(samples_per_row) + 63) & ~static_cast<size_t>(63);
+    JSAMPARRAY rows = static_cast<JSAMPARRAY>(alloc_small(cinfo, pool_id, num_rows * sizeof(JSAMPROW)));
+    JSAMPLE* samples = static_cast<JSAMPLE*>(alloc_small(cinfo, pool_id, num_rows * row_size * sizeof(JSAMPLE)));
+    for (JDIMENSION i = 0; i < num_rows; ++i) rows[i] = samples + i * row_size;
+    return rows;
+}
+
+static JBLOCKARRAY alloc_barray(j_common_ptr cinfo, int pool_id, JDIMENSION blocks_per_row, JDIMENSION num_rows) {
+    JBLOCKARRAY rows = static_cast<JBLOCKARRAY>(alloc_small(cinfo, pool_id, num_rows * sizeof(JBLOCKROW)));
+    JBLOCKROW blocks = static_cast<JBLOCKROW>(alloc_small(cinfo, pool_id, num_rows * blocks_per_row * sizeof(JBLOCK)));
+    for (JDIMENSION i = 0; i < num_rows; ++i) rows[i] = blocks + i * blocks_per_row;
+    return rows;
+}
+
+// Virtual arrays only back multi-pass encoding (optimized Huffman tables,
+// progressive scans), which this encoder never turns on
+static jvirt_sarray_ptr request_virt_sarray(j_common_ptr cinfo, int, boolean, JDIMENSION, JDIMENSION, JDIMENSION) {
+    ERREXIT(cinfo, JERR_NOT_COMPILED);
+    return nullptr;
+}
+
+static jvirt_barray_ptr request_virt_barray(j_common_ptr cinfo, int, boolean, JDIMENSION, JDIMENSION, JDIMENSION) {
+    ERREXIT(cinfo, JERR_NOT_COMPILED);
+    return nullptr;
+}
+
+static void realize_virt_arrays(j_common_ptr) {}
+
+static JSAMPARRAY access_virt_sarray(j_common_ptr cinfo, jvirt_sarray_ptr, JDIMENSION, JDIMENSION, boolean) {
+    ERREXIT(cinfo, JERR_NOT_COMPILED);
+    return nullptr;
+}
+
+static JBLOCKARRAY access_virt_barray(j_common_ptr cinfo, jvirt_barray_ptr, JDIMENSION, JDIMENSION, boolean) {
+    ERREXIT(cinfo, JERR_NOT_COMPILED);
+    return nullptr;
+}
+
+static void free_pool(j_common_ptr cinfo, int pool_id) {
+    JpegEncoderState& state = state_of(cinfo);
+    if (pool_id == JPOOL_IMAGE) state.image.reset();
+    else if (pool_id == JPOOL_PERMANENT) state.permanent.reset();
+}
+
+// The arenas belong to the encoder, which frees them
+static void self_destruct(j_common_ptr) {}
+
+JpegEncoder::JpegEncoder() : state_(new JpegEncoderState()), size_(0) {
+    JpegEncoderState& state = *state_;
+    state.cinfo.err = jpeg_std_error(&state.error);
+    state.cinfo.client_data = &state; // Kept by jpeg_create_compress
+    state.error.error_exit = on_error;
+    state.error.output_message = on_message;
+    if (setjmp(state.jump)) {
+        LOG_ERROR("libjpeg setup failed: %s", state.message);
+        if (state.cinfo.mem == &state.memory) state.cinfo.mem = state.library_memory;
+        jpeg_destroy_compress(&state.cinfo);
+        delete state_;
+        state_ = nullptr;
+        return;
+    }
+    jpeg_create_compress(&state.cinfo);
+
+    // libjpeg's own manager (allocated by jpeg_create_compress, with the
+    // master state in its permanent pool) is kept for the final destroy
+    state.library_memory = state.cinfo.mem;
+    state.memory = *state.library_memory;
+    state.memory.alloc_small = alloc_small;
+    state.memory.alloc_large = alloc_small;
+    state.memory.alloc_sarray = alloc_sarray;
+    state.memory.alloc_barray = alloc_barray;
+    state.memory.request_virt_sarray = request_virt_sarray;
+    state.memory.request_virt_barray = request_virt_barray;
+    state.memory.realize_virt_arrays = realize_virt_arrays;
+    state.memory.access_virt_sarray = access_virt_sarray;
+    state.memory.access_virt_barray = access_virt_barray;
+    state.memory.free_pool = free_pool;
+    state.memory.self_destruct = self_destruct;
+    state.cinfo.mem = &state.memory;
+
+    state.destination.init_destination = init_destination;
+    state.destination.empty_output_buffer = empty_output_buffer;
+    state.destination.term_destination = term_destination;
+    state.cinfo.dest = &state.destination;
+
+    // What tjCompress2 did with TJSAMP_420 and TJFLAG_FASTDCT: YCbCr with
+    // 2x2 luma sampling is libjpeg's default for colour input
+    state.cinfo.in_color_space = JCS_EXT_BGR;
+    state.cinfo.input_components = 3;
+    jpeg_set_defaults(&state.cinfo);
+    state.cinfo.dct_method = JDCT_IFAST;
+}
+
+JpegEncoder::~JpegEncoder() {
+    if (!state_) return;
+    state_->cinfo.mem = state_->library_memory;
+    jpeg_destroy_compress(&state_->cinfo);
+    delete state_;
+}
+
+// TurboJPEG's tjBufSize for 4:2:0, so pooled frames sized here also pass
+// JpegCropper's check
+size_t JpegEncoder::max_size(int width, int height) {
+    size_t padded_w = (static_cast<size_t>(width) + 15) & ~static_cast<size_t>(15);
+    size_t padded_h = (static_cast<size_t>(height) + 15) & ~static_cast<size_t>(15);
+    return padded_w * padded_h * 3 + 2048;
+}
+
+bool JpegEncoder::encode(const uint8_t* bgr, int width, int height, size_t stride, int quality) {
+    // Grow only when the resolution goes up; max_size is the worst case
+    size_t needed = max_size(width, height);
+    if (needed > buffer_.size()) buffer_.resize(needed);
+    size_ = encode_into(bgr, width, height, stride, quality, buffer_.data(), buffer_.size());
+    return size_ != 0;
+}
+
+size_t JpegEncoder::encode_into(const uint8_t* bgr, int width, int height, size_t stride, int quality,
+                                uint8_t* out, size_t capacity) {
+    if (!state_ || capacity < max_size(width, height)) return 0;
+
+    JpegEncoderState& state = *state_;
+    jpeg_compress_struct& cinfo = state.cinfo;
+    if (setjmp(state.jump)) {
+        // Also rewinds the image arena
+        jpeg_abort_compress(&cinfo);
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "JPEG compression failed: %s", state.message);
+        return 0;
+    }
+    state.out = out;
+    state.capacity = capacity;
+    cinfo.image_width = static_cast<JDIMENSION>(width);
+    cinfo.image_height = static_cast<JDIMENSION>(height);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    // Rows go in an MCU row at a time, pointed at in place
+    JSAMPROW rows[16];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JDIMENSION count = std::min<JDIMENSION>(16, cinfo.image_height - cinfo.next_scanline);
+        for (JDIMENSION i = 0; i < count; ++i) {
+            rows[i] = const_cast<JSAMPROW>(bgr + (cinfo.next_scanline + i) * stride);
+        }
+        jpeg_write_scanlines(&cinfo, rows, count);
+    }
+    jpeg_finish_compress(&cinfo);
+    return capacity - cinfo.dest->free_in_buffer;
+}
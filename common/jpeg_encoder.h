@@ -0,0 +1,45 @@
+#ifndef NLX_COMMON_JPEG_ENCODER_H
+#define NLX_COMMON_JPEG_ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct JpegEncoderState;
+
+// libjpeg(-turbo) compressor with persistent state: the compress struct lives
+// as long as the encoder, and its memory manager draws from arenas the
+// encoder owns, which a finished image rewinds instead of freeing. After the
+// first frame of a resolution an encode allocates nothing (TurboJPEG's
+// tjCompress2, like cv::imencode, has libjpeg malloc and free its per-image
+// pools on every call). One encoder per thread; it is not shared.
+class JpegEncoder {
+public:
+    JpegEncoder();
+    ~JpegEncoder();
+
+    // Compresses packed BGR pixels; `stride` is bytes per row. The result
+    // stays valid until the next call. Returns false on failure.
+    bool encode(const uint8_t* bgr, int width, int height, size_t stride, int quality);
+
+    const uint8_t* data() const { return buffer_.data(); }
+    size_t size() const { return size_; }
+
+    // Compresses into a caller-owned buffer (e.g. a pooled frame), which
+    // must hold at least max_size(width, height) bytes. Returns 0 on failure.
+    size_t encode_into(const uint8_t* bgr, int width, int height, size_t stride, int quality,
+                       uint8_t* out, size_t capacity);
+
+    // Worst-case compressed size for a frame of this resolution
+    static size_t max_size(int width, int height);
+
+private:
+    JpegEncoder(const JpegEncoder&);
+    JpegEncoder& operator=(const JpegEncoder&);
+
+    JpegEncoderState* state_;
+    std::vector<uint8_t> buffer_; // For encode(); grows only with the resolution
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "log.h"
+#include "clock.h"
+
+#include <unistd.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace {
+
+const size_t LOG_QUEUE_SLOTS = 256; // Power of two
+const size_t LOG_TEXT_SIZE = 240;
+const size_t LOG_OUT_BUFFER = 16384;
+
+struct LogRecord {
+    time_t sec;
+    uint8_t level;
+    uint16_t length;
+    char text[LOG_TEXT_SIZE];
+};
+
+// Single-producer (owning thread) / single-consumer (writer) ring
+struct LogQueue {
+    LogRecord slots[LOG_QUEUE_SLOTS];
+    char pad0[64];
+    std::atomic<uint64_t> head;             // Next slot the producer fills
+    char pad1[64];                          // Keep head and tail on separate lines
+    std::atomic<uint64_t> tail;             // Next slot the writer drains
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> retired;              // Owning thread has exited
+    LogQueue* next;                         // Changed under registry_mutex; the writer also reads it without
+
+    LogQueue() : head(0), tail(0), dropped(0), retired(false), next(nullptr) {}
+};
+
+// Never destroyed: detached threads may still log while the process exits
+std::mutex& registry_mutex = *new std::mutex;
+std::condition_variable& writer_cond = *new std::condition_variable;
+LogQueue* registry = nullptr;
+
+std::atomic<int> min_level(LOG_LEVEL_INFO);
+std::atomic<bool> writer_stop(false);
+std::once_flag writer_once;
+std::thread* writer_thread = nullptr;
+
+class Output {
+public:
+    explicit Output(int fd) : fd_(fd), len_(0) {}
+
+    void append(const char* data, size_t size) {
+        if (len_ + size > sizeof(buf_)) flush();
+        if (size > sizeof(buf_)) size = sizeof(buf_);
+        memcpy(buf_ + len_, data, size);
+        len_ += size;
+    }
+
+    void flush() {
+        size_t off = 0;
+        while (off < len_) {
+            ssize_t n = ::write(fd_, buf_ + off, len_ - off);
+            if (n <= 0) break; // Nothing sensible to do about a broken stdout
+            off += n;
+        }
+        len_ = 0;
+    }
+
+private:
+    int fd_;
+    size_t len_;
+    char buf_[LOG_OUT_BUFFER];
+};
+
+class Writer {
+public:
+    Writer() : out_(STDOUT_FILENO), err_(STDERR_FILENO), cached_sec_(-1), ts_len_(0) {}
+
+    void run() {
+        for (;;) {
+            bool stopping = writer_stop.load(std::memory_order_acquire);
+            size_t count = drain();
+            out_.flush();
+            err_.flush();
+            if (stopping) break;
+            if (count == 0) {
+                std::unique_lock<std::mutex> lock(registry_mutex);
+                writer_cond.wait_for(lock, std::chrono::milliseconds(20));
+            }
+        }
+    }
+
+private:
+    // Output may block on a slow stdout, so the queues are drained without
+    // registry_mutex, which every thread's first log call takes: threads
+    // only push new queues at the head of the list and only this thread
+    // unlinks, so the list read from the head taken here stays intact
+    size_t drain() {
+        LogQueue* first;
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            first = registry;
+        }
+        size_t count = 0;
+        bool retired = false;
+        for (LogQueue* q = first; q; q = q->next) {
+            uint64_t tail = q->tail.load(std::memory_order_relaxed);
+            uint64_t head = q->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail, ++count) {
+                const LogRecord& r = q->slots[tail & (LOG_QUEUE_SLOTS - 1)];
+                emit(r.level, r.sec, r.text, r.length);
+            }
+            q->tail.store(tail, std::memory_order_release);
+
+            uint64_t dropped = q->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0) {
+                char text[64];
+                int n = snprintf(text, sizeof(text), "Log queue full, %llu messages dropped",
+                                 static_cast<unsigned long long>(dropped));
+                emit(LOG_LEVEL_ERROR, time(nullptr), text, n);
+            }
+            retired |= q->retired.load(std::memory_order_acquire);
+        }
+        if (retired) unlink_retired();
+        return count;
+    }
+
+    // Unlinks the queues of exited threads that are fully drained, under the
+    // lock, and frees them after it
+    void unlink_retired() {
+        LogQueue* dead = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            LogQueue** link = &registry;
+            while (*link) {
+                LogQueue* q = *link;
+                if (q->retired.load(std::memory_order_acquire) &&
+                    q->head.load(std::memory_order_acquire) == q->tail.load(std::memory_order_relaxed) &&
+                    q->dropped.load(std::memory_order_relaxed) == 0) {
+                    *link = q->next;
+                    q->next = dead;
+                    dead = q;
+                } else {
+                    link = &q->next;
+                }
+            }
+        }
+        while (dead) {
+            LogQueue* q = dead;
+            dead = q->next;
+            delete q;
+        }
+    }
+
+    void emit(int level, time_t sec, const char* text, size_t length) {
+        if (sec != cached_sec_) {
+            // Same layout as ctime(), formatted once per second
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            ts_len_ = strftime(ts_, sizeof(ts_), "[%a %b %e %H:%M:%S %Y] ", &tm);
+            cached_sec_ = sec;
+        }
+        Output& out = level >= LOG_LEVEL_ERROR ? err_ : out_;
+        out.append(ts_, ts_len_);
+        out.append(text, length);
+        out.append("\n", 1);
+    }
+
+    Output out_;
+    Output err_;
+    time_t cached_sec_;
+    char ts_[40];
+    size_t ts_len_;
+};
+
+void start_writer() {
+    writer_thread = new std::thread([] {
+        Writer* writer = new Writer;
+        writer->run();
+        delete writer;
+    });
+    atexit(log_shutdown);
+}
+
+// Registers the calling thread's queue on first use and retires it on exit
+struct QueueHolder {
+    LogQueue* queue;
+
+    QueueHolder() : queue(new LogQueue) {
+        std::call_once(writer_once, start_writer);
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        queue->next = registry;
+        registry = queue;
+    }
+
+    ~QueueHolder() { queue->retired.store(true, std::memory_order_release); }
+};
+
+LogQueue* local_queue() {
+    static thread_local QueueHolder holder;
+    return holder.queue;
+}
+
+void log_vwrite(LogLevel level, uint64_t suppressed, const char* fmt, va_list ap) {
+    if (level < min_level.load(std::memory_order_relaxed)) return;
+
+    LogQueue* q = local_queue();
+    uint64_t head = q->head.load(std::memory_order_relaxed);
+    uint64_t queued = head - q->tail.load(std::memory_order_acquire);
+    if (queued >= LOG_QUEUE_SLOTS) {
+        q->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (queued == LOG_QUEUE_SLOTS / 2) writer_cond.notify_one(); // Wake the writer early in a burst
+
+    LogRecord& r = q->slots[head & (LOG_QUEUE_SLOTS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    r.sec = ts.tv_sec;
+    r.level = static_cast<uint8_t>(level);
+
+    int n = vsnprintf(r.text, LOG_TEXT_SIZE, fmt, ap);
+    if (n < 0) n = 0;
+    if (n >= static_cast<int>(LOG_TEXT_SIZE)) n = LOG_TEXT_SIZE - 1;
+    if (suppressed > 0 && n < static_cast<int>(LOG_TEXT_SIZE) - 1) {
+        int m = snprintf(r.text + n, LOG_TEXT_SIZE - n, " (%llu similar suppressed)",
+                         static_cast<unsigned long long>(suppressed));
+        if (m > 0) n += m;
+        if (n >= static_cast<int>(LOG_TEXT_SIZE)) n = LOG_TEXT_SIZE - 1;
+    }
+    r.length = static_cast<uint16_t>(n);
+
+    q->head.store(head + 1, std::memory_order_release);
+}
+
+} // namespace
+
+void log_write(LogLevel level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, 0, fmt, ap);
+    va_end(ap);
+}
+
+void log_write_suppressed(LogLevel level, uint64_t suppressed, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, suppressed, fmt, ap);
+    va_end(ap);
+}
+
+void log_set_level(LogLevel level) {
+    min_level.store(level, std::memory_order_relaxed);
+}
+
+void log_shutdown() {
+    std::thread* thread;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        thread = writer_thread;
+        writer_thread = nullptr;
+        writer_stop.store(true, std::memory_order_release);
+    }
+    writer_cond.notify_all();
+    if (thread) {
+        thread->join();
+        delete thread;
+    }
+}
+
+bool LogRateLimiter::allow(uint64_t* suppressed) {
+    uint64_t now = monotonic_ns();
+    uint64_t next = next_ns_.load(std::memory_order_relaxed);
+    if (now < next || !next_ns_.compare_exchange_strong(next, now + interval_ns_)) {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    *suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef NLX_COMMON_LOG_H
+#define NLX_COMMON_LOG_H
+
+#include <atomic>
+#include <cstdint>
+
+// Asynchronous logging shared by all servers.
+//
+// Callers format into a fixed-size record on their own lock-free
+// single-producer queue; a background thread stamps, batches and writes the
+// records. Logging never blocks and never flushes on the caller's thread: if
+// a queue is full the record is dropped and counted. Timestamps come from the
+// coarse realtime clock and are formatted once per second by the writer.
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO = 1,
+    LOG_LEVEL_ERROR = 2, // Written to stderr
+};
+
+void log_write(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Same as log_write, appending a note when earlier records from the same call
+// site were suppressed by rate limiting.
+void log_write_suppressed(LogLevel level, uint64_t suppressed, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Records below this level are discarded before formatting (default INFO)
+void log_set_level(LogLevel level);
+
+// Write out everything queued so far and stop the writer thread. Registered
+// with atexit; call it explicitly before a deliberate exit to flush early.
+void log_shutdown();
+
+// Admits one record per interval for a single call site
+class LogRateLimiter {
+public:
+    explicit LogRateLimiter(uint32_t interval_ms) : interval_ns_(interval_ms * 1000000ull), next_ns_(0), suppressed_(0) {}
+
+    // Returns true if the record may be written; *suppressed receives the
+    // number of records dropped since the last admitted one.
+    bool allow(uint64_t* suppressed);
+
+private:
+    uint64_t interval_ns_;
+    std::atomic<uint64_t> next_ns_;
+    std::atomic<uint64_t> suppressed_;
+};
+
+#define LOG_DEBUG(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_ERROR(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// At most one record per interval_ms from this call site, for hot paths
+#define LOG_EVERY_MS(level, interval_ms, ...)                               \
+    do {                                                                    \
+        static LogRateLimiter nlx_log_limiter_(interval_ms);                \
+        uint64_t nlx_log_suppressed_;                                       \
+        if (nlx_log_limiter_.allow(&nlx_log_suppressed_))                   \
+            log_write_suppressed(level, nlx_log_suppressed_, __VA_ARGS__);  \
+    } while (0)
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef NLX_COMMON_MUX_H
+#define NLX_COMMON_MUX_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Interleaved A/V stream framing.
+//
+// Every packet starts with a fixed 16-byte header, all fields big-endian:
+//
+//   offset  size  field
+//   0       2     magic 'N' 'X'
+//   2       1     type  (MUX_TYPE_*)
+//   3       1     flags (MUX_FLAG_*)
+//   4       8     pts   presentation time, CLOCK_MONOTONIC nanoseconds
+//   12      4     payload length in bytes
+//
+// The first packet on a connection is always MUX_TYPE_INFO describing the
+// stream parameters; after that video (JPEG) and audio (S16_LE PCM) packets
+// follow in non-decreasing pts order per type.
+
+const size_t MUX_HEADER_SIZE = 16;
+
+const uint8_t MUX_TYPE_INFO = 'I';
+const uint8_t MUX_TYPE_VIDEO = 'V';
+const uint8_t MUX_TYPE_AUDIO = 'A';
+
+const uint8_t MUX_FLAG_KEYFRAME = 0x01;
+const uint8_t MUX_FLAG_DISCONTINUITY = 0x02; // Data was dropped before this packet
+
+// MUX_TYPE_INFO payload, all fields big-endian
+struct MuxInfo {
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bits_per_sample;
+    uint16_t width;
+    uint16_t height;
+    uint16_t fps;
+};
+
+const size_t MUX_INFO_SIZE = 14;
+
+inline void mux_put_u16(uint8_t* p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v >> 8);
+    p[1] = static_cast<uint8_t>(v);
+}
+
+inline void mux_put_u32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<uint8_t>(v >> (24 - 8 * i));
+}
+
+inline void mux_put_u64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = static_cast<uint8_t>(v >> (56 - 8 * i));
+}
+
+inline void mux_write_header(uint8_t* out, uint8_t type, uint8_t flags, uint64_t pts_ns, uint32_t length) {
+    out[0] = 'N';
+    out[1] = 'X';
+    out[2] = type;
+    out[3] = flags;
+    mux_put_u64(out + 4, pts_ns);
+    mux_put_u32(out + 12, length);
+}
+
+inline void mux_write_info(uint8_t* out, const MuxInfo& info) {
+    mux_put_u32(out, info.sample_rate);
+    mux_put_u16(out + 4, info.channels);
+    mux_put_u16(out + 6, info.bits_per_sample);
+    mux_put_u16(out + 8, info.width);
+    mux_put_u16(out + 10, info.height);
+    mux_put_u16(out + 12, info.fps);
+}
+
+#endif
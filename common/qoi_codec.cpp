@@ -0,0 +1,206 @@
+#include "qoi_codec.h"
+
+#include <cstring>
+
+static const uint8_t QOI_OP_INDEX = 0x00; // 00xxxxxx
+static const uint8_t QOI_OP_DIFF = 0x40;  // 01xxxxxx
+static const uint8_t QOI_OP_LUMA = 0x80;  // 10xxxxxx
+static const uint8_t QOI_OP_RUN = 0xc0;   // 11xxxxxx
+static const uint8_t QOI_OP_RGB = 0xfe;
+static const uint8_t QOI_OP_MASK = 0xc0;
+
+static const size_t HEADER_BYTES = 14;
+static const uint8_t END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+static const int MAX_RUN = 62;        // 63 and 64 would collide with QOI_OP_RGB and QOI_OP_RGBA
+static const int MAX_DIMENSION = 16384;
+
+// Pixels are held as one word, R in the low byte and alpha (always opaque
+// here, but part of the format's hash) in the high one
+static inline uint32_t pack(uint8_t r, uint8_t g, uint8_t b) {
+    return r | (static_cast<uint32_t>(g) << 8) | (static_cast<uint32_t>(b) << 16) | 0xff000000u;
+}
+
+static inline unsigned hash(unsigned r, unsigned g, unsigned b) {
+    return (r * 3 + g * 5 + b * 7 + 255 * 11) & 63;
+}
+
+static inline void put_be32(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+static inline uint32_t get_be32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+size_t qoi_max_size(int width, int height) {
+    return static_cast<size_t>(width) * height * 4 + HEADER_BYTES + sizeof(END_MARKER);
+}
+
+size_t qoi_encode(const uint8_t* bgr, int width, int height, size_t stride, uint8_t* out, size_t capacity) {
+    if (width <= 0 || height <= 0 || capacity < qoi_max_size(width, height)) return 0;
+
+    uint8_t* p = out;
+    memcpy(p, "qoif", 4);
+    put_be32(p + 4, width);
+    put_be32(p + 8, height);
+    p[12] = 3; // Channels
+    p[13] = 0; // sRGB
+    p += HEADER_BYTES;
+
+    uint32_t index[64];
+    memset(index, 0, sizeof(index));
+    uint32_t prev = pack(0, 0, 0);
+    int pr = 0, pg = 0, pb = 0;
+    int run = 0;
+
+    // The pixels form one sequence across rows, as the format has no notion
+    // of rows; only the source pointer jumps at each row's end
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* src = bgr + y * stride;
+        const uint8_t* end = src + static_cast<size_t>(width) * 3;
+        for (; src < end; src += 3) {
+            int r = src[2], g = src[1], b = src[0];
+            uint32_t px = pack(r, g, b);
+            if (px == prev) {
+                if (++run == MAX_RUN) {
+                    *p++ = QOI_OP_RUN | (MAX_RUN - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            // Every candidate op is built and one is picked with bit masks
+            // rather than branches, which camera noise would make
+            // unpredictable; written with `if` or `&&`, the compiler branches
+            // again. The chosen op is stored as four bytes and the pointer
+            // advances by its length; the worst-case bound leaves room for
+            // the overhang.
+            unsigned slot = hash(r, g, b);
+            bool indexed = index[slot] == px;
+            index[slot] = px;
+            // Channel differences wrap, as the decoder adds them modulo 256
+            int dr = static_cast<int8_t>(r - pr);
+            int dg = static_cast<int8_t>(g - pg);
+            int db = static_cast<int8_t>(b - pb);
+            bool small = (static_cast<unsigned>(dr + 2) | static_cast<unsigned>(dg + 2) |
+                          static_cast<unsigned>(db + 2)) < 4;
+            bool luma = (static_cast<unsigned>(dg + 32) < 64) &
+                        ((static_cast<unsigned>(dr - dg + 8) | static_cast<unsigned>(db - dg + 8)) < 16);
+
+            uint32_t op = QOI_OP_RGB | (r << 8) | (g << 16) | (static_cast<uint32_t>(b) << 24);
+            uint32_t luma_op = (QOI_OP_LUMA | (dg + 32)) | (((dr - dg + 8) << 4 | (db - dg + 8)) << 8);
+            uint32_t diff_op = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+            uint32_t luma_mask = 0u - static_cast<uint32_t>(luma);
+            uint32_t small_mask = 0u - static_cast<uint32_t>(small);
+            uint32_t index_mask = 0u - static_cast<uint32_t>(indexed);
+            op ^= (op ^ luma_op) & luma_mask;
+            op ^= (op ^ diff_op) & small_mask;
+            op ^= (op ^ (QOI_OP_INDEX | slot)) & index_mask;
+            uint32_t len = 4 - (luma_mask & 2) - (small_mask & 1);
+            len ^= (len ^ 1) & index_mask;
+            p[0] = static_cast<uint8_t>(op);
+            p[1] = static_cast<uint8_t>(op >> 8);
+            p[2] = static_cast<uint8_t>(op >> 16);
+            p[3] = static_cast<uint8_t>(op >> 24);
+            p += len;
+
+            prev = px;
+            pr = r;
+            pg = g;
+            pb = b;
+        }
+    }
+    if (run > 0) *p++ = QOI_OP_RUN | (run - 1);
+
+    memcpy(p, END_MARKER, sizeof(END_MARKER));
+    p += sizeof(END_MARKER);
+    return p - out;
+}
+
+bool qoi_check(const uint8_t* data, size_t size) {
+    return size >= HEADER_BYTES + sizeof(END_MARKER) && memcmp(data, "qoif", 4) == 0;
+}
+
+bool qoi_peek_size(const uint8_t* data, size_t size, int* width, int* height) {
+    if (!qoi_check(data, size)) return false;
+    uint32_t w = get_be32(data + 4), h = get_be32(data + 8);
+    if (w == 0 || h == 0 || w > MAX_DIMENSION || h > MAX_DIMENSION || data[12] < 3) return false;
+    *width = static_cast<int>(w);
+    *height = static_cast<int>(h);
+    return true;
+}
+
+bool qoi_decode(const uint8_t* data, size_t size, uint8_t* out, size_t stride, bool bgr) {
+    int width, height;
+    if (!qoi_peek_size(data, size, &width, &height)) return false;
+
+    // Every op is at most 4 bytes and the stream ends with the 8-byte
+    // marker, so an op that starts before the marker can be read whole
+    const uint8_t* p = data + HEADER_BYTES;
+    const uint8_t* ops_end = data + size - sizeof(END_MARKER);
+    int r_at = bgr ? 2 : 0, b_at = bgr ? 0 : 2;
+
+    uint32_t index[64];
+    memset(index, 0, sizeof(index));
+    int r = 0, g = 0, b = 0;
+    int run = 0;
+
+    for (int y = 0; y < height; ++y) {
+        uint8_t* dst = out + y * stride;
+        uint8_t* end = dst + static_cast<size_t>(width) * 3;
+        for (; dst < end; dst += 3) {
+            if (run > 0) {
+                --run;
+            } else {
+                if (p >= ops_end) return false;
+                unsigned op = *p++;
+                switch (op >> 6) {
+                    case QOI_OP_INDEX >> 6: {
+                        uint32_t px = index[op];
+                        r = px & 0xff;
+                        g = (px >> 8) & 0xff;
+                        b = (px >> 16) & 0xff;
+                        break;
+                    }
+                    case QOI_OP_DIFF >> 6:
+                        r = (r + ((op >> 4) & 3) - 2) & 0xff;
+                        g = (g + ((op >> 2) & 3) - 2) & 0xff;
+                        b = (b + (op & 3) - 2) & 0xff;
+                        break;
+                    case QOI_OP_LUMA >> 6: {
+                        int dg = static_cast<int>(op & 0x3f) - 32;
+                        r = (r + dg + (*p >> 4) - 8) & 0xff;
+                        g = (g + dg) & 0xff;
+                        b = (b + dg + (*p & 0x0f) - 8) & 0xff;
+                        ++p;
+                        break;
+                    }
+                    default:
+                        if (op >= QOI_OP_RGB) {
+                            // QOI_OP_RGBA carries an alpha byte; frames are opaque, it is dropped
+                            r = p[0];
+                            g = p[1];
+                            b = p[2];
+                            p += op == QOI_OP_RGB ? 3 : 4;
+                        } else {
+                            run = op & 0x3f;
+                        }
+                        break;
+                }
+                index[hash(r, g, b)] = pack(r, g, b);
+            }
+            dst[r_at] = static_cast<uint8_t>(r);
+            dst[1] = static_cast<uint8_t>(g);
+            dst[b_at] = static_cast<uint8_t>(b);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,210 @@
+#include "rt_profile.h"
+#include "log.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct RtRole {
+    std::string name;
+    int policy;
+    int priority;
+    cpu_set_t cpus;
+    int n_cpus; // 0 leaves the affinity alone
+    std::string cpu_list;
+};
+
+// Written by rt_profile_parse() before any thread starts, read-only after
+std::vector<RtRole> roles;
+bool lock_memory = false;
+
+// Stack each profiled thread touches up front; deeper than any hot loop here
+const size_t STACK_PREFAULT_BYTES = 256 * 1024;
+
+bool parse_int(const std::string& text, int& value) {
+    if (text.empty()) return false;
+    char* end = nullptr;
+    long v = strtol(text.c_str(), &end, 10);
+    if (*end != '\0' || v < 0 || v > 65535) return false;
+    value = static_cast<int>(v);
+    return true;
+}
+
+bool parse_cpus(const std::string& text, RtRole& role) {
+    CPU_ZERO(&role.cpus);
+    role.n_cpus = 0;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, '+')) {
+        size_t dash = item.find('-');
+        int first, last;
+        if (dash == std::string::npos) {
+            if (!parse_int(item, first)) return false;
+            last = first;
+        } else if (!parse_int(item.substr(0, dash), first) || !parse_int(item.substr(dash + 1), last)) {
+            return false;
+        }
+        if (first > last || last >= CPU_SETSIZE) return false;
+        for (int cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, &role.cpus);
+            ++role.n_cpus;
+        }
+    }
+    role.cpu_list = text;
+    return role.n_cpus > 0;
+}
+
+const char* policy_name(int policy) {
+    switch (policy) {
+        case SCHED_FIFO: return "SCHED_FIFO";
+        case SCHED_RR: return "SCHED_RR";
+        default: return "SCHED_OTHER";
+    }
+}
+
+// Separate frame so the compiler cannot fold the array away
+__attribute__((noinline)) void prefault_stack() {
+    volatile char stack[STACK_PREFAULT_BYTES];
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sizeof(stack); i += page) stack[i] = 0;
+}
+
+} // namespace
+
+bool rt_profile_parse(const std::string& spec, std::string& error) {
+    std::stringstream ss(spec);
+    std::string entry;
+    while (std::getline(ss, entry, ',')) {
+        if (entry.empty()) continue;
+        if (entry == "mlock") {
+            lock_memory = true;
+            continue;
+        }
+
+        size_t eq = entry.find('=');
+        if (eq == std::string::npos || eq == 0) {
+            error = "expected <role>=<policy> in \"" + entry + "\"";
+            return false;
+        }
+        RtRole role;
+        role.name = entry.substr(0, eq);
+        role.priority = 0;
+        role.n_cpus = 0;
+        CPU_ZERO(&role.cpus);
+
+        std::string rest = entry.substr(eq + 1);
+        size_t at = rest.find('@');
+        if (at != std::string::npos) {
+            if (!parse_cpus(rest.substr(at + 1), role)) {
+                error = "bad CPU list in \"" + entry + "\"";
+                return false;
+            }
+            rest = rest.substr(0, at);
+        }
+        size_t colon = rest.find(':');
+        std::string policy = rest.substr(0, colon);
+        if (policy == "fifo") role.policy = SCHED_FIFO;
+        else if (policy == "rr") role.policy = SCHED_RR;
+        else if (policy == "other") role.policy = SCHED_OTHER;
+        else {
+            error = "unknown policy \"" + policy + "\" (fifo, rr or other)";
+            return false;
+        }
+
+        if (colon != std::string::npos && !parse_int(rest.substr(colon + 1), role.priority)) {
+            error = "bad priority in \"" + entry + "\"";
+            return false;
+        }
+        if (role.policy != SCHED_OTHER) {
+            int lo = sched_get_priority_min(role.policy), hi = sched_get_priority_max(role.policy);
+            if (colon == std::string::npos) role.priority = lo;
+            if (role.priority < lo || role.priority > hi) {
+                error = "priority for " + role.name + " must be " + std::to_string(lo) + ".." + std::to_string(hi);
+                return false;
+            }
+        } else if (role.priority != 0) {
+            error = "SCHED_OTHER takes no priority in \"" + entry + "\"";
+            return false;
+        }
+        roles.push_back(role);
+    }
+    return true;
+}
+
+void rt_profile_apply(const char* role) {
+    // Thread names show up in top -H, ps -L and perf, which is how a
+    // profile is checked on the board
+    char name[16];
+    std::snprintf(name, sizeof(name), "nlx-%s", role);
+    pthread_setname_np(pthread_self(), name);
+
+    for (size_t i = 0; i < roles.size(); ++i) {
+        const RtRole& r = roles[i];
+        if (r.name != role) continue;
+
+        if (r.n_cpus > 0) {
+            int err = pthread_setaffinity_np(pthread_self(), sizeof(r.cpus), &r.cpus);
+            if (err != 0) LOG_ERROR("Thread %s: cannot pin to CPUs %s: %s", role, r.cpu_list.c_str(), strerror(err));
+        }
+
+        struct sched_param param;
+        std::memset(&param, 0, sizeof(param));
+        param.sched_priority = r.priority;
+        int err = pthread_setschedparam(pthread_self(), r.policy, &param);
+        if (err != 0) {
+            LOG_ERROR("Thread %s: cannot set %s priority %d: %s (needs CAP_SYS_NICE or LimitRTPRIO)", role,
+                      policy_name(r.policy), r.priority, strerror(err));
+        } else {
+            LOG_INFO("Thread %s: %s priority %d, CPUs %s", role, policy_name(r.policy), r.priority,
+                     r.n_cpus ? r.cpu_list.c_str() : "any");
+        }
+        break;
+    }
+
+    if (lock_memory) prefault_stack();
+}
+
+void rt_profile_lock_memory() {
+    if (!lock_memory) return;
+
+    // Freed blocks stay in the heap instead of going back to the kernel, so
+    // a buffer released and reallocated later is still resident and locked
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    // MCL_CURRENT faults in and locks what exists now, frame pools included.
+    // Later mappings (thread stacks in particular, 8 MiB each) are locked
+    // only as their pages are touched rather than populated whole.
+    if (mlockall(MCL_CURRENT) != 0) {
+        LOG_ERROR("mlockall failed: %s (raise LimitMEMLOCK / ulimit -l)", strerror(errno));
+        return;
+    }
+#ifdef MCL_ONFAULT
+    if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) == 0) {
+        LOG_INFO("Memory locked, later pages lock on first touch");
+        return;
+    }
+#endif
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        LOG_ERROR("mlockall(MCL_FUTURE) failed: %s", strerror(errno));
+        return;
+    }
+    LOG_INFO("Memory locked");
+}
+
+void rt_prefault(void* data, size_t bytes) {
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(data);
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < bytes; i += page) p[i] = p[i];
+}
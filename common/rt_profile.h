@@ -0,0 +1,38 @@
+#ifndef NLX_COMMON_RT_PROFILE_H
+#define NLX_COMMON_RT_PROFILE_H
+
+#include <cstddef>
+#include <string>
+
+// Real-time profile for the servers' latency-critical threads.
+//
+// A profile is given on the command line as comma-separated entries:
+//
+//   <role>=<fifo|rr|other>[:<priority>][@<cpus>]   scheduling for one thread role
+//   mlock                                          lock and prefault memory
+//
+// where <cpus> is a '+'-separated list of cores or ranges, e.g.
+// `capture=fifo:80@2,client=rr:60@3,serial=fifo:40@3,mlock`. Roles not listed
+// keep the default scheduler and float across cores.
+//
+// Each thread calls rt_profile_apply() with its role when it starts; the
+// settings are per thread, so threads spawned later start from the default
+// again. Failures (usually missing CAP_SYS_NICE / LimitRTPRIO, or
+// LimitMEMLOCK for mlock) are logged and the thread carries on unprivileged.
+
+// Parses a profile; on error returns false with a message in `error`
+bool rt_profile_parse(const std::string& spec, std::string& error);
+
+// Applies the profile entry for `role` to the calling thread and names it
+void rt_profile_apply(const char* role);
+
+// With `mlock` in the profile: locks everything mapped so far (call once
+// the frame pools and device buffers exist, which prefaults them), locks
+// later pages as they are first touched, and keeps freed heap memory mapped
+// so a steady-state loop never takes a page fault. No-op otherwise.
+void rt_profile_lock_memory();
+
+// Touches every page of `bytes` at `data` so first use does not fault
+void rt_prefault(void* data, size_t bytes);
+
+#endif
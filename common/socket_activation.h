@@ -0,0 +1,28 @@
+#ifndef NLX_COMMON_SOCKET_ACTIVATION_H
+#define NLX_COMMON_SOCKET_ACTIVATION_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+
+// systemd socket activation without libsystemd (the sd_listen_fds(3)
+// protocol): when started from a .socket unit, the listening socket is
+// already open as fd 3 and LISTEN_PID/LISTEN_FDS describe it.
+static const int LISTEN_FDS_START = 3;
+
+// Returns the passed listening socket, or -1 when the process was not
+// socket-activated. Clears the variables so children do not inherit them.
+inline int activated_listen_fd() {
+    const char* pid = getenv("LISTEN_PID");
+    const char* fds = getenv("LISTEN_FDS");
+    bool activated = pid && fds && strtol(pid, nullptr, 10) == getpid() && strtol(fds, nullptr, 10) >= 1;
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    if (!activated) return -1;
+
+    fcntl(LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+    return LISTEN_FDS_START;
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef NLX_COMMON_SYNTHETIC_AUDIO_H
+#define NLX_COMMON_SYNTHETIC_AUDIO_H
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+
+#include "clock.h"
+
+// Hardware-free capture source selected with `--device synthetic`: a sine
+// tone delivered in real time, paced on CLOCK_MONOTONIC the way a sound card
+// releases periods. Never allocates after construction.
+//
+// With set_buffering() it also models the card's ring buffer: data becomes
+// readable a whole period at a time, and a reader that falls more than
+// `n_periods` periods behind gets -EPIPE and loses the overwritten audio,
+// like an ALSA overrun.
+//
+// With set_markers() a marker burst replaces the tone whenever
+// CLOCK_MONOTONIC crosses a multiple of the marker interval. A receiver on
+// the same host can therefore tell exactly when each marker was captured
+// (see native_client/audio_latency_bench.cpp).
+class SyntheticAudio {
+public:
+    // Markers are a 63-chip maximal-length sequence; its autocorrelation has
+    // a single sharp peak, so a cross-correlating receiver finds the first
+    // sample exactly even with the tone around it
+    static const int MARKER_LENGTH = 63;
+    static const int MARKER_AMPLITUDE = 20000;
+
+    static int marker_chip(int i) {
+        static int8_t chips[MARKER_LENGTH];
+        static bool built = false;
+        if (!built) {
+            // LFSR for x^6 + x^5 + 1
+            unsigned int state = 1;
+            for (int k = 0; k < MARKER_LENGTH; ++k) {
+                chips[k] = (state & 1) ? 1 : -1;
+                unsigned int bit = (state ^ (state >> 1)) & 1;
+                state = (state >> 1) | (bit << 5);
+            }
+            built = true;
+        }
+        return chips[i];
+    }
+
+    explicit SyntheticAudio(unsigned int sample_rate, double tone_hz = 440.0)
+        : sample_rate_(sample_rate), phase_(0.0), step_(2.0 * M_PI * tone_hz / sample_rate),
+          start_ns_(0), produced_(0), period_size_(0), n_periods_(0), overruns_(0),
+          marker_interval_ns_(0), next_marker_ns_(0), marker_pos_(MARKER_LENGTH) {
+        marker_chip(0);
+    }
+
+    // Emulate a card configured with this period size and period count
+    void set_buffering(unsigned int period_size, unsigned int n_periods) {
+        period_size_ = period_size;
+        n_periods_ = n_periods;
+    }
+
+    // Inject a marker every interval_ms (0 disables)
+    void set_markers(unsigned int interval_ms) {
+        marker_interval_ns_ = interval_ms * 1000000ull;
+    }
+
+    // Blocks until `frames` mono samples are due, then fills them. Returns
+    // -EPIPE (and skips ahead) if the reader overran the modelled buffer.
+    long read(int16_t* out, unsigned long frames) {
+        if (start_ns_ == 0) {
+            start_ns_ = monotonic_ns();
+            if (marker_interval_ns_) next_marker_ns_ = (start_ns_ / marker_interval_ns_ + 1) * marker_interval_ns_;
+        }
+
+        if (period_size_ && n_periods_) {
+            uint64_t written = (monotonic_ns() - start_ns_) * sample_rate_ / 1000000000ull;
+            if (written > produced_ + static_cast<uint64_t>(period_size_) * n_periods_) {
+                // The card overwrote unread data; resume at its current period
+                produced_ = written - written % period_size_;
+                ++overruns_;
+                return -EPIPE;
+            }
+        }
+
+        uint64_t available = produced_ + frames;
+        if (period_size_) available = (available + period_size_ - 1) / period_size_ * period_size_;
+        uint64_t due_ns = start_ns_ + available * 1000000000ull / sample_rate_;
+        struct timespec due;
+        due.tv_sec = due_ns / 1000000000ull;
+        due.tv_nsec = due_ns % 1000000000ull;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr) == EINTR) {}
+
+        for (unsigned long i = 0; i < frames; ++i) {
+            if (marker_interval_ns_ && marker_pos_ >= MARKER_LENGTH) {
+                uint64_t sample_ns = start_ns_ + (produced_ + i) * 1000000000ull / sample_rate_;
+                if (sample_ns >= next_marker_ns_) {
+                    marker_pos_ = 0;
+                    next_marker_ns_ = (sample_ns / marker_interval_ns_ + 1) * marker_interval_ns_;
+                }
+            }
+            if (marker_pos_ < MARKER_LENGTH) {
+                out[i] = static_cast<int16_t>(MARKER_AMPLITUDE * marker_chip(marker_pos_++));
+            } else {
+                out[i] = static_cast<int16_t>(8000.0 * std::sin(phase_));
+            }
+            phase_ += step_;
+            if (phase_ > 2.0 * M_PI) phase_ -= 2.0 * M_PI;
+        }
+        produced_ += frames;
+        return static_cast<long>(frames);
+    }
+
+    unsigned int sample_rate() const { return sample_rate_; }
+    unsigned long overruns() const { return overruns_; }
+
+private:
+    unsigned int sample_rate_;
+    double phase_;
+    double step_;
+    uint64_t start_ns_;
+    uint64_t produced_; // Frames handed out since start_ns_
+    unsigned int period_size_;
+    unsigned int n_periods_;
+    unsigned long overruns_;
+    uint64_t marker_interval_ns_;
+    uint64_t next_marker_ns_;
+    int marker_pos_;    // Next chip of the marker in progress; MARKER_LENGTH when idle
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef NLX_COMMON_SYNTHETIC_VIDEO_H
+#define NLX_COMMON_SYNTHETIC_VIDEO_H
+
+#include <opencv2/opencv.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+
+#include "clock.h"
+
+// Hardware-free frame source selected with `--device synthetic`: a moving
+// BGR test pattern paced at the configured fps. Frames are rendered into the
+// caller's Mat, which is only reallocated when the size changes.
+class SyntheticVideo {
+public:
+    SyntheticVideo() : width_(320), height_(240), fps_(30), index_(0), next_ns_(0) {}
+
+    void set_size(int width, int height) {
+        if (width > 0) width_ = width;
+        if (height > 0) height_ = height;
+    }
+
+    void set_fps(int fps) {
+        if (fps > 0) fps_ = fps;
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int fps() const { return fps_; }
+
+    bool read(cv::Mat& frame) {
+        uint64_t now = monotonic_ns();
+        if (next_ns_ == 0 || now > next_ns_ + 1000000000ull) next_ns_ = now;
+        struct timespec due;
+        due.tv_sec = next_ns_ / 1000000000ull;
+        due.tv_nsec = next_ns_ % 1000000000ull;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr) == EINTR) {}
+        next_ns_ += 1000000000ull / fps_;
+
+        frame.create(height_, width_, CV_8UC3);
+        const int t = static_cast<int>(index_++);
+        const int bar = (t * 4) % width_;
+        for (int y = 0; y < height_; ++y) {
+            uint8_t* row = frame.ptr<uint8_t>(y);
+            for (int x = 0; x < width_; ++x) {
+                bool on_bar = x >= bar && x < bar + 16;
+                row[3 * x + 0] = on_bar ? 255 : static_cast<uint8_t>(x + t);
+                row[3 * x + 1] = on_bar ? 255 : static_cast<uint8_t>(y + 2 * t);
+                row[3 * x + 2] = on_bar ? 255 : static_cast<uint8_t>((x + y) / 2);
+            }
+        }
+        return true;
+    }
+
+private:
+    int width_;
+    int height_;
+    int fps_;
+    uint64_t index_;
+    uint64_t next_ns_; // Release time of the next frame
+};
+
+#endif
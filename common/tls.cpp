@@ -0,0 +1,155 @@
+#include "tls.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+static const char* TLS12_CIPHERS = "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+                                   "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384";
+
+static std::string ssl_error(const char* what) {
+    char buf[256];
+    unsigned long err = ERR_get_error();
+    ERR_clear_error();
+    if (err == 0) return what;
+    ERR_error_string_n(err, buf, sizeof(buf));
+    return std::string(what) + ": " + buf;
+}
+
+static void set_timeouts(int fd, int timeout_ms) {
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Settings shared by both ends; false if this OpenSSL cannot do kTLS at all.
+// OpenSSL 3.0 installs receive keys in the kernel for TLS 1.2 only, and both
+// ends read through the kernel.
+static bool configure(SSL_CTX* ctx, std::string& error) {
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_TICKET | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_num_tickets(ctx, 0);
+    if (!SSL_CTX_set_cipher_list(ctx, TLS12_CIPHERS)) {
+        error = ssl_error("Cannot set TLS ciphers");
+        return false;
+    }
+    return true;
+#else
+    error = "OpenSSL was built without kernel TLS support";
+    return false;
+#endif
+}
+
+TlsServer::TlsServer() : ctx_(nullptr) {}
+
+TlsServer::~TlsServer() {
+    if (ctx_) SSL_CTX_free(ctx_);
+}
+
+bool TlsServer::load(const std::string& cert_path, const std::string& key_path, std::string& error) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        error = ssl_error("Cannot create TLS context");
+        return false;
+    }
+    if (!configure(ctx, error)) {
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_path.c_str()) != 1) {
+        error = ssl_error(("Cannot load certificate " + cert_path).c_str());
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_path.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        error = ssl_error(("Cannot load private key " + key_path).c_str());
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    if (ctx_) SSL_CTX_free(ctx_);
+    ctx_ = ctx;
+    return true;
+}
+
+bool TlsServer::accept(int fd, int timeout_ms, std::string& error) const {
+    SSL* ssl = SSL_new(ctx_);
+    if (!ssl) {
+        error = ssl_error("Cannot create TLS session");
+        return false;
+    }
+    set_timeouts(fd, timeout_ms);
+    bool ok = false;
+    if (SSL_set_fd(ssl, fd) != 1) {
+        error = ssl_error("Cannot attach TLS session");
+    } else if (SSL_accept(ssl) != 1) {
+        error = ssl_error("TLS handshake failed");
+    } else if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        error = std::string("Kernel TLS unavailable for ") + SSL_get_cipher_name(ssl) + " (modprobe tls)";
+    } else {
+        ok = true;
+    }
+    // The socket BIO does not own fd; freeing leaves the kernel state in place
+    SSL_free(ssl);
+    set_timeouts(fd, 0);
+    return ok;
+}
+
+bool tls_connect_client(int fd, const std::string& host, const std::string& ca_file, int timeout_ms,
+                        std::string& error) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx) {
+        error = ssl_error("Cannot create TLS context");
+        return false;
+    }
+    if (!configure(ctx, error)) {
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    if (!ca_file.empty()) {
+        if (SSL_CTX_load_verify_locations(ctx, ca_file.c_str(), nullptr) != 1) {
+            error = ssl_error(("Cannot load CA file " + ca_file).c_str());
+            SSL_CTX_free(ctx);
+            return false;
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+
+    SSL* ssl = SSL_new(ctx);
+    SSL_CTX_free(ctx); // The session holds its own reference
+    if (!ssl) {
+        error = ssl_error("Cannot create TLS session");
+        return false;
+    }
+    unsigned char addr[sizeof(struct in6_addr)];
+    bool is_ip = inet_pton(AF_INET, host.c_str(), addr) == 1 || inet_pton(AF_INET6, host.c_str(), addr) == 1;
+    if (!is_ip) SSL_set_tlsext_host_name(ssl, host.c_str());
+    if (!ca_file.empty()) {
+        if (is_ip) X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.c_str());
+        else SSL_set1_host(ssl, host.c_str());
+    }
+
+    set_timeouts(fd, timeout_ms);
+    bool ok = false;
+    if (SSL_set_fd(ssl, fd) != 1) {
+        error = ssl_error("Cannot attach TLS session");
+    } else if (SSL_connect(ssl) != 1) {
+        long verify = SSL_get_verify_result(ssl);
+        error = verify != X509_V_OK ? std::string("TLS certificate rejected: ") +
+                                          X509_verify_cert_error_string(verify)
+                                    : ssl_error("TLS handshake failed");
+    } else if (!BIO_get_ktls_recv(SSL_get_rbio(ssl)) || !BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+        error = std::string("Kernel TLS unavailable for ") + SSL_get_cipher_name(ssl) + " (modprobe tls)";
+    } else {
+        ok = true;
+    }
+    SSL_free(ssl);
+    set_timeouts(fd, 0);
+    return ok;
+}
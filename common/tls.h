@@ -0,0 +1,51 @@
+#ifndef NLX_COMMON_TLS_H
+#define NLX_COMMON_TLS_H
+
+#include <string>
+
+typedef struct ssl_ctx_st SSL_CTX;
+
+// TLS with the record layer in the kernel (kTLS).
+//
+// OpenSSL only performs the handshake. Afterwards the session keys are
+// installed on the socket with TLS_TX and TLS_RX and the OpenSSL objects are
+// freed: the plain send/writev/sendfile and recv paths keep working
+// unchanged and the kernel encrypts or decrypts in place, with no userspace
+// copy. Needs the `tls` kernel module (`modprobe tls`) and OpenSSL 3 built
+// with KTLS; without them the connection is refused rather than silently
+// left in plaintext.
+//
+// Only TLS 1.2 AES-GCM suites are offered: those are what kTLS implements in
+// every kernel that has it, and OpenSSL 3.0 moves receive keys into the
+// kernel for TLS 1.2 only. Session tickets are disabled: nothing may be
+// written through OpenSSL once the kernel owns the record sequence.
+
+class TlsServer {
+public:
+    TlsServer();
+    ~TlsServer();
+
+    // Loads a PEM certificate chain and private key
+    bool load(const std::string& cert_path, const std::string& key_path, std::string& error);
+    bool enabled() const { return ctx_ != nullptr; }
+
+    // Handshakes on the connected blocking socket `fd` (giving up after
+    // timeout_ms) and moves the record layer into the kernel. On failure
+    // the caller closes the connection.
+    bool accept(int fd, int timeout_ms, std::string& error) const;
+
+private:
+    TlsServer(const TlsServer&);
+    TlsServer& operator=(const TlsServer&);
+
+    SSL_CTX* ctx_;
+};
+
+// Client side: handshakes on the connected blocking socket `fd` and moves
+// the record layer into the kernel. With `ca_file` the server certificate
+// is verified against it and `host`; without, the link is encrypted but the
+// server is not authenticated.
+bool tls_connect_client(int fd, const std::string& host, const std::string& ca_file, int timeout_ms,
+                        std::string& error);
+
+#endif
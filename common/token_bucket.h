@@ -0,0 +1,44 @@
+#ifndef NLX_COMMON_TOKEN_BUCKET_H
+#define NLX_COMMON_TOKEN_BUCKET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Byte-rate limiter: tokens accrue at `rate` bytes per second, up to `burst`
+// while the sender is idle. A send may take more than is left; the debt then
+// delays the next one, so the long-run rate holds whatever the frame sizes
+// and a sender never has to split a frame to fit. A rate of 0 disables it.
+class TokenBucket {
+public:
+    TokenBucket(double rate, double burst) : rate_(rate), burst_(burst), tokens_(burst), last_ns_(0) {}
+
+    bool enabled() const { return rate_ > 0; }
+
+    // Nanoseconds until the debt is paid off; 0 when a send may start now
+    uint64_t wait_ns(uint64_t now_ns) {
+        if (!enabled()) return 0;
+        refill(now_ns);
+        if (tokens_ >= 0) return 0;
+        return static_cast<uint64_t>(-tokens_ / rate_ * 1e9) + 1;
+    }
+
+    void consume(size_t bytes, uint64_t now_ns) {
+        if (!enabled()) return;
+        refill(now_ns);
+        tokens_ -= static_cast<double>(bytes);
+    }
+
+private:
+    void refill(uint64_t now_ns) {
+        if (last_ns_ != 0 && now_ns > last_ns_) tokens_ = std::min(burst_, tokens_ + (now_ns - last_ns_) * rate_ / 1e9);
+        last_ns_ = now_ns;
+    }
+
+    double rate_;
+    double burst_;
+    double tokens_;
+    uint64_t last_ns_;
+};
+
+#endif
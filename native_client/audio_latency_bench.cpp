@@ -0,0 +1,436 @@
+// Audio end-to-end latency benchmark. The audio server's synthetic source
+// (`--device synthetic --markers <ms>`) replaces its tone with a marker burst
+// whenever CLOCK_MONOTONIC crosses a multiple of the marker interval. This
+// tool receives the stream, finds each marker by cross-correlation and
+// compares the arrival time of the chunk that carried it with the instant it
+// was captured. It must run on the same host as the server, since both sides
+// read the same monotonic clock.
+//
+// Samples missing between two markers reveal overruns, so a sweep over
+// period size and period count (--server starts one server per setting)
+// yields a latency/xrun trade-off table. --stress adds busy processes to
+// check a server --rt-profile under load; --histogram shows the full
+// latency distribution per setting.
+#include <getopt.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_receiver.h"
+#include "clock.h"
+#include "synthetic_audio.h"
+
+static const int MARKER_LENGTH = SyntheticAudio::MARKER_LENGTH;
+static const int ARRIVAL_SLOTS = 8;
+
+struct BenchConfig {
+    std::string host;
+    int port;
+    unsigned int sample_rate;
+    unsigned int chunk;       // Frames per server send
+    unsigned int marker_ms;
+    double threshold;         // Normalized correlation that counts as a marker
+    int warmup_s;
+    int duration_s;
+    std::string rt_profile;   // Passed to started servers
+};
+
+struct RunResult {
+    std::vector<double> latency_ms;
+    uint64_t markers;
+    uint64_t xruns;           // Marker intervals with missing samples
+    uint64_t lost_samples;
+    std::string error;
+
+    RunResult() : markers(0), xruns(0), lost_samples(0) {}
+};
+
+// Streaming matched filter for the marker sequence. Keeps the last
+// MARKER_LENGTH - 1 samples so markers split across chunks are found.
+class MarkerDetector {
+public:
+    explicit MarkerDetector(double threshold)
+        : threshold_(threshold), work_(MARKER_LENGTH - 1, 0), peak_(-1.0), peak_index_(0), peak_left_(0),
+          skip_until_(0) {}
+
+    // Feeds `n` samples starting at stream index `base`; appends the stream
+    // index of the first sample of every marker found to `found`
+    void feed(const int16_t* samples, size_t n, uint64_t base, std::vector<uint64_t>& found) {
+        work_.resize(MARKER_LENGTH - 1);
+        work_.insert(work_.end(), samples, samples + n);
+
+        // Sliding energy over the window via running sum
+        double energy = 0.0;
+        for (int k = 0; k < MARKER_LENGTH - 1; ++k) energy += static_cast<double>(work_[k]) * work_[k];
+        for (size_t p = 0; p < n; ++p) {
+            double newest = work_[p + MARKER_LENGTH - 1];
+            energy += newest * newest;
+            uint64_t index = base + p - (MARKER_LENGTH - 1);
+
+            if (index >= skip_until_ && base + p >= static_cast<uint64_t>(MARKER_LENGTH - 1) && energy > 0.0) {
+                double dot = 0.0;
+                for (int k = 0; k < MARKER_LENGTH; ++k) dot += work_[p + k] * SyntheticAudio::marker_chip(k);
+                double score = dot / std::sqrt(energy * MARKER_LENGTH);
+                if (score > threshold_ && score > peak_) {
+                    if (peak_ < 0) peak_left_ = MARKER_LENGTH;
+                    peak_ = score;
+                    peak_index_ = index;
+                }
+            }
+            if (peak_ >= 0 && --peak_left_ <= 0) {
+                found.push_back(peak_index_);
+                skip_until_ = peak_index_ + MARKER_LENGTH;
+                peak_ = -1.0;
+            }
+
+            double oldest = work_[p];
+            energy -= oldest * oldest;
+        }
+        work_.erase(work_.begin(), work_.end() - (MARKER_LENGTH - 1));
+    }
+
+private:
+    double threshold_;
+    std::vector<int16_t> work_;
+    double peak_;
+    uint64_t peak_index_;
+    int peak_left_;
+    uint64_t skip_until_;
+};
+
+static bool measure(const BenchConfig& config, RunResult& result) {
+    AudioReceiver receiver;
+    uint64_t deadline = monotonic_ns() + 5000000000ull;
+    // A freshly started server may not be listening yet
+    while (!receiver.connect(config.host, config.port, 1000)) {
+        if (monotonic_ns() > deadline) {
+            result.error = receiver.error();
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    MarkerDetector detector(config.threshold);
+    std::vector<int16_t> chunk(config.chunk);
+    std::vector<uint64_t> found;
+    uint64_t arrival_ns[ARRIVAL_SLOTS];
+    uint64_t interval_ns = config.marker_ms * 1000000ull;
+    uint64_t start_ns = monotonic_ns();
+    uint64_t measure_ns = start_ns + config.warmup_s * 1000000000ull;
+    uint64_t end_ns = measure_ns + config.duration_s * 1000000000ull;
+    uint64_t received = 0;
+    uint64_t last_index = 0, last_capture_ns = 0;
+
+    while (monotonic_ns() < end_ns) {
+        if (!receiver.receive(chunk.data(), chunk.size())) {
+            result.error = receiver.error();
+            return false;
+        }
+        uint64_t now = monotonic_ns();
+        uint64_t chunk_no = received / config.chunk;
+        arrival_ns[chunk_no % ARRIVAL_SLOTS] = now;
+
+        found.clear();
+        detector.feed(chunk.data(), chunk.size(), received, found);
+        received += chunk.size();
+
+        for (size_t i = 0; i < found.size(); ++i) {
+            uint64_t marker_chunk = found[i] / config.chunk;
+            if (chunk_no - marker_chunk >= ARRIVAL_SLOTS) continue;
+            uint64_t arrived = arrival_ns[marker_chunk % ARRIVAL_SLOTS];
+            // Markers sit on multiples of the interval; latency is assumed
+            // to stay below one interval
+            uint64_t captured = arrived / interval_ns * interval_ns;
+
+            if (last_capture_ns && now >= measure_ns) {
+                double expected = (captured - last_capture_ns) / 1e9 * config.sample_rate;
+                double lost = expected - static_cast<double>(found[i] - last_index);
+                if (lost > 2.0) {
+                    ++result.xruns;
+                    result.lost_samples += static_cast<uint64_t>(lost + 0.5);
+                }
+            }
+            if (now >= measure_ns) {
+                result.latency_ms.push_back((arrived - captured) / 1e6);
+                ++result.markers;
+            }
+            last_index = found[i];
+            last_capture_ns = captured;
+        }
+    }
+    return true;
+}
+
+static pid_t start_server(const std::string& path, const BenchConfig& config, unsigned int period_size,
+                          unsigned int n_periods, bool verbose) {
+    std::vector<std::string> args;
+    args.push_back(path);
+    args.push_back("--device");
+    args.push_back("synthetic");
+    args.push_back("--port=" + std::to_string(config.port));
+    args.push_back("--sample-rate=" + std::to_string(config.sample_rate));
+    args.push_back("--chunk=" + std::to_string(config.chunk));
+    args.push_back("--markers=" + std::to_string(config.marker_ms));
+    args.push_back("--period-size=" + std::to_string(period_size));
+    args.push_back("--periods=" + std::to_string(n_periods));
+    if (!config.rt_profile.empty()) args.push_back("--rt-profile=" + config.rt_profile);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!verbose) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        std::vector<char*> argv;
+        for (size_t i = 0; i < args.size(); ++i) argv.push_back(const_cast<char*>(args[i].c_str()));
+        argv.push_back(nullptr);
+        execv(path.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_server(pid_t pid) {
+    kill(pid, SIGINT);
+    for (int i = 0; i < 40; ++i) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+// CPU hogs at normal priority, one per requested core's worth of load
+static std::vector<pid_t> start_stress(int n) {
+    std::vector<pid_t> pids;
+    for (int i = 0; i < n; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Die with the benchmark, including on Ctrl-C
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() == 1) _exit(0);
+            for (volatile unsigned long spin = 0;; ++spin) {}
+        }
+        if (pid > 0) pids.push_back(pid);
+    }
+    return pids;
+}
+
+static void stop_stress(const std::vector<pid_t>& pids) {
+    for (size_t i = 0; i < pids.size(); ++i) kill(pids[i], SIGKILL);
+    for (size_t i = 0; i < pids.size(); ++i) waitpid(pids[i], nullptr, 0);
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+}
+
+static void print_header() {
+    std::printf("%7s %7s %9s | %7s %7s %7s %7s %7s %7s | %7s %5s %8s\n", "period", "periods", "buffer_ms", "p50_ms",
+                "p90_ms", "p99_ms", "max_ms", "jit_sd", "jit_pp", "markers", "xruns", "lost_ms");
+}
+
+static void print_row(unsigned int period_size, unsigned int n_periods, const BenchConfig& config,
+                      RunResult& result) {
+    std::vector<double>& v = result.latency_ms;
+    std::sort(v.begin(), v.end());
+    double mean = 0.0, var = 0.0;
+    for (size_t i = 0; i < v.size(); ++i) mean += v[i];
+    if (!v.empty()) mean /= v.size();
+    for (size_t i = 0; i < v.size(); ++i) var += (v[i] - mean) * (v[i] - mean);
+    if (v.size() > 1) var /= v.size() - 1;
+
+    char period[16], periods[16], buffer[16];
+    std::snprintf(period, sizeof(period), period_size ? "%u" : "-", period_size);
+    std::snprintf(periods, sizeof(periods), n_periods ? "%u" : "-", n_periods);
+    std::snprintf(buffer, sizeof(buffer), period_size ? "%.1f" : "-",
+                  period_size * n_periods * 1000.0 / config.sample_rate);
+    std::printf("%7s %7s %9s | %7.2f %7.2f %7.2f %7.2f %7.2f %7.2f | %7llu %5llu %8.1f\n", period, periods, buffer,
+                percentile(v, 0.50), percentile(v, 0.90), percentile(v, 0.99), v.empty() ? 0.0 : v.back(),
+                std::sqrt(var), percentile(v, 0.99) - percentile(v, 0.01),
+                static_cast<unsigned long long>(result.markers), static_cast<unsigned long long>(result.xruns),
+                result.lost_samples * 1000.0 / config.sample_rate);
+    std::fflush(stdout);
+}
+
+// Latency distribution in fixed-width buckets; expects result.latency_ms
+// sorted (print_row does that)
+static void print_histogram(const RunResult& result, double bucket_ms) {
+    const std::vector<double>& v = result.latency_ms;
+    if (v.empty()) return;
+    const size_t MAX_BUCKETS = 40;
+    double first = std::floor(v.front() / bucket_ms) * bucket_ms;
+    std::vector<size_t> counts(std::min(MAX_BUCKETS, static_cast<size_t>((v.back() - first) / bucket_ms) + 1), 0);
+    size_t peak = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        size_t b = std::min(counts.size() - 1, static_cast<size_t>((v[i] - first) / bucket_ms));
+        peak = std::max(peak, ++counts[b]);
+    }
+    for (size_t b = 0; b < counts.size(); ++b) {
+        bool last = b + 1 == counts.size() && v.back() >= first + counts.size() * bucket_ms;
+        std::printf("    %s%7.2f ms %7zu %s\n", last ? ">=" : "  ", first + b * bucket_ms, counts[b],
+                    std::string(counts[b] * 50 / peak, '#').c_str());
+    }
+    std::fflush(stdout);
+}
+
+static std::vector<unsigned int> parse_list(const char* text) {
+    std::vector<unsigned int> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) values.push_back(std::stoul(item));
+    if (values.empty()) throw std::invalid_argument(text);
+    return values;
+}
+
+void print_usage(const char* prog_name) {
+    std::cerr << "Usage: " << prog_name
+              << " [options]\n"
+              << "Measures against a running server (--device synthetic --markers <ms>), or with --server\n"
+              << "starts one synthetic server per period setting and prints a trade-off table.\n"
+              << "Options:\n"
+              << "  --host <host>          Server address (default: 127.0.0.1; must be this host)\n"
+              << "  --port <port>          Audio port (default: 40918)\n"
+              << "  --sample-rate <rate>   Stream sample rate (default: 44100)\n"
+              << "  --chunk <frames>       Frames per server send (default: 1024)\n"
+              << "  --markers <ms>         Marker interval the server uses (default: 250)\n"
+              << "  --threshold <0..1>     Correlation needed to accept a marker (default: 0.6)\n"
+              << "  --warmup <s>           Seconds ignored after connecting (default: 1)\n"
+              << "  --duration <s>         Seconds measured per setting (default: 10)\n"
+              << "  --server <path>        Audio server binary to start for each setting\n"
+              << "  --period-sizes <list>  Comma-separated period sizes to sweep (default: 64,128,256,512)\n"
+              << "  --periods <list>       Comma-separated period counts to sweep (default: 2,4,8)\n"
+              << "  --rt-profile <spec>    Pass --rt-profile to the started servers\n"
+              << "  --stress <n>           Run n busy-loop processes during the measurement\n"
+              << "  --histogram <ms>       Print the latency distribution in buckets of this width\n"
+              << "  --verbose              Show the started servers' output\n"
+              << "  --help                 Show this help\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    config.host = "127.0.0.1";
+    config.port = 40918;
+    config.sample_rate = 44100;
+    config.chunk = 1024;
+    config.marker_ms = 250;
+    config.threshold = 0.6;
+    config.warmup_s = 1;
+    config.duration_s = 10;
+    std::string server;
+    std::vector<unsigned int> period_sizes = {64, 128, 256, 512};
+    std::vector<unsigned int> period_counts = {2, 4, 8};
+    bool verbose = false;
+    int stress = 0;
+    double histogram_ms = 0.0;
+
+    static struct option long_options[] = {
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'p'},
+        {"sample-rate", required_argument, 0, 's'},
+        {"chunk", required_argument, 0, 'c'},
+        {"markers", required_argument, 0, 'm'},
+        {"threshold", required_argument, 0, 'T'},
+        {"warmup", required_argument, 0, 'w'},
+        {"duration", required_argument, 0, 't'},
+        {"server", required_argument, 0, 'S'},
+        {"period-sizes", required_argument, 0, 'P'},
+        {"periods", required_argument, 0, 'n'},
+        {"rt-profile", required_argument, 0, 'R'},
+        {"stress", required_argument, 0, 'L'},
+        {"histogram", required_argument, 0, 'g'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'x'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        try {
+            switch (opt) {
+                case 'H': config.host = optarg; break;
+                case 'p': config.port = std::stoi(optarg); break;
+                case 's': config.sample_rate = std::stoul(optarg); break;
+                case 'c': config.chunk = std::stoul(optarg); break;
+                case 'm': config.marker_ms = std::stoul(optarg); break;
+                case 'T': config.threshold = std::stod(optarg); break;
+                case 'w': config.warmup_s = std::stoi(optarg); break;
+                case 't': config.duration_s = std::stoi(optarg); break;
+                case 'S': server = optarg; break;
+                case 'P': period_sizes = parse_list(optarg); break;
+                case 'n': period_counts = parse_list(optarg); break;
+                case 'R': config.rt_profile = optarg; break;
+                case 'L': stress = std::stoi(optarg); break;
+                case 'g': histogram_ms = std::stod(optarg); break;
+                case 'v': verbose = true; break;
+                case 'x': print_usage(argv[0]); return 0;
+                default: print_usage(argv[0]); return -1;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid argument: " << e.what() << "\n";
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (config.chunk == 0 || config.marker_ms == 0 || config.sample_rate == 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    std::printf("Chunk %u frames (%.1f ms), markers every %u ms, %d s per setting\n", config.chunk,
+                config.chunk * 1000.0 / config.sample_rate, config.marker_ms, config.duration_s);
+    if (stress > 0) std::printf("Stress: %d busy processes\n", stress);
+    if (!config.rt_profile.empty()) std::printf("Server RT profile: %s\n", config.rt_profile.c_str());
+    print_header();
+
+    std::vector<pid_t> hogs = start_stress(stress);
+
+    if (server.empty()) {
+        RunResult result;
+        bool ok = measure(config, result);
+        stop_stress(hogs);
+        if (!ok) {
+            std::cerr << "Measurement failed: " << result.error << "\n";
+            return 1;
+        }
+        print_row(0, 0, config, result);
+        if (histogram_ms > 0) print_histogram(result, histogram_ms);
+        return result.markers ? 0 : 1;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < period_sizes.size(); ++i) {
+        for (size_t j = 0; j < period_counts.size(); ++j) {
+            pid_t pid = start_server(server, config, period_sizes[i], period_counts[j], verbose);
+            if (pid < 0) {
+                std::perror("fork");
+                stop_stress(hogs);
+                return 1;
+            }
+            RunResult result;
+            bool ok = measure(config, result);
+            stop_server(pid);
+            if (!ok) {
+                std::printf("%7u %7u   failed: %s\n", period_sizes[i], period_counts[j], result.error.c_str());
+                ++failures;
+                continue;
+            }
+            print_row(period_sizes[i], period_counts[j], config, result);
+            if (histogram_ms > 0) print_histogram(result, histogram_ms);
+        }
+    }
+    stop_stress(hogs);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+#include "audio_receiver.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tcp_socket.h"
+
+AudioReceiver::AudioReceiver() : fd_(-1), bytes_(0) {}
+
+AudioReceiver::~AudioReceiver() {
+    close();
+}
+
+bool AudioReceiver::connect(const std::string& host, int port, int timeout_ms) {
+    close();
+    bytes_ = 0;
+    fd_ = tcp_connect(host, port, timeout_ms, tls_, error_);
+    return fd_ >= 0;
+}
+
+void AudioReceiver::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+void AudioReceiver::interrupt() {
+    int fd = fd_;
+    if (fd >= 0) shutdown(fd, SHUT_RDWR);
+}
+
+bool AudioReceiver::receive(int16_t* out, size_t frames) {
+    if (fd_ < 0) {
+        error_ = "Not connected";
+        return false;
+    }
+    return recv_exact(fd_, out, frames * sizeof(int16_t), bytes_, error_);
+}
+
+size_t AudioReceiver::flush() {
+    if (fd_ < 0) return 0;
+    // Keep sample alignment: drop whole samples only, finishing a split one
+    size_t dropped = recv_discard(fd_);
+    bytes_ += dropped;
+    if (bytes_ % sizeof(int16_t)) {
+        int16_t partial;
+        recv_exact(fd_, &partial, 1, bytes_, error_);
+    }
+    return dropped;
+}
@@ -0,0 +1,48 @@
+#ifndef NLX_NATIVE_CLIENT_AUDIO_RECEIVER_H
+#define NLX_NATIVE_CLIENT_AUDIO_RECEIVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "tcp_socket.h"
+
+// Native receive path for the audio stream: raw S16_LE mono with no framing,
+// cut into fixed-size chunks here. Unlike a single recv() per chunk, a chunk
+// split across TCP segments is reassembled rather than dropped.
+class AudioReceiver {
+public:
+    AudioReceiver();
+    ~AudioReceiver();
+
+    // Applies to the next connect()
+    void set_tls(const TlsOptions& tls) { tls_ = tls; }
+
+    bool connect(const std::string& host, int port, int timeout_ms);
+    void close();
+    bool connected() const { return fd_ >= 0; }
+
+    // Blocks until `frames` samples were written to `out`. Returns false on
+    // disconnect, error or after interrupt(); error() says which.
+    bool receive(int16_t* out, size_t frames);
+
+    // Drops audio already queued in the socket so playback catches up
+    size_t flush();
+
+    // Makes a blocked receive() return false; safe from any thread
+    void interrupt();
+
+    const std::string& error() const { return error_; }
+    uint64_t bytes_received() const { return bytes_; }
+
+private:
+    AudioReceiver(const AudioReceiver&);
+    AudioReceiver& operator=(const AudioReceiver&);
+
+    int fd_;
+    TlsOptions tls_;
+    uint64_t bytes_;
+    std::string error_;
+};
+
+#endif
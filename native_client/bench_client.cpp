@@ -0,0 +1,321 @@
+// Headless video client: receives the stream, decodes it natively and
+// reports throughput, pipeline latency and CPU use once per second. Used to
+// compare the native path against the PyQt client and to size the decode
+// pool for a given resolution.
+#include <getopt.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "video_receiver.h"
+
+static std::atomic<bool> running(true);
+static VideoReceiver* active_receiver = nullptr;
+
+static void handle_sigint(int) {
+    running = false;
+    // shutdown(2) is async-signal-safe and unblocks the receive loop
+    if (active_receiver) active_receiver->interrupt();
+}
+
+// Samples for one reporting interval; the vectors are reserved up front and
+// only cleared, so steady-state reporting does not allocate
+struct Stats {
+    std::mutex mutex;
+    std::vector<uint32_t> latency_us; // First byte received -> decoded
+    uint64_t frames;
+    uint64_t recv_us;
+    uint64_t decode_us;
+    uint64_t decode_errors;
+
+    Stats() : frames(0), recv_us(0), decode_us(0), decode_errors(0) { latency_us.reserve(1024); }
+
+    void add(const DecodedFrame& f) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++frames;
+        recv_us += (f.last_byte_ns - f.first_byte_ns) / 1000;
+        decode_us += (f.decoded_ns - f.last_byte_ns) / 1000;
+        if (latency_us.size() < latency_us.capacity()) {
+            latency_us.push_back(static_cast<uint32_t>((f.decoded_ns - f.first_byte_ns) / 1000));
+        }
+    }
+};
+
+struct Totals {
+    uint64_t frames;
+    std::vector<uint32_t> latency_us;
+    Totals() : frames(0) {}
+};
+
+static uint32_t percentile(std::vector<uint32_t>& v, double p) {
+    if (v.empty()) return 0;
+    size_t k = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+static uint64_t cpu_us() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void report(Stats& stats, Totals& totals, std::vector<uint32_t>& scratch, uint64_t bytes, double seconds,
+                   double cpu_percent) {
+    uint64_t frames, recv_us, decode_us;
+    {
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        frames = stats.frames;
+        recv_us = stats.recv_us;
+        decode_us = stats.decode_us;
+        scratch.assign(stats.latency_us.begin(), stats.latency_us.end());
+        stats.frames = stats.recv_us = stats.decode_us = 0;
+        stats.latency_us.clear();
+    }
+    totals.frames += frames;
+    totals.latency_us.insert(totals.latency_us.end(), scratch.begin(), scratch.end());
+
+    std::printf("%6.1f fps %7.2f Mbit/s | recv %6.2f ms decode %6.2f ms | latency p50 %6.2f p95 %6.2f p99 %6.2f ms"
+                " | cpu %5.1f%%\n",
+                frames / seconds, bytes * 8 / seconds / 1e6, frames ? recv_us / 1000.0 / frames : 0.0,
+                frames ? decode_us / 1000.0 / frames : 0.0, percentile(scratch, 0.50) / 1000.0,
+                percentile(scratch, 0.95) / 1000.0, percentile(scratch, 0.99) / 1000.0, cpu_percent);
+    std::fflush(stdout);
+}
+
+void print_usage(const char* prog_name) {
+    std::cerr << "Usage: " << prog_name
+              << " [options]\n"
+              << "Options:\n"
+              << "  --host <host>        Server address (default: 127.0.0.1)\n"
+              << "  --port <port>        Video port (default: 40917)\n"
+              << "  --channel <n>        Camera to request from a multi-camera server (default: the server's 0)\n"
+              << "  --size <W>x<H>       Ask the server to scale down to this resolution (default: its own)\n"
+              << "  --quality <q>        Ask the server for this JPEG quality (default: its own)\n"
+              << "  --codec <codec>      Ask the server for jpeg, lossless qoi, or delta frames (exact\n"
+              << "                       raw as LZ4 keyframes and deltas, decoded inline: --threads 0)\n"
+              << "                       (default: jpeg)\n"
+              << "  --fps <n>            Ask the server for at most this many frames per second\n"
+              << "  --max-kbps <n>       Ask the server to cap its send rate at this many kbit/s\n"
+              << "  --pull <ms>          Pull mode: request the newest frame every <ms>; latency then\n"
+              << "                       counts from the request\n"
+              << "  --drop <policy>      When behind, ask the server to skip to the newest frame (latest),\n"
+              << "                       send all its history holds (queue) or disconnect (close)\n"
+              << "  --duration <s>       Stop after this many seconds, 0 runs until Ctrl-C (default: 0)\n"
+              << "  --threads <n>        Decode worker threads, 0 decodes on the receive thread (default: 0)\n"
+              << "  --format <rgb|bgr>   Decoded pixel format (default: rgb)\n"
+              << "  --no-decode          Only receive; measures the network path alone\n"
+              << "  --tls                Connect over TLS (kernel TLS); compare with a plaintext\n"
+              << "                       run to measure the encryption overhead\n"
+              << "  --tls-ca <pem>       Verify the server certificate against this CA (implies --tls)\n"
+              << "  --help               Show this help\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string host = "127.0.0.1";
+    int port = 40917;
+    int channel = -1;
+    int width = 0, height = 0, quality = 0;
+    int fps = 0, max_kbps = 0;
+    int pull_ms = 0;
+    std::string drop;
+    std::string codec;
+    int duration = 0;
+    int threads = 0;
+    PixelFormat format = PIXEL_RGB;
+    bool decode = true;
+    TlsOptions tls;
+
+    static struct option long_options[] = {
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'p'},
+        {"channel", required_argument, 0, 'c'},
+        {"size", required_argument, 0, 'S'},
+        {"quality", required_argument, 0, 'q'},
+        {"fps", required_argument, 0, 'F'},
+        {"max-kbps", required_argument, 0, 'K'},
+        {"pull", required_argument, 0, 'P'},
+        {"drop", required_argument, 0, 'D'},
+        {"codec", required_argument, 0, 'k'},
+        {"duration", required_argument, 0, 't'},
+        {"threads", required_argument, 0, 'j'},
+        {"format", required_argument, 0, 'f'},
+        {"no-decode", no_argument, 0, 'n'},
+        {"tls", no_argument, 0, 's'},
+        {"tls-ca", required_argument, 0, 'C'},
+        {"help", no_argument, 0, 'x'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        try {
+            switch (opt) {
+                case 'H': host = optarg; break;
+                case 'p': port = std::stoi(optarg); break;
+                case 'c': channel = std::stoi(optarg); break;
+                case 'S':
+                    if (sscanf(optarg, "%dx%d", &width, &height) != 2) throw std::invalid_argument(optarg);
+                    break;
+                case 'q': quality = std::stoi(optarg); break;
+                case 'F': fps = std::stoi(optarg); break;
+                case 'K': max_kbps = std::stoi(optarg); break;
+                case 'P': pull_ms = std::stoi(optarg); break;
+                case 'D':
+                    drop = optarg;
+                    if (drop != "latest" && drop != "queue" && drop != "close") throw std::invalid_argument(optarg);
+                    break;
+                case 'k':
+                    codec = optarg;
+                    if (codec != "jpeg" && codec != "qoi" && codec != "delta") throw std::invalid_argument(optarg);
+                    break;
+                case 't': duration = std::stoi(optarg); break;
+                case 'j': threads = std::stoi(optarg); break;
+                case 'f':
+                    if (std::string(optarg) == "bgr") format = PIXEL_BGR;
+                    else if (std::string(optarg) != "rgb") throw std::invalid_argument(optarg);
+                    break;
+                case 'n': decode = false; break;
+                case 's': tls.enabled = true; break;
+                case 'C': tls.enabled = true; tls.ca_file = optarg; break;
+                case 'x': print_usage(argv[0]); return 0;
+                default: print_usage(argv[0]); return -1;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid argument: " << e.what() << "\n";
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (codec == "delta" && decode && threads > 0) {
+        std::cerr << "--codec delta decodes in order on the receive thread; use --threads 0\n";
+        return -1;
+    }
+
+    VideoReceiver receiver;
+    receiver.set_tls(tls);
+    receiver.set_channel(channel);
+    receiver.set_variant(width, height, quality);
+    receiver.set_pacing(fps, max_kbps);
+    receiver.set_pull(pull_ms > 0);
+    receiver.set_drop(drop);
+    receiver.set_codec(codec);
+    if (!receiver.connect(host, port, 3000)) {
+        std::cerr << receiver.error() << "\n";
+        return 1;
+    }
+    std::printf("Connected to %s:%d%s, decode: %s\n", host.c_str(), port, tls.enabled ? " (TLS)" : "",
+                !decode ? "off" : threads > 0 ? (std::to_string(threads) + " threads").c_str() : "inline");
+
+    active_receiver = &receiver;
+    struct sigaction sa;
+    sa.sa_handler = handle_sigint;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    Stats stats;
+    Totals totals;
+    totals.latency_us.reserve(1024 * 64);
+    std::vector<uint32_t> scratch;
+    scratch.reserve(1024);
+
+    DecodePool* pool = nullptr;
+    if (decode && threads > 0) {
+        pool = new DecodePool(threads, format, threads + 1, [&stats](const DecodedFrame& f) { stats.add(f); });
+    }
+
+    JpegDecoder decoder;
+    EncodedFrame encoded;
+    DecodedFrame decoded;
+    uint64_t received = 0, undecoded = 0, lost_markers = 0;
+    uint64_t start_ns = monotonic_ns(), interval_ns = start_ns;
+    uint64_t start_cpu = cpu_us(), interval_cpu = start_cpu;
+    uint64_t interval_bytes = 0;
+    uint64_t next_pull_ns = start_ns;
+
+    while (running) {
+        uint64_t requested_ns = 0;
+        if (pull_ms > 0) {
+            uint64_t now = monotonic_ns();
+            if (now < next_pull_ns) usleep((next_pull_ns - now) / 1000);
+            next_pull_ns += pull_ms * 1000000ULL;
+            requested_ns = monotonic_ns();
+            if (!receiver.request_frame()) {
+                if (running) std::cerr << receiver.error() << "\n";
+                break;
+            }
+        }
+        if (!receiver.receive(encoded)) {
+            if (running) std::cerr << receiver.error() << "\n";
+            break;
+        }
+        ++received;
+        if (requested_ns) encoded.first_byte_ns = requested_ns;
+
+        if (encoded.size == 0) {
+            ++lost_markers;
+        } else if (!decode) {
+            // Count receive-only frames with decode time zero
+            decoded.seq = encoded.seq;
+            decoded.first_byte_ns = encoded.first_byte_ns;
+            decoded.last_byte_ns = decoded.decoded_ns = encoded.last_byte_ns;
+            stats.add(decoded);
+        } else if (pool) {
+            pool->submit(encoded);
+        } else if (decoder.decode(encoded, format, decoded)) {
+            stats.add(decoded);
+        } else {
+            ++undecoded;
+        }
+
+        uint64_t now = monotonic_ns();
+        if (now - interval_ns >= 1000000000ULL) {
+            uint64_t cpu = cpu_us();
+            double seconds = (now - interval_ns) / 1e9;
+            uint64_t bytes = receiver.bytes_received();
+            report(stats, totals, scratch, bytes - interval_bytes, seconds,
+                   (cpu - interval_cpu) / 10000.0 / seconds);
+            interval_ns = now;
+            interval_cpu = cpu;
+            interval_bytes = bytes;
+        }
+        if (duration > 0 && now - start_ns >= duration * 1000000000ULL) break;
+    }
+
+    active_receiver = nullptr;
+    uint64_t dropped = 0;
+    if (pool) {
+        pool->stop();
+        dropped = pool->dropped();
+        delete pool;
+    }
+
+    double seconds = (monotonic_ns() - start_ns) / 1e9;
+    double cpu_percent = (cpu_us() - start_cpu) / 10000.0 / seconds;
+    {
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        totals.frames += stats.frames;
+        totals.latency_us.insert(totals.latency_us.end(), stats.latency_us.begin(), stats.latency_us.end());
+    }
+    std::printf("Summary: %llu frames received, %llu shown, %llu dropped, %llu undecodable, %llu source-lost markers"
+                " in %.1f s\n",
+                static_cast<unsigned long long>(received), static_cast<unsigned long long>(totals.frames),
+                static_cast<unsigned long long>(dropped), static_cast<unsigned long long>(undecoded),
+                static_cast<unsigned long long>(lost_markers), seconds);
+    std::printf("  %.1f fps, %.2f Mbit/s, cpu %.1f%%, latency p50 %.2f p95 %.2f p99 %.2f max %.2f ms\n",
+                totals.frames / seconds, receiver.bytes_received() * 8 / seconds / 1e6, cpu_percent,
+                percentile(totals.latency_us, 0.50) / 1000.0, percentile(totals.latency_us, 0.95) / 1000.0,
+                percentile(totals.latency_us, 0.99) / 1000.0, percentile(totals.latency_us, 1.0) / 1000.0);
+    return 0;
+}
@@ -0,0 +1,214 @@
+// Python module `nlxclient`: the native receive/decode path for the PyQt
+// clients. Socket reads, framing, JPEG decode and PCM chunking run with the
+// GIL released; results come back as numpy arrays that point straight at the
+// buffers the data was decoded or received into.
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audio_receiver.h"
+#include "clock.h"
+#include "video_receiver.h"
+
+namespace py = pybind11;
+
+// Recycles the memory behind returned arrays. A buffer goes back into use
+// once Python drops every array that references it; while the caller holds
+// on to more arrays than the pool keeps, extra buffers are allocated and
+// freed normally. Used from one reading thread at a time.
+class ArrayBufferPool {
+public:
+    typedef std::shared_ptr<std::vector<uint8_t>> Buffer;
+
+    explicit ArrayBufferPool(size_t max_pooled) : max_pooled_(max_pooled) {}
+
+    Buffer acquire(size_t size) {
+        for (size_t i = 0; i < buffers_.size(); ++i) {
+            // use_count() == 1: only the pool holds it, no array is alive
+            if (buffers_[i].use_count() == 1) {
+                if (buffers_[i]->size() < size) buffers_[i]->resize(size);
+                return buffers_[i];
+            }
+        }
+        Buffer buffer = std::make_shared<std::vector<uint8_t>>(size);
+        if (buffers_.size() < max_pooled_) buffers_.push_back(buffer);
+        return buffer;
+    }
+
+private:
+    size_t max_pooled_;
+    std::vector<Buffer> buffers_;
+};
+
+// Wraps pooled memory in an array without copying; the capsule keeps the
+// buffer alive for as long as the array (or any view of it) exists
+template <typename T>
+static py::array_t<T> wrap(const ArrayBufferPool::Buffer& buffer, std::vector<py::ssize_t> shape,
+                           std::vector<py::ssize_t> strides) {
+    ArrayBufferPool::Buffer* owner = new ArrayBufferPool::Buffer(buffer);
+    py::capsule base(owner, [](void* p) { delete static_cast<ArrayBufferPool::Buffer*>(p); });
+    return py::array_t<T>(shape, strides, reinterpret_cast<T*>(buffer->data()), base);
+}
+
+static TlsOptions tls_options(bool tls, const std::string& tls_ca) {
+    TlsOptions options;
+    options.enabled = tls || !tls_ca.empty();
+    options.ca_file = tls_ca;
+    return options;
+}
+
+static py::object connection_error(const std::string& message) {
+    PyErr_SetString(PyExc_ConnectionError, message.c_str());
+    throw py::error_already_set();
+}
+
+class PyVideoStream {
+public:
+    PyVideoStream(const std::string& host, int port, int timeout_ms, const std::string& format, bool tls,
+                  const std::string& tls_ca, int channel, int width, int height, int quality, int fps,
+                  int max_kbps, const std::string& codec)
+        : format_(format == "bgr" ? PIXEL_BGR : PIXEL_RGB), pool_(4), stopped_(false), frames_(0),
+          latency_ms_(0) {
+        if (format != "rgb" && format != "bgr") throw py::value_error("format must be 'rgb' or 'bgr'");
+        if (codec != "jpeg" && codec != "qoi" && codec != "delta") {
+            throw py::value_error("codec must be 'jpeg', 'qoi' or 'delta'");
+        }
+        receiver_.set_tls(tls_options(tls, tls_ca));
+        receiver_.set_channel(channel);
+        receiver_.set_variant(width, height, quality);
+        receiver_.set_pacing(fps, max_kbps);
+        if (codec != "jpeg") receiver_.set_codec(codec);
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = receiver_.connect(host, port, timeout_ms);
+        }
+        if (!ok) connection_error(receiver_.error());
+    }
+
+    // Next decoded frame as an (height, width, 3) uint8 array, or None once
+    // stop() was called. Frames that fail to decode are skipped.
+    py::object read() {
+        ArrayBufferPool::Buffer buffer;
+        int width = 0, height = 0;
+        bool ok = false;
+        {
+            py::gil_scoped_release release;
+            while (!ok && receiver_.receive(encoded_)) {
+                if (encoded_.size == 0) continue; // "Source lost" marker
+                if (!decoder_.peek_size(encoded_.data.data(), encoded_.size, &width, &height)) continue;
+                size_t stride = static_cast<size_t>(width) * 3;
+                buffer = pool_.acquire(stride * height);
+                ok = decoder_.decode_into(encoded_.data.data(), encoded_.size, format_, buffer->data(), stride);
+            }
+            if (ok) latency_ms_ = (monotonic_ns() - encoded_.first_byte_ns) / 1e6;
+        }
+        if (!ok) {
+            if (stopped_) return py::none();
+            return connection_error(receiver_.error());
+        }
+        ++frames_;
+        return wrap<uint8_t>(buffer, {height, width, 3}, {static_cast<py::ssize_t>(width) * 3, 3, 1});
+    }
+
+    // Unblocks a read() in progress on another thread; it returns None
+    void stop() {
+        stopped_ = true;
+        receiver_.interrupt();
+    }
+
+    uint64_t frames() const { return frames_; }
+    uint64_t bytes_received() const { return receiver_.bytes_received(); }
+    double latency_ms() const { return latency_ms_; }
+
+private:
+    VideoReceiver receiver_;
+    JpegDecoder decoder_;
+    EncodedFrame encoded_;
+    PixelFormat format_;
+    ArrayBufferPool pool_;
+    std::atomic<bool> stopped_;
+    uint64_t frames_;
+    double latency_ms_;
+};
+
+class PyAudioStream {
+public:
+    PyAudioStream(const std::string& host, int port, size_t chunk, int timeout_ms, bool tls, const std::string& tls_ca)
+        : chunk_(chunk), pool_(16), stopped_(false) {
+        if (chunk == 0) throw py::value_error("chunk must be positive");
+        receiver_.set_tls(tls_options(tls, tls_ca));
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = receiver_.connect(host, port, timeout_ms);
+        }
+        if (!ok) connection_error(receiver_.error());
+    }
+
+    // Next `chunk` samples as an int16 array, or None once stop() was called
+    py::object read() {
+        ArrayBufferPool::Buffer buffer = pool_.acquire(chunk_ * sizeof(int16_t));
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = receiver_.receive(reinterpret_cast<int16_t*>(buffer->data()), chunk_);
+        }
+        if (!ok) {
+            if (stopped_) return py::none();
+            return connection_error(receiver_.error());
+        }
+        return wrap<int16_t>(buffer, {static_cast<py::ssize_t>(chunk_)},
+                             {static_cast<py::ssize_t>(sizeof(int16_t))});
+    }
+
+    size_t flush() { return receiver_.flush(); }
+
+    void stop() {
+        stopped_ = true;
+        receiver_.interrupt();
+    }
+
+    size_t chunk() const { return chunk_; }
+    uint64_t bytes_received() const { return receiver_.bytes_received(); }
+
+private:
+    AudioReceiver receiver_;
+    size_t chunk_;
+    ArrayBufferPool pool_;
+    std::atomic<bool> stopped_;
+};
+
+PYBIND11_MODULE(nlxclient, m) {
+    m.doc() = "Native receive and decode for the NlxVideoTransm video and audio streams";
+
+    py::class_<PyVideoStream>(m, "VideoStream")
+        .def(py::init<const std::string&, int, int, const std::string&, bool, const std::string&, int, int, int,
+                      int, int, int, const std::string&>(),
+             py::arg("host"), py::arg("port") = 40917, py::arg("timeout_ms") = 3000, py::arg("format") = "rgb",
+             py::arg("tls") = false, py::arg("tls_ca") = "", py::arg("channel") = -1, py::arg("width") = 0,
+             py::arg("height") = 0, py::arg("quality") = 0, py::arg("fps") = 0, py::arg("max_kbps") = 0,
+             py::arg("codec") = "jpeg")
+        .def("read", &PyVideoStream::read,
+             "Block for the next frame; returns an (h, w, 3) uint8 array, or None after stop()")
+        .def("stop", &PyVideoStream::stop, "Unblock read() from another thread")
+        .def_property_readonly("frames", &PyVideoStream::frames)
+        .def_property_readonly("bytes_received", &PyVideoStream::bytes_received)
+        .def_property_readonly("latency_ms", &PyVideoStream::latency_ms,
+                               "First byte received to decoded, for the last frame");
+
+    py::class_<PyAudioStream>(m, "AudioStream")
+        .def(py::init<const std::string&, int, size_t, int, bool, const std::string&>(), py::arg("host"),
+             py::arg("port") = 40918, py::arg("chunk") = 1024, py::arg("timeout_ms") = 3000, py::arg("tls") = false,
+             py::arg("tls_ca") = "")
+        .def("read", &PyAudioStream::read,
+             "Block for the next chunk; returns an int16 array, or None after stop()")
+        .def("flush", &PyAudioStream::flush, "Drop audio already queued in the socket; returns bytes dropped")
+        .def("stop", &PyAudioStream::stop, "Unblock read() from another thread")
+        .def_property_readonly("chunk", &PyAudioStream::chunk)
+        .def_property_readonly("bytes_received", &PyAudioStream::bytes_received);
+}
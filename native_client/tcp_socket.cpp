@@ -0,0 +1,91 @@
+#include "tcp_socket.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "tls.h"
+
+int tcp_connect(const std::string& host, int port, int timeout_ms, const TlsOptions& tls, std::string& error) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    int gai = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res);
+    if (gai != 0) {
+        error = std::string("Resolve failed: ") + gai_strerror(gai);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = std::string("Socket failed: ") + strerror(errno);
+        freeaddrinfo(res);
+        return -1;
+    }
+    int ret = connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (ret < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret == 0) errno = ETIMEDOUT;
+        if (ret > 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) ret = 0;
+        else if (ret > 0) errno = err, ret = -1;
+        else ret = -1;
+    }
+    if (ret < 0) {
+        error = std::string("Connect failed: ") + strerror(errno);
+        close(fd);
+        return -1;
+    }
+
+    // Back to blocking: receivers wait in recv, not in a poll loop
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (tls.enabled && !tls_connect_client(fd, host, tls.ca_file, timeout_ms, error)) {
+        close(fd);
+        return -1;
+    }
+    error.clear();
+    return fd;
+}
+
+bool recv_exact(int fd, void* buf, size_t len, uint64_t& counter, std::string& error) {
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n > 0) {
+            p += n;
+            len -= n;
+            counter += n;
+        } else if (n == 0) {
+            error = "Connection closed by server";
+            return false;
+        } else if (errno != EINTR) {
+            error = std::string("Receive failed: ") + strerror(errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t recv_discard(int fd) {
+    uint8_t scratch[4096];
+    size_t total = 0;
+    for (;;) {
+        ssize_t n = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+        if (n > 0) total += n;
+        else if (n < 0 && errno == EINTR) continue;
+        else return total;
+    }
+}
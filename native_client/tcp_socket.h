@@ -0,0 +1,29 @@
+#ifndef NLX_NATIVE_CLIENT_TCP_SOCKET_H
+#define NLX_NATIVE_CLIENT_TCP_SOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Client TLS for tcp_connect(), decrypted by the kernel (see common/tls.h)
+struct TlsOptions {
+    bool enabled;
+    std::string ca_file; // Verify the server against this CA; empty encrypts only
+
+    TlsOptions() : enabled(false) {}
+};
+
+// Connects to host:port, giving up after timeout_ms, and performs the TLS
+// handshake if enabled. Returns a blocking socket with TCP_NODELAY set that
+// reads plaintext either way, or -1 with `error` filled in.
+int tcp_connect(const std::string& host, int port, int timeout_ms, const TlsOptions& tls, std::string& error);
+
+// recv() straight into `buf` until `len` bytes arrived, adding them to
+// `counter`. Returns false with `error` filled in on disconnect or failure.
+bool recv_exact(int fd, void* buf, size_t len, uint64_t& counter, std::string& error);
+
+// Discards whatever is already queued on the socket without blocking;
+// returns the number of bytes dropped
+size_t recv_discard(int fd);
+
+#endif
@@ -0,0 +1,247 @@
+#include "video_receiver.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <turbojpeg.h>
+#include <cerrno>
+#include <cstring>
+
+#include "clock.h"
+#include "qoi_codec.h"
+#include "tcp_socket.h"
+
+// Anything larger is a corrupt size prefix, not a frame
+static const uint32_t MAX_FRAME_BYTES = 64u << 20;
+
+VideoReceiver::VideoReceiver()
+    : fd_(-1), channel_(-1), width_(0), height_(0), quality_(0), fps_(0), max_kbps_(0), pull_(false), crop_x_(0),
+      crop_y_(0), crop_w_(0), crop_h_(0), seq_(0), bytes_(0) {}
+
+VideoReceiver::~VideoReceiver() {
+    close();
+}
+
+bool VideoReceiver::connect(const std::string& host, int port, int timeout_ms) {
+    close();
+    seq_ = 0;
+    bytes_ = 0;
+    fd_ = tcp_connect(host, port, timeout_ms, tls_, error_);
+    if (fd_ < 0) return false;
+
+    std::string request;
+    if (channel_ >= 0) request += " CHANNEL " + std::to_string(channel_);
+    if (width_ > 0 && height_ > 0) request += " SIZE " + std::to_string(width_) + "x" + std::to_string(height_);
+    if (quality_ > 0) request += " QUALITY " + std::to_string(quality_);
+    if (fps_ > 0) request += " FPS " + std::to_string(fps_);
+    if (max_kbps_ > 0) request += " MAXRATE " + std::to_string(max_kbps_);
+    if (pull_) request += " MODE pull";
+    if (!drop_.empty()) request += " DROP " + drop_;
+    if (!codec_.empty()) request += " CODEC " + codec_;
+    if (crop_w_ > 0 && crop_h_ > 0) {
+        request += " CROP " + std::to_string(crop_x_) + ":" + std::to_string(crop_y_) + ":" + std::to_string(crop_w_) +
+                   "x" + std::to_string(crop_h_);
+    }
+    // An empty line spares the server its wait for a request
+    request = request.empty() ? "\n" : request.substr(1) + "\n";
+    if (send(fd_, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        error_ = std::string("Stream request failed: ") + strerror(errno);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void VideoReceiver::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+void VideoReceiver::interrupt() {
+    int fd = fd_;
+    if (fd >= 0) shutdown(fd, SHUT_RDWR);
+}
+
+bool VideoReceiver::request_frame() {
+    static const char request[] = "GET\n";
+    if (fd_ < 0) {
+        error_ = "Not connected";
+        return false;
+    }
+    if (send(fd_, request, sizeof(request) - 1, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(request) - 1)) {
+        error_ = std::string("Frame request failed: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool VideoReceiver::receive(EncodedFrame& frame) {
+    if (fd_ < 0) {
+        error_ = "Not connected";
+        return false;
+    }
+
+    uint32_t size_be;
+    if (!recv_exact(fd_, &size_be, sizeof(size_be), bytes_, error_)) return false;
+    frame.first_byte_ns = monotonic_ns();
+    uint32_t size = ntohl(size_be);
+    if (size > MAX_FRAME_BYTES) {
+        error_ = "Invalid frame size " + std::to_string(size);
+        return false;
+    }
+
+    if (frame.data.size() < size) frame.data.resize(size);
+    if (!recv_exact(fd_, frame.data.data(), size, bytes_, error_)) return false;
+    frame.size = size;
+    frame.seq = ++seq_;
+    frame.last_byte_ns = monotonic_ns();
+    return true;
+}
+
+JpegDecoder::JpegDecoder() : handle_(tjInitDecompress()), failed_codec_(nullptr) {}
+
+JpegDecoder::~JpegDecoder() {
+    if (handle_) tjDestroy(static_cast<tjhandle>(handle_));
+}
+
+const char* JpegDecoder::error() const {
+    return failed_codec_ ? failed_codec_ : tjGetErrorStr();
+}
+
+bool JpegDecoder::peek_size(const uint8_t* jpeg, size_t size, int* width, int* height) {
+    failed_codec_ = nullptr;
+    if (qoi_check(jpeg, size)) {
+        if (!qoi_peek_size(jpeg, size, width, height)) failed_codec_ = "Malformed QOI frame";
+        return !failed_codec_;
+    }
+    if (delta_check(jpeg, size)) {
+        if (!delta_peek_size(jpeg, size, width, height)) failed_codec_ = "Malformed delta frame";
+        return !failed_codec_;
+    }
+    int subsamp, colorspace;
+    return handle_ && tjDecompressHeader3(static_cast<tjhandle>(handle_), jpeg, size, width, height, &subsamp,
+                                          &colorspace) == 0;
+}
+
+bool JpegDecoder::decode_into(const uint8_t* jpeg, size_t size, PixelFormat format, uint8_t* out, size_t stride) {
+    int width, height;
+    if (!peek_size(jpeg, size, &width, &height)) return false;
+    if (qoi_check(jpeg, size)) {
+        if (!qoi_decode(jpeg, size, out, stride, format == PIXEL_BGR)) failed_codec_ = "Malformed QOI frame";
+        return !failed_codec_;
+    }
+    if (delta_check(jpeg, size)) {
+        if (!delta_.decode(jpeg, size, out, stride, format == PIXEL_BGR)) {
+            failed_codec_ = "Malformed delta frame, or a delta without its keyframe";
+        }
+        return !failed_codec_;
+    }
+    return tjDecompress2(static_cast<tjhandle>(handle_), jpeg, size, out, width, static_cast<int>(stride), height,
+                         format == PIXEL_RGB ? TJPF_RGB : TJPF_BGR, TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) == 0;
+}
+
+bool JpegDecoder::decode(const EncodedFrame& in, PixelFormat format, DecodedFrame& out) {
+    int width, height;
+    if (!peek_size(in.data.data(), in.size, &width, &height)) return false;
+
+    size_t stride = static_cast<size_t>(width) * 3;
+    if (out.pixels.size() < stride * height) out.pixels.resize(stride * height);
+    if (!decode_into(in.data.data(), in.size, format, out.pixels.data(), stride)) return false;
+
+    out.width = width;
+    out.height = height;
+    out.stride = stride;
+    out.seq = in.seq;
+    out.first_byte_ns = in.first_byte_ns;
+    out.last_byte_ns = in.last_byte_ns;
+    out.decoded_ns = monotonic_ns();
+    return true;
+}
+
+DecodePool::DecodePool(int threads, PixelFormat format, size_t slots, Callback callback)
+    : format_(format), callback_(callback), slots_(slots < 2 ? 2 : slots), stopping_(false),
+      last_delivered_seq_(0), delivered_(0), dropped_(0) {
+    if (threads < 1) threads = 1;
+    for (int i = 0; i < threads; ++i) threads_.push_back(std::thread(&DecodePool::worker, this));
+}
+
+DecodePool::~DecodePool() {
+    stop();
+}
+
+bool DecodePool::submit(EncodedFrame& frame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Slot* slot = nullptr;
+        for (size_t i = 0; i < slots_.size() && !slot; ++i) {
+            if (slots_[i].state == Slot::FREE) slot = &slots_[i];
+        }
+        if (!slot || stopping_) {
+            ++dropped_;
+            return false;
+        }
+
+        // Swap rather than copy: the caller keeps receiving into the slot's old buffer
+        slot->encoded.data.swap(frame.data);
+        slot->encoded.size = frame.size;
+        slot->encoded.seq = frame.seq;
+        slot->encoded.first_byte_ns = frame.first_byte_ns;
+        slot->encoded.last_byte_ns = frame.last_byte_ns;
+        slot->state = Slot::PENDING;
+    }
+    cond_.notify_one();
+    return true;
+}
+
+void DecodePool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (threads_[i].joinable()) threads_[i].join();
+    }
+    threads_.clear();
+}
+
+void DecodePool::worker() {
+    JpegDecoder decoder;
+    for (;;) {
+        Slot* slot = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;) {
+                // Oldest pending first, so frames finish roughly in order
+                for (size_t i = 0; i < slots_.size(); ++i) {
+                    if (slots_[i].state == Slot::PENDING && (!slot || slots_[i].encoded.seq < slot->encoded.seq)) {
+                        slot = &slots_[i];
+                    }
+                }
+                if (slot || stopping_) break;
+                cond_.wait(lock);
+            }
+            if (!slot) return;
+            slot->state = Slot::DECODING;
+        }
+
+        bool ok = decoder.decode(slot->encoded, format_, slot->decoded);
+        {
+            std::lock_guard<std::mutex> deliver(deliver_mutex_);
+            if (ok && slot->decoded.seq > last_delivered_seq_) {
+                last_delivered_seq_ = slot->decoded.seq;
+                callback_(slot->decoded);
+                ++delivered_;
+            } else {
+                ++dropped_;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot->state = Slot::FREE;
+        }
+    }
+}
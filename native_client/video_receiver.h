@@ -0,0 +1,214 @@
+#ifndef NLX_NATIVE_CLIENT_VIDEO_RECEIVER_H
+#define NLX_NATIVE_CLIENT_VIDEO_RECEIVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "delta_codec.h"
+#include "tcp_socket.h"
+
+// Native receive/decode path for the video stream (4-byte big-endian size,
+// then a JPEG, a lossless QOI image for "CODEC qoi", or a keyframe or delta
+// for "CODEC delta"). Everything here reuses buffers: once the largest frame of a
+// session has been seen, receiving and decoding do not allocate.
+
+// One compressed frame as it came off the socket
+struct EncodedFrame {
+    std::vector<uint8_t> data; // Capacity only grows; `size` bytes are valid
+    size_t size;
+    uint64_t seq;              // Receive order, starting at 1
+    uint64_t first_byte_ns;    // CLOCK_MONOTONIC when the size prefix arrived
+    uint64_t last_byte_ns;     // ... and when the last payload byte arrived
+
+    EncodedFrame() : size(0), seq(0), first_byte_ns(0), last_byte_ns(0) {}
+};
+
+enum PixelFormat {
+    PIXEL_RGB = 0, // What Qt and numpy consumers want
+    PIXEL_BGR = 1, // What OpenCV consumers want
+};
+
+struct DecodedFrame {
+    std::vector<uint8_t> pixels; // Packed, `stride` bytes per row
+    int width;
+    int height;
+    size_t stride;
+    uint64_t seq;
+    uint64_t first_byte_ns;
+    uint64_t last_byte_ns;
+    uint64_t decoded_ns;
+
+    DecodedFrame() : width(0), height(0), stride(0), seq(0), first_byte_ns(0), last_byte_ns(0), decoded_ns(0) {}
+};
+
+class VideoReceiver {
+public:
+    VideoReceiver();
+    ~VideoReceiver();
+
+    // Applies to the next connect()
+    void set_tls(const TlsOptions& tls) { tls_ = tls; }
+    // Camera to request from a multi-camera server; -1 sends no request and
+    // gets the server's camera 0. Applies to the next connect().
+    void set_channel(int channel) { channel_ = channel; }
+    // Resolution and JPEG quality to request; 0 keeps the server's own. The
+    // server only scales down. Applies to the next connect().
+    void set_variant(int width, int height, int quality) {
+        width_ = width;
+        height_ = height;
+        quality_ = quality;
+    }
+    // Frame rate and send-rate cap (kbit/s) to request; 0 for no limit. The
+    // server skips frames to meet both. Applies to the next connect().
+    void set_pacing(int fps, int max_kbps) {
+        fps_ = fps;
+        max_kbps_ = max_kbps;
+    }
+    // Pull mode: the server sends a frame only for each request_frame().
+    // Applies to the next connect().
+    void set_pull(bool pull) { pull_ = pull; }
+    // What the server does when this receiver falls behind: "latest" skips
+    // to the newest frame, "queue" sends every frame its history holds,
+    // "close" disconnects; empty leaves the server's default ("latest").
+    // Applies to the next connect().
+    void set_drop(const std::string& policy) { drop_ = policy; }
+    // "qoi" asks for lossless frames (larger, no compression artifacts),
+    // "delta" for exact raw frames sent as keyframes and differences (small
+    // for static scenes; decode them in order with one JpegDecoder, not
+    // through a DecodePool, which may drop or reorder frames); empty or
+    // "jpeg" for JPEG. Applies to the next connect().
+    void set_codec(const std::string& codec) { codec_ = codec; }
+    // Asks for one frame instead of a stream: this region of the camera's
+    // last snapshot, cut out losslessly. The server moves the corner to a
+    // multiple of 8 or 16 pixels; the decoded frame has the actual size.
+    // A width of 0 streams as usual. Applies to the next connect().
+    void set_crop(int x, int y, int width, int height) {
+        crop_x_ = x;
+        crop_y_ = y;
+        crop_w_ = width;
+        crop_h_ = height;
+    }
+
+    bool connect(const std::string& host, int port, int timeout_ms);
+    void close();
+    bool connected() const { return fd_ >= 0; }
+
+    // Blocks for the next complete frame. Returns false on disconnect, error
+    // or after interrupt(); error() says which. A frame with size 0 is the
+    // server's "source lost" marker, sent while its camera recovers.
+    bool receive(EncodedFrame& frame);
+
+    // Pull mode: asks for the server's newest frame, which the next
+    // receive() returns; a size 0 answer means none was ready in time
+    bool request_frame();
+
+    // Makes a blocked receive() return false; safe from any thread
+    void interrupt();
+
+    const std::string& error() const { return error_; }
+    uint64_t bytes_received() const { return bytes_; }
+
+private:
+    VideoReceiver(const VideoReceiver&);
+    VideoReceiver& operator=(const VideoReceiver&);
+
+    int fd_;
+    TlsOptions tls_;
+    int channel_;
+    int width_;
+    int height_;
+    int quality_;
+    int fps_;
+    int max_kbps_;
+    bool pull_;
+    std::string drop_;
+    std::string codec_;
+    int crop_x_;
+    int crop_y_;
+    int crop_w_;
+    int crop_h_;
+    uint64_t seq_;
+    uint64_t bytes_;
+    std::string error_;
+};
+
+// TurboJPEG decompressor with a persistent handle. Lossless QOI frames and
+// delta-stream frames are recognised by their magic and decoded by
+// qoi_codec and delta_codec instead, so every consumer of this class takes
+// any codec. A delta stream's keyframe is kept here, which is why its
+// frames must all go through the same decoder.
+class JpegDecoder {
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    // Decodes into `out`, growing its pixel buffer only on resolution increase
+    bool decode(const EncodedFrame& in, PixelFormat format, DecodedFrame& out);
+
+    // Decodes into caller memory of at least width*height*3 bytes (after
+    // reading the header with peek_size)
+    bool decode_into(const uint8_t* jpeg, size_t size, PixelFormat format, uint8_t* out, size_t stride);
+    bool peek_size(const uint8_t* jpeg, size_t size, int* width, int* height);
+
+    const char* error() const;
+
+private:
+    JpegDecoder(const JpegDecoder&);
+    JpegDecoder& operator=(const JpegDecoder&);
+
+    void* handle_;
+    DeltaDecoder delta_;
+    const char* failed_codec_; // Set when the last failure was not TurboJPEG's
+};
+
+// Optional decode workers. Received frames are handed over by swapping
+// buffers with a free slot, decoded on one of N threads (each with its own
+// JpegDecoder), and delivered newest-first: a frame that finishes after a
+// newer one was delivered is dropped, which is what a live viewer wants.
+class DecodePool {
+public:
+    typedef std::function<void(const DecodedFrame&)> Callback;
+
+    DecodePool(int threads, PixelFormat format, size_t slots, Callback callback);
+    ~DecodePool();
+
+    // Takes the frame's buffer (leaving `frame` with a recycled one).
+    // Returns false and drops the frame if every slot is busy.
+    bool submit(EncodedFrame& frame);
+
+    void stop();
+
+    uint64_t delivered() const { return delivered_; }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    struct Slot {
+        enum State { FREE, PENDING, DECODING } state;
+        EncodedFrame encoded;
+        DecodedFrame decoded;
+        Slot() : state(FREE) {}
+    };
+
+    void worker();
+
+    PixelFormat format_;
+    Callback callback_;
+    std::vector<Slot> slots_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::mutex deliver_mutex_;
+    bool stopping_;
+    uint64_t last_delivered_seq_;
+    std::atomic<uint64_t> delivered_;
+    std::atomic<uint64_t> dropped_;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "area_scaler.h"
+
+#include <algorithm>
+
+// Taps of `n` output pixels over `source_n` source pixels. In units of
+// 1/n source pixel, output i spans [i * source_n, (i + 1) * source_n) and
+// source j spans [j * n, (j + 1) * n); a tap's weight is the overlap over
+// source_n. Rounding is put right on each pixel's largest tap, so the
+// weights sum to exactly 65536 and a flat area stays flat.
+static void area_taps(int source_n, int n, std::vector<int>& first, std::vector<AreaScaler::Tap>& taps) {
+    first.resize(n + 1);
+    taps.clear();
+    for (int i = 0; i < n; ++i) {
+        first[i] = static_cast<int>(taps.size());
+        int64_t start = static_cast<int64_t>(i) * source_n, end = start + source_n;
+        uint32_t total = 0;
+        size_t largest = taps.size();
+        for (int j = static_cast<int>(start / n); j < source_n && static_cast<int64_t>(j) * n < end; ++j) {
+            int64_t overlap =
+                std::min(end, static_cast<int64_t>(j + 1) * n) - std::max(start, static_cast<int64_t>(j) * n);
+            AreaScaler::Tap tap;
+            tap.source = j;
+            tap.weight = static_cast<uint32_t>((overlap * 65536 + source_n / 2) / source_n);
+            if (tap.weight == 0) continue;
+            if (taps.size() == largest || tap.weight > taps[largest].weight) largest = taps.size();
+            total += tap.weight;
+            taps.push_back(tap);
+        }
+        taps[largest].weight += 65536 - total;
+    }
+    first[n] = static_cast<int>(taps.size());
+}
+
+// Samples are summed down a column in fixed runs of LANES with 16-bit high
+// multiplies, which the compiler vectorises at -O2
+static const size_t LANES = 16;
+
+// `sample` times `weight` (1/65536), in 1/256
+static inline uint16_t weigh(uint8_t sample, uint16_t weight) {
+    return static_cast<uint16_t>((static_cast<uint32_t>(static_cast<uint16_t>(sample << 8)) * weight) >> 16);
+}
+
+static void weigh_row(const uint8_t* __restrict src, uint16_t weight, size_t n, uint16_t* __restrict out) {
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t k = i; k < i + LANES; ++k) out[k] = weigh(src[k], weight);
+    }
+    for (; i < n; ++i) out[i] = weigh(src[i], weight);
+}
+
+static void add_weighed_row(const uint8_t* __restrict src, uint16_t weight, size_t n, uint16_t* __restrict out) {
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t k = i; k < i + LANES; ++k) out[k] = static_cast<uint16_t>(out[k] + weigh(src[k], weight));
+    }
+    for (; i < n; ++i) out[i] = static_cast<uint16_t>(out[i] + weigh(src[i], weight));
+}
+
+AreaScaler::AreaScaler() : src_width_(0), src_height_(0), width_(0), height_(0) {}
+
+void AreaScaler::scale(const uint8_t* src, int src_width, int src_height, size_t src_stride, uint8_t* dst, int width,
+                       int height, size_t dst_stride) {
+    if (src_width != src_width_ || src_height != src_height_ || width != width_ || height != height_) {
+        area_taps(src_width, width, x_first_, x_taps_);
+        area_taps(src_height, height, y_first_, y_taps_);
+        column_.resize(static_cast<size_t>(src_width) * 3);
+        src_width_ = src_width;
+        src_height_ = src_height;
+        width_ = width;
+        height_ = height;
+    }
+
+    // Separable, down the columns first: that pass covers every source row
+    // but on contiguous bytes, and the gathering pass across then runs once
+    // per output row. A weight of a whole 65536 is taken as 65535, and the
+    // column sums truncate; both stay well under one output level.
+    size_t src_bytes = static_cast<size_t>(src_width) * 3;
+    for (int y = 0; y < height; ++y) {
+        for (int t = y_first_[y]; t < y_first_[y + 1]; ++t) {
+            const Tap& ty = y_taps_[t];
+            const uint8_t* row = src + ty.source * src_stride;
+            uint16_t weight = static_cast<uint16_t>(std::min<uint32_t>(ty.weight, 0xffff));
+            if (t == y_first_[y]) weigh_row(row, weight, src_bytes, &column_[0]);
+            else add_weighed_row(row, weight, src_bytes, &column_[0]);
+        }
+
+        // At most 65280 * 65536 plus rounding, inside 32 bits
+        uint8_t* out = dst + y * dst_stride;
+        for (int x = 0; x < width; ++x) {
+            // A pixel's taps are consecutive source pixels
+            const Tap* tap = &x_taps_[x_first_[x]];
+            const Tap* end = &x_taps_[0] + x_first_[x + 1];
+            const uint16_t* p = &column_[tap->source * 3];
+            uint32_t sum[3] = {1u << 23, 1u << 23, 1u << 23};
+            for (; tap != end; ++tap, p += 3) {
+                sum[0] += p[0] * tap->weight;
+                sum[1] += p[1] * tap->weight;
+                sum[2] += p[2] * tap->weight;
+            }
+            for (int c = 0; c < 3; ++c) out[x * 3 + c] = static_cast<uint8_t>(sum[c] >> 24);
+        }
+    }
+}
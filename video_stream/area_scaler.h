@@ -0,0 +1,43 @@
+#ifndef NLX_VIDEO_AREA_SCALER_H
+#define NLX_VIDEO_AREA_SCALER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Area-averaging resize of packed BGR images, as cv::resize does with
+// INTER_AREA when scaling down: each output pixel is the mean of the source
+// area it covers, edge pixels weighted by how much of them it covers. The
+// weight tables and row buffers are kept, so only a change of either size
+// allocates (cv::resize allocates its tables and buffers on every call).
+class AreaScaler {
+public:
+    AreaScaler();
+
+    // Scales `src` (`src_stride` bytes per row) into `dst`, which the caller
+    // owns and sizes for `height` rows of `dst_stride` bytes
+    void scale(const uint8_t* src, int src_width, int src_height, size_t src_stride, uint8_t* dst, int width,
+               int height, size_t dst_stride);
+
+    // Source pixel and its share of one output pixel, in 1/65536
+    struct Tap {
+        int source;
+        uint32_t weight;
+    };
+
+private:
+    AreaScaler(const AreaScaler&);
+    AreaScaler& operator=(const AreaScaler&);
+
+    int src_width_;
+    int src_height_;
+    int width_;
+    int height_;
+    std::vector<int> x_first_; // Per output column (and one past), its first tap
+    std::vector<int> y_first_;
+    std::vector<Tap> x_taps_;
+    std::vector<Tap> y_taps_;
+    std::vector<uint16_t> column_; // Source rows of one output row summed, in 1/256
+};
+
+#endif
@@ -0,0 +1,584 @@
+#include "capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "alloc_check.h"
+#include "clock.h"
+#include "jpeg_encoder.h"
+#include "log.h"
+#include "qoi_codec.h"
+#include "rt_profile.h"
+
+void FrameChannel::publish(const FrameRef& raw, const FrameRef& jpeg) {
+    uint64_t gap_ms = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (jpeg->seq <= seq_) return;
+        raw_ = raw;
+        jpeg_ = jpeg;
+        seq_ = jpeg->seq;
+        jpeg_published_ = ++published_;
+        if (!history_.empty()) {
+            history_[history_next_] = jpeg;
+            history_published_[history_next_] = published_;
+            history_next_ = (history_next_ + 1) % history_.size();
+        }
+        uint64_t now = monotonic_ns();
+        if (lost_) {
+            gap_ms = (now - last_publish_ns_) / 1000000;
+            ++recovery_.count;
+            recovery_.last_ms = gap_ms;
+            recovery_.total_ms += gap_ms;
+            if (gap_ms > recovery_.max_ms) recovery_.max_ms = gap_ms;
+            lost_ = false;
+        }
+        last_publish_ns_ = now;
+    }
+    cond_.notify_all();
+    if (gap_ms) LOG_INFO("Video source recovered after %llu ms", static_cast<unsigned long long>(gap_ms));
+}
+
+FrameRef FrameChannel::wait_jpeg(uint64_t after, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return seq_ > after; });
+    if (seq_ <= after || !jpeg_) return FrameRef();
+    return jpeg_;
+}
+
+void FrameChannel::set_history(size_t frames) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    history_.assign(frames, FrameRef());
+    history_published_.assign(frames, 0);
+    history_next_ = 0;
+}
+
+FrameRef FrameChannel::next_jpeg(uint64_t after, int timeout_ms, uint64_t* published) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return seq_ > after; });
+    if (seq_ <= after || !jpeg_) return FrameRef();
+    const FrameRef* oldest = &jpeg_;
+    *published = jpeg_published_;
+    for (size_t i = 0; i < history_.size(); ++i) {
+        const FrameRef& frame = history_[i];
+        if (frame && frame->seq > after && frame->seq < (*oldest)->seq) {
+            oldest = &frame;
+            *published = history_published_[i];
+        }
+    }
+    return *oldest;
+}
+
+FrameRef FrameChannel::wait_raw(uint64_t after, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return seq_ > after; });
+    if (seq_ <= after || !raw_) return FrameRef();
+    return raw_;
+}
+
+FrameRef FrameChannel::latest_raw() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return raw_;
+}
+
+FrameRef FrameChannel::latest_jpeg() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jpeg_;
+}
+
+void FrameChannel::keep_snapshot(const FrameRef& jpeg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot_ = jpeg;
+}
+
+FrameRef FrameChannel::latest_snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return snapshot_;
+}
+
+FrameChannel::Variant* FrameChannel::find_variant(const VariantKey& key) {
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        if (variants_[i].key == key) return &variants_[i];
+    }
+    return nullptr;
+}
+
+bool FrameChannel::subscribe(const VariantKey& key, size_t max_variants) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Variant* variant = find_variant(key);
+    if (variant) {
+        ++variant->subscribers;
+        return true;
+    }
+    if (variants_.size() >= max_variants) return false;
+    Variant added;
+    added.key = key;
+    added.subscribers = 1;
+    added.seq = 0;
+    added.encoding_seq = 0;
+    variants_.push_back(added);
+    return true;
+}
+
+void FrameChannel::unsubscribe(const VariantKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < variants_.size(); ++i) {
+        if (variants_[i].key == key && --variants_[i].subscribers == 0) {
+            variants_.erase(variants_.begin() + i);
+            break;
+        }
+    }
+}
+
+FrameRef FrameChannel::wait_variant(const VariantKey& key, uint64_t after, int timeout_ms, VariantEncoder& encoder) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return seq_ > after; });
+    if (seq_ <= after || !raw_) return FrameRef();
+    uint64_t seq = raw_->seq;
+
+    // Another subscriber is encoding this frame: share its result. The
+    // variant is looked up again after every wait since subscribe() may
+    // have moved it.
+    Variant* variant = find_variant(key);
+    while (variant && variant->encoding_seq == seq) {
+        cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms));
+        variant = find_variant(key);
+    }
+    if (!variant) return FrameRef();
+    if (variant->seq >= seq) return variant->frame;
+
+    variant->encoding_seq = seq;
+    FrameRef raw = raw_;
+    lock.unlock();
+    FrameRef encoded = encoder.encode(*raw, key);
+    lock.lock();
+
+    variant = find_variant(key);
+    if (variant) {
+        variant->encoding_seq = 0;
+        if (encoded && encoded->seq > variant->seq) {
+            variant->frame = encoded;
+            variant->seq = encoded->seq;
+        }
+    }
+    lock.unlock();
+    cond_.notify_all();
+    return encoded;
+}
+
+FrameRef FrameChannel::latest_variant(const VariantKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Variant* variant = find_variant(key);
+    return variant ? variant->frame : FrameRef();
+}
+
+FrameRef VariantEncoder::encode(const FrameBuffer& raw, const VariantKey& key) {
+    if (raw.format != FRAME_BGR) return FrameRef();
+    const uint8_t* pixels = raw.data();
+    int width = raw.width, height = raw.height;
+    size_t stride = raw.stride;
+    if (key.width > 0 && (key.width != raw.width || key.height != raw.height)) {
+        scaled_.create(key.height, key.width, CV_8UC3);
+        scaler_.scale(raw.data(), raw.width, raw.height, raw.stride, scaled_.data, scaled_.cols, scaled_.rows,
+                      scaled_.step);
+        pixels = scaled_.data;
+        width = scaled_.cols;
+        height = scaled_.rows;
+        stride = scaled_.step;
+    }
+
+    FrameRef out = jpeg_pool_.acquire(pool_wait_ms_);
+    if (!out) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "JPEG frame pool exhausted, dropping variant frame");
+        return FrameRef();
+    }
+    bool qoi = key.codec == CODEC_QOI;
+    size_t size = qoi ? qoi_encode(pixels, width, height, stride, out->data(), out->capacity())
+                      : jpeg_.encode_into(pixels, width, height, stride, key.quality, out->data(), out->capacity());
+    if (size == 0) {
+        if (qoi) LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to encode %dx%d lossless variant", width, height);
+        else LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to encode %dx%d q%d variant", width, height, key.quality);
+        return FrameRef();
+    }
+    out->format = qoi ? FRAME_QOI : FRAME_JPEG;
+    out->size = size;
+    out->width = width;
+    out->height = height;
+    out->stride = 0;
+    out->seq = raw.seq;
+    out->pts_ns = raw.pts_ns;
+    return out;
+}
+
+void FrameChannel::add_consumer(int fps) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fps > 0) limited_fps_.push_back(fps);
+    ++consumers_;
+    update_demand();
+}
+
+void FrameChannel::remove_consumer(int fps) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fps > 0) {
+        std::vector<int>::iterator it = std::find(limited_fps_.begin(), limited_fps_.end(), fps);
+        if (it != limited_fps_.end()) limited_fps_.erase(it);
+    }
+    --consumers_;
+    update_demand();
+}
+
+void FrameChannel::update_demand() {
+    bool full_rate = consumers_ > static_cast<int>(limited_fps_.size());
+    demand_fps_ = full_rate || limited_fps_.empty() ? 0 : *std::max_element(limited_fps_.begin(), limited_fps_.end());
+}
+
+void FrameChannel::mark_lost() {
+    if (!lost_.exchange(true)) LOG_ERROR("Video source lost, clients are kept while it recovers");
+}
+
+void FrameChannel::check_stall(int stall_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (lost_ || !has_consumers() || last_publish_ns_ == 0) return;
+    if (monotonic_ns() - last_publish_ns_ >= stall_ms * 1000000ull) {
+        lost_ = true;
+        LOG_ERROR("No video frame for %d ms, source lost", stall_ms);
+    }
+}
+
+void FrameChannel::arm_watchdog() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_publish_ns_ = monotonic_ns();
+    lost_ = false;
+}
+
+RecoveryStats FrameChannel::recovery_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return recovery_;
+}
+
+void FrameChannel::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    raw_.reset();
+    jpeg_.reset();
+    for (size_t i = 0; i < history_.size(); ++i) history_[i].reset();
+    for (size_t i = 0; i < variants_.size(); ++i) variants_[i].frame.reset();
+}
+
+// Reads one frame straight into pooled memory. Backends that decode into the
+// Mat we pass write in place; others hand back their own buffer, which is
+// copied in once.
+static bool read_into(FrameSource& source, FrameBuffer& raw, int width, int height) {
+    cv::Mat view;
+    size_t stride = static_cast<size_t>(width) * 3;
+    if (stride * height <= raw.capacity()) view = cv::Mat(height, width, CV_8UC3, raw.data(), stride);
+    if (!source.read(view) || view.empty()) return false;
+
+    if (view.data != raw.data()) {
+        stride = static_cast<size_t>(view.cols) * 3;
+        if (view.type() != CV_8UC3 || stride * view.rows > raw.capacity()) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Captured frame %dx%d does not fit pool buffer", view.cols,
+                         view.rows);
+            return false;
+        }
+        cv::Mat dst(view.rows, view.cols, CV_8UC3, raw.data(), stride);
+        view.copyTo(dst);
+    }
+
+    raw.format = FRAME_BGR;
+    raw.width = view.cols;
+    raw.height = view.rows;
+    raw.stride = stride;
+    raw.size = stride * view.rows;
+    return true;
+}
+
+bool open_capture(FrameSource& source, const CaptureConfig& config) {
+    if (!source.open(config.device)) return false;
+    source.set(cv::CAP_PROP_FRAME_WIDTH, config.width);
+    source.set(cv::CAP_PROP_FRAME_HEIGHT, config.height);
+    source.set(cv::CAP_PROP_FPS, config.fps);
+    source.set(cv::CAP_PROP_BUFFERSIZE, 1);
+    return true;
+}
+
+// Releases the device and reopens it with backoff while consumers wait;
+// their sessions stay open meanwhile
+static bool reopen_source(FrameSource& source, FrameChannel& channel, const CaptureConfig& config,
+                          const std::atomic<bool>& running) {
+    channel.mark_lost();
+    source.release();
+    int backoff_ms = 100;
+    while (running && channel.has_consumers()) {
+        if (open_capture(source, config)) {
+            LOG_INFO("Video device %s reopened", config.device.c_str());
+            return true;
+        }
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Reopening %s failed, retrying", config.device.c_str());
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+        backoff_ms = std::min(backoff_ms * 2, 2000);
+    }
+    return false;
+}
+
+static long long elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+EncodeQueue::EncodeQueue(FramePool& jpeg_pool, size_t capacity, int pool_wait_ms)
+    : jpeg_pool_(jpeg_pool), pool_wait_ms_(pool_wait_ms), ring_(std::max<size_t>(capacity, 1)), head_(0),
+      count_(0), stopping_(false), dropped_(0) {}
+
+EncodeQueue::~EncodeQueue() {
+    stop();
+}
+
+void EncodeQueue::start(int workers) {
+    stopping_ = false;
+    size_t n = static_cast<size_t>(std::max(workers, 1));
+    InFlight idle = {nullptr, 0, FrameRef(), FrameRef(), false, false};
+    in_flight_.assign(n, idle);
+    for (size_t i = 0; i < n; ++i) threads_.push_back(std::thread(&EncodeQueue::worker, this, i));
+}
+
+void EncodeQueue::publish_in_order(FrameChannel* channel) {
+    while (true) {
+        InFlight* oldest = nullptr;
+        for (size_t i = 0; i < in_flight_.size(); ++i) {
+            InFlight& job = in_flight_[i];
+            if (job.channel == channel && (!oldest || job.seq < oldest->seq)) oldest = &job;
+        }
+        if (!oldest || !oldest->done) return;
+        if (oldest->jpeg) {
+            if (oldest->snapshot) channel->keep_snapshot(oldest->jpeg);
+            channel->publish(oldest->raw, oldest->jpeg);
+        }
+        oldest->channel = nullptr;
+        oldest->raw.reset();
+        oldest->jpeg.reset();
+    }
+}
+
+void EncodeQueue::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i) threads_[i].join();
+    threads_.clear();
+}
+
+bool EncodeQueue::submit(const FrameRef& raw, FrameChannel& channel, int quality, RoiMap* roi, bool snapshot) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_ == ring_.size()) {
+            ++dropped_;
+            return false;
+        }
+        Job& job = ring_[(head_ + count_) % ring_.size()];
+        job.raw = raw;
+        job.channel = &channel;
+        job.quality = quality;
+        job.roi = roi;
+        job.snapshot = snapshot;
+        ++count_;
+    }
+    cond_.notify_one();
+    return true;
+}
+
+void EncodeQueue::worker(size_t index) {
+    rt_profile_apply("encode");
+    JpegEncoder encoder;
+    RoiCoarsener coarsener;
+    AllocCheck alloc_check("video encode", 30, 300);
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return count_ > 0 || stopping_; });
+            if (count_ == 0) return;
+            Job& slot = ring_[head_];
+            job.raw = std::move(slot.raw);
+            job.channel = slot.channel;
+            job.quality = slot.quality;
+            job.roi = slot.roi;
+            job.snapshot = slot.snapshot;
+            head_ = (head_ + 1) % ring_.size();
+            --count_;
+            InFlight& mine = in_flight_[index];
+            mine.channel = job.channel;
+            mine.seq = job.raw->seq;
+            mine.done = false;
+        }
+
+        FrameRef jpeg = jpeg_pool_.acquire(pool_wait_ms_);
+        const FrameBuffer& raw = *job.raw;
+        if (!jpeg) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "JPEG frame pool exhausted, dropping frame");
+        } else {
+            // The raw frame is shared with variants and other consumers, so
+            // the coarsened background goes into this worker's scratch copy
+            size_t stride = raw.stride;
+            const uint8_t* pixels = job.roi ? coarsener.apply(raw, *job.roi, stride) : raw.data();
+            size_t size = encoder.encode_into(pixels, raw.width, raw.height, stride, job.quality, jpeg->data(),
+                                              jpeg->capacity());
+            if (size == 0) {
+                LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to encode frame");
+                jpeg.reset();
+            } else {
+                jpeg->format = FRAME_JPEG;
+                jpeg->size = size;
+                jpeg->width = raw.width;
+                jpeg->height = raw.height;
+                jpeg->stride = 0;
+                jpeg->seq = raw.seq;
+                jpeg->pts_ns = raw.pts_ns;
+            }
+        }
+
+        // A failed frame is still marked done, so the frames after it go out
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            InFlight& mine = in_flight_[index];
+            mine.raw = std::move(job.raw);
+            mine.jpeg = std::move(jpeg);
+            mine.snapshot = job.snapshot;
+            mine.done = true;
+            publish_in_order(job.channel);
+        }
+        alloc_check.iteration();
+    }
+}
+
+void capture_loop(FrameSource& source, FramePool& raw_pool, EncodeQueue& encoder, FrameChannel& channel,
+                  std::atomic<bool>& snapshot_signal, const CaptureConfig& config,
+                  const std::atomic<bool>& running) {
+    rt_profile_apply("capture");
+    AllocCheck alloc_check("video capture", 30, 300);
+    uint64_t seq = 0;
+    bool active = false;
+    bool warm = false;                 // Reading at idle_fps
+    uint64_t idle_since_ns = monotonic_ns();
+    uint64_t wake_ns = 0;              // When the current consumer arrived; 0 once its first frame is out
+    int failures = 0;                  // Consecutive failed reads
+    uint64_t next_encode_ns = 0;       // Next frame due while every consumer is rate-limited
+    const uint64_t half_frame_ns = 500000000ull / std::max(config.fps, 1);
+
+    while (running) {
+        if (!channel.has_consumers()) {
+            if (active) {
+                active = false;
+                idle_since_ns = monotonic_ns();
+                LOG_INFO("No consumers, capture %s", config.idle_fps > 0 ? "idling" : "paused");
+            }
+            if (source.is_open() && config.idle_timeout_ms > 0 &&
+                monotonic_ns() - idle_since_ns >= config.idle_timeout_ms * 1000000ull) {
+                source.release();
+                warm = false;
+                LOG_INFO("Idle for %d s, video device released", config.idle_timeout_ms / 1000);
+            }
+            if (source.is_open() && config.idle_fps > 0) {
+                if (!warm) {
+                    source.set(cv::CAP_PROP_FPS, config.idle_fps);
+                    warm = true;
+                }
+                // Pace by sleeping too: not every driver honours the lower rate
+                source.grab();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1000 / config.idle_fps));
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+            continue;
+        }
+
+        if (!active) {
+            active = true;
+            wake_ns = monotonic_ns();
+            if (!source.is_open()) {
+                if (!open_capture(source, config)) {
+                    LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Failed to reopen video device: %s", config.device.c_str());
+                    active = false;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                    continue;
+                }
+                LOG_INFO("Video device reopened");
+            } else if (warm) {
+                source.set(cv::CAP_PROP_FPS, config.fps);
+            }
+            warm = false;
+            channel.arm_watchdog();
+        }
+
+        FrameRef raw = raw_pool.acquire(config.pool_wait_ms);
+        if (!raw) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Raw frame pool exhausted, dropping frame");
+            continue;
+        }
+
+        bool ok;
+        bool snapshot = snapshot_signal.exchange(false);
+        if (snapshot) {
+            // Measure time for setting snapshot resolution
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            source.set(cv::CAP_PROP_FRAME_WIDTH, config.snapw);
+            source.set(cv::CAP_PROP_FRAME_HEIGHT, config.snaph);
+            LOG_INFO("cap.set (snapshot resolution) time: %lld us", elapsed_us(start));
+
+            start = std::chrono::steady_clock::now();
+            ok = read_into(source, *raw, config.snapw, config.snaph);
+            if (ok) LOG_INFO("cap.read (snapshot) time: %lld us", elapsed_us(start));
+            else LOG_ERROR("Failed to capture snapshot");
+
+            // Measure time for reverting to default resolution
+            start = std::chrono::steady_clock::now();
+            source.set(cv::CAP_PROP_FRAME_WIDTH, config.width);
+            source.set(cv::CAP_PROP_FRAME_HEIGHT, config.height);
+            LOG_INFO("cap.set (revert resolution) time: %lld us", elapsed_us(start));
+        } else {
+            ok = read_into(source, *raw, config.width, config.height);
+            if (!ok) LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to capture frame");
+        }
+        if (!ok) {
+            raw.reset();
+            if (++failures >= config.reopen_after || channel.source_lost()) {
+                reopen_source(source, channel, config, running);
+                failures = 0;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            continue;
+        }
+        failures = 0;
+        raw->seq = ++seq;
+        raw->pts_ns = monotonic_ns();
+
+        // Decimate before encoding: the device keeps its rate (slowing it
+        // down would cost the next full-rate consumer a reconfigure), but
+        // only the frames the fastest consumer wants get encoded. Half a
+        // frame of slack keeps e.g. 30 -> 5 fps on every sixth frame.
+        int demand = channel.demand_fps();
+        if (demand > 0 && demand < config.fps && !snapshot) {
+            if (raw->pts_ns + half_frame_ns < next_encode_ns) continue;
+            uint64_t period_ns = 1000000000ull / demand;
+            next_encode_ns = raw->pts_ns > next_encode_ns + period_ns ? raw->pts_ns + period_ns
+                                                                      : next_encode_ns + period_ns;
+        } else {
+            next_encode_ns = 0;
+        }
+
+        // A snapshot is for close inspection: no region coarsening
+        if (!encoder.submit(raw, channel, config.quality, snapshot ? nullptr : config.roi.get(), snapshot)) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Encoder queue full, dropping frame from %s", config.device.c_str());
+            continue;
+        }
+        if (wake_ns) {
+            LOG_INFO("First frame from %s %.1f ms after a consumer arrived", config.device.c_str(),
+                     (monotonic_ns() - wake_ns) / 1e6);
+            wake_ns = 0;
+        }
+        alloc_check.iteration();
+    }
+}
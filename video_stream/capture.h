@@ -0,0 +1,313 @@
+#ifndef NLX_VIDEO_CAPTURE_H
+#define NLX_VIDEO_CAPTURE_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "area_scaler.h"
+#include "frame_pool.h"
+#include "jpeg_encoder.h"
+#include "roi.h"
+#include "synthetic_video.h"
+
+struct CaptureConfig {
+    int width;
+    int height;
+    int fps;
+    int snapw;        // Resolution used for one frame after a snapshot signal
+    int snaph;
+    int quality;      // JPEG quality
+    int pool_wait_ms; // How long to wait for a free pool buffer before dropping a frame
+    int idle_fps;     // Warm-standby rate while nobody watches; 0 stops reading
+    int idle_timeout_ms; // Release the device after this long without consumers; 0 keeps it open
+    int reopen_after;    // Consecutive failed reads before the device is reopened
+    std::string device;
+    std::shared_ptr<RoiMap> roi; // Regions kept sharp in the stream, background coarsened; null for none
+};
+
+// Source outages seen by consumers: from the last frame before a loss to the
+// first frame after the device came back
+struct RecoveryStats {
+    uint64_t count;
+    uint64_t last_ms;
+    uint64_t max_ms;
+    uint64_t total_ms;
+};
+
+// V4L2 camera, or the generated test pattern when the device is "synthetic"
+class FrameSource {
+public:
+    FrameSource() : synthetic_(false), open_(false) {}
+
+    bool open(const std::string& device) {
+        synthetic_ = device == "synthetic";
+        open_ = synthetic_ || cap_.open(device, cv::CAP_V4L2);
+        return open_;
+    }
+
+    bool is_open() const { return open_; }
+
+    bool set(int prop, double value) {
+        if (!synthetic_) return cap_.set(prop, value);
+        if (prop == cv::CAP_PROP_FRAME_WIDTH) pattern_.set_size(static_cast<int>(value), 0);
+        else if (prop == cv::CAP_PROP_FRAME_HEIGHT) pattern_.set_size(0, static_cast<int>(value));
+        else if (prop == cv::CAP_PROP_FPS) pattern_.set_fps(static_cast<int>(value));
+        return true;
+    }
+
+    bool read(cv::Mat& frame) {
+        return synthetic_ ? pattern_.read(frame) : cap_.read(frame);
+    }
+
+    // Dequeues a frame without decoding it; keeps the sensor's auto-exposure
+    // running while idle
+    bool grab() {
+        return synthetic_ ? pattern_.read(scratch_) : cap_.grab();
+    }
+
+    void release() {
+        if (!synthetic_) cap_.release();
+        open_ = false;
+    }
+
+private:
+    bool synthetic_;
+    bool open_;
+    cv::Mat scratch_;
+    cv::VideoCapture cap_;
+    SyntheticVideo pattern_;
+};
+
+enum VideoCodec {
+    CODEC_JPEG = 0,
+    CODEC_QOI,   // Lossless; the quality is ignored
+    CODEC_DELTA, // Exact raw frames as LZ4 keyframes and deltas, encoded per viewer
+};
+
+// What a subscriber wants from a camera besides the stream the encoders
+// produce anyway. Width and height 0 keep the captured resolution.
+struct VariantKey {
+    int width;
+    int height;
+    int quality;
+    VideoCodec codec;
+
+    bool operator==(const VariantKey& other) const {
+        return width == other.width && height == other.height && quality == other.quality && codec == other.codec;
+    }
+};
+
+// Scales and encodes raw frames for variants, as JPEG or lossless QOI; one
+// per consumer thread, so the scratch image and encoder state are reused
+// without locking
+class VariantEncoder {
+public:
+    VariantEncoder(FramePool& jpeg_pool, int pool_wait_ms) : jpeg_pool_(jpeg_pool), pool_wait_ms_(pool_wait_ms) {}
+
+    // Returns an empty ref if the pool is exhausted or encoding failed
+    FrameRef encode(const FrameBuffer& raw, const VariantKey& key);
+
+private:
+    VariantEncoder(const VariantEncoder&);
+    VariantEncoder& operator=(const VariantEncoder&);
+
+    FramePool& jpeg_pool_;
+    int pool_wait_ms_;
+    JpegEncoder jpeg_;
+    AreaScaler scaler_;
+    cv::Mat scaled_; // Reallocated only when a variant's size changes
+};
+
+// Newest raw and encoded frame, published by the capture thread. Consumers
+// (client senders, the recorder) hold references to pooled buffers, so a
+// slow consumer never blocks capture or the others.
+class FrameChannel {
+public:
+    FrameChannel()
+        : history_next_(0), seq_(0), published_(0), jpeg_published_(0), consumers_(0), demand_fps_(0),
+          last_publish_ns_(0), lost_(false), recovery_() {}
+
+    // Also ends a source outage, recording how long it lasted. A frame older
+    // than the one already published is dropped; EncodeQueue publishes each
+    // camera's frames in capture order, so none of its frames are.
+    void publish(const FrameRef& raw, const FrameRef& jpeg);
+
+    // Waits up to timeout_ms for an encoded frame newer than `after`;
+    // returns an empty ref on timeout
+    FrameRef wait_jpeg(uint64_t after, int timeout_ms);
+
+    // Waits up to timeout_ms for a raw frame newer than `after`; empty on
+    // timeout or for a source without raw frames (relays, workers)
+    FrameRef wait_raw(uint64_t after, int timeout_ms);
+    FrameRef latest_raw();
+    FrameRef latest_jpeg();
+
+    // The last snapshot (--snapw x --snaph) is kept apart from the stream,
+    // across pauses, for crop requests
+    void keep_snapshot(const FrameRef& jpeg);
+    FrameRef latest_snapshot();
+
+    // Keeps the last `frames` encoded frames (call before publishing), so a
+    // consumer that takes every frame in order (next_jpeg) rides out a
+    // short stall without a gap. Each costs a pooled JPEG buffer.
+    void set_history(size_t frames);
+    // Oldest retained frame newer than `after`, waiting up to timeout_ms;
+    // without history the same as wait_jpeg. `published` is set to the
+    // frame's position in the publish order: a gap there, unlike one in
+    // seq (frames dropped before encoding or publishing), means frames
+    // left the history before the consumer took them.
+    FrameRef next_jpeg(uint64_t after, int timeout_ms, uint64_t* published);
+
+    // Variants are encoded lazily: the first subscriber to ask for a frame
+    // encodes it (with its own encoder) and every other subscriber of the
+    // variant shares that buffer, so each variant costs at most one encode
+    // per captured frame and nothing while no subscriber asks. Subscribing
+    // fails when max_variants distinct variants already have subscribers;
+    // a variant's cached frame is dropped with its last subscriber.
+    bool subscribe(const VariantKey& key, size_t max_variants);
+    void unsubscribe(const VariantKey& key);
+    // Like wait_jpeg for a subscribed variant
+    FrameRef wait_variant(const VariantKey& key, uint64_t after, int timeout_ms, VariantEncoder& encoder);
+    FrameRef latest_variant(const VariantKey& key);
+
+    // Source-loss watchdog. The capture thread marks the source lost when
+    // reads fail; check_stall() (called periodically from another thread)
+    // also catches a read that hangs. Consumers keep their sessions and
+    // bridge the gap while source_lost() is set.
+    void mark_lost();
+    void check_stall(int stall_ms);
+    bool source_lost() const { return lost_; }
+    // Restarts the stall timer, e.g. when capture resumes after idling
+    void arm_watchdog();
+    RecoveryStats recovery_stats();
+
+    // Capture runs only while at least one consumer is registered. A consumer
+    // that needs only `fps` frames per second says so (0: every frame); while
+    // every consumer is limited, frames beyond the fastest one's rate are
+    // dropped before they are encoded.
+    void add_consumer(int fps = 0);
+    void remove_consumer(int fps = 0);
+    bool has_consumers() const { return consumers_ > 0; }
+    // Highest rate the consumers need; 0 when one needs every frame
+    int demand_fps() const { return demand_fps_; }
+
+    void wake_all() { cond_.notify_all(); }
+
+    // Drops the held frames so their buffers return to the pools
+    void clear();
+
+private:
+    struct Variant {
+        VariantKey key;
+        int subscribers;
+        uint64_t seq;          // Frame cached in `frame`
+        uint64_t encoding_seq; // Frame a subscriber is encoding right now; 0 if none
+        FrameRef frame;
+    };
+
+    Variant* find_variant(const VariantKey& key);
+    void update_demand();
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    FrameRef raw_;
+    FrameRef jpeg_;
+    FrameRef snapshot_;
+    std::vector<Variant> variants_;
+    std::vector<FrameRef> history_; // Ring of the newest encoded frames
+    std::vector<uint64_t> history_published_; // Publish count of each
+    size_t history_next_;
+    uint64_t seq_;
+    uint64_t published_;      // Frames published so far
+    uint64_t jpeg_published_; // Publish count of jpeg_
+    std::atomic<int> consumers_;
+    std::vector<int> limited_fps_; // Rates of the limited consumers
+    std::atomic<int> demand_fps_;
+    uint64_t last_publish_ns_;
+    std::atomic<bool> lost_;
+    RecoveryStats recovery_;
+};
+
+// JPEG encoder workers shared by all cameras. Capture threads hand over raw
+// frames; a worker encodes each into the shared JPEG pool and publishes both
+// to the camera's channel. Jobs live in a fixed ring: when it is full the new
+// frame is dropped, as the workers are behind and a newer one follows anyway.
+// Several workers may encode consecutive frames of one camera; one that
+// finishes ahead of an earlier frame holds its result until that frame is
+// published (or failed), so no paid-for encode is discarded as late.
+class EncodeQueue {
+public:
+    EncodeQueue(FramePool& jpeg_pool, size_t capacity, int pool_wait_ms);
+    ~EncodeQueue();
+
+    void start(int workers);
+    // Finishes queued jobs and joins the workers
+    void stop();
+
+    // Returns false (and counts a drop) when the queue is full. With `roi`
+    // the background is coarsened before encoding; a `snapshot` is also
+    // kept by the channel.
+    bool submit(const FrameRef& raw, FrameChannel& channel, int quality, RoiMap* roi = nullptr,
+                bool snapshot = false);
+
+    uint64_t dropped() const { return dropped_; }
+    size_t workers() const { return threads_.size(); }
+
+private:
+    EncodeQueue(const EncodeQueue&);
+    EncodeQueue& operator=(const EncodeQueue&);
+
+    struct Job {
+        FrameRef raw;
+        FrameChannel* channel;
+        int quality;
+        RoiMap* roi;
+        bool snapshot;
+    };
+
+    // A worker's current job, kept until it is published in order
+    struct InFlight {
+        FrameChannel* channel; // Null while the worker is idle
+        uint64_t seq;
+        FrameRef raw;
+        FrameRef jpeg;         // Empty until done, or if encoding failed
+        bool done;
+        bool snapshot;
+    };
+
+    void worker(size_t index);
+    // Publishes `channel`'s finished frames up to its oldest unfinished
+    // one; called with mutex_ held
+    void publish_in_order(FrameChannel* channel);
+
+    FramePool& jpeg_pool_;
+    int pool_wait_ms_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<Job> ring_;
+    size_t head_;  // Oldest job
+    size_t count_;
+    bool stopping_;
+    std::vector<std::thread> threads_;
+    std::vector<InFlight> in_flight_; // One per worker
+    std::atomic<uint64_t> dropped_;
+};
+
+// Opens config.device at the stream resolution and frame rate
+bool open_capture(FrameSource& source, const CaptureConfig& config);
+
+// Capture frames and queue them for encoding until `running` clears. With no
+// consumers the device is kept warm at config.idle_fps, then released after
+// config.idle_timeout_ms and reopened when a consumer returns.
+void capture_loop(FrameSource& source, FramePool& raw_pool, EncodeQueue& encoder, FrameChannel& channel,
+                  std::atomic<bool>& snapshot_signal, const CaptureConfig& config,
+                  const std::atomic<bool>& running);
+
+#endif
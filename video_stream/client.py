@@ -1,30 +1,85 @@
 import sys
 import socket
+import ssl
 import struct
 import cv2
 import numpy as np
 from PyQt5.QtWidgets import (QApplication, QMainWindow, QWidget, QVBoxLayout, 
-                             QHBoxLayout, QLabel, QLineEdit, QPushButton)
+                             QHBoxLayout, QLabel, QLineEdit, QPushButton, QCheckBox)
 from PyQt5.QtGui import QImage, QPixmap
 from PyQt5.QtCore import Qt, QThread, pyqtSignal
 from datetime import datetime
 import io
+import os
+
+# Native receive/decode core from native_client (`make python` there); the
+# pure-Python path below is used when it has not been built
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "native_client"))
+try:
+    import nlxclient
+except ImportError:
+    nlxclient = None
+
+# TLS for servers started with --tls-cert. The server certificate is checked
+# against $NLX_TLS_CA when set; otherwise the link is encrypted but the
+# server is not authenticated.
+TLS_CA = os.environ.get("NLX_TLS_CA", "")
+
+def tls_wrap(sock, host):
+    if TLS_CA:
+        context = ssl.create_default_context(cafile=TLS_CA)
+    else:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+        context.check_hostname = False
+        context.verify_mode = ssl.CERT_NONE
+    return context.wrap_socket(sock, server_hostname=host)
 
 class StreamThread(QThread):
     frame_received = pyqtSignal(np.ndarray)
     error_occurred = pyqtSignal(str)
 
-    def __init__(self, host, port):
+    def __init__(self, host, port, tls=False, channel=-1):
         super().__init__()
         self.host = host
         self.port = port
+        self.tls = tls
+        self.channel = channel
         self.running = True
+        self.native = None
 
     def run(self):
+        if nlxclient is not None:
+            self.run_native()
+        else:
+            self.run_python()
+
+    def run_native(self):
+        # Receive, JPEG decode and RGB conversion happen in C++ without the
+        # GIL; each frame arrives as an RGB array over the decoded pixels
+        try:
+            self.native = nlxclient.VideoStream(self.host, self.port, format="rgb", tls=self.tls, tls_ca=TLS_CA,
+                                               channel=self.channel)
+            if not self.running:
+                self.native.stop()
+            while self.running:
+                frame = self.native.read()
+                if frame is None:
+                    break
+                self.frame_received.emit(frame)
+        except Exception as e:
+            self.error_occurred.emit(str(e))
+
+    def run_python(self):
         try:
             # Connect to the server
             sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
             sock.connect((self.host, self.port))
+            if self.tls:
+                sock = tls_wrap(sock, self.host)
+            # Camera on a multi-camera server; an empty request line gets
+            # camera 0 at once, where sending nothing would wait out the
+            # server's request timeout
+            sock.sendall(b"CHANNEL %d\n" % self.channel if self.channel >= 0 else b"\n")
 
             while self.running:
                 # Read frame size (4 bytes, network byte order)
@@ -38,6 +93,9 @@ class StreamThread(QThread):
                     break
 
                 size = struct.unpack("!I", size_data)[0]
+                if size == 0:
+                    # "Source lost" marker; frames resume once the camera recovers
+                    continue
 
                 # Read frame data
                 frame_data = b""
@@ -65,6 +123,9 @@ class StreamThread(QThread):
 
     def stop(self):
         self.running = False
+        native = self.native
+        if native is not None:
+            native.stop()
 
 class VideoClient(QMainWindow):
     def __init__(self):
@@ -81,11 +142,16 @@ class VideoClient(QMainWindow):
         input_layout = QHBoxLayout()
         self.host_input = QLineEdit("127.0.0.1")
         self.port_input = QLineEdit("40917")
+        self.channel_input = QLineEdit("0")
+        self.tls_check = QCheckBox("TLS")
         self.connect_button = QPushButton("Connect")
         input_layout.addWidget(QLabel("Host:"))
         input_layout.addWidget(self.host_input)
         input_layout.addWidget(QLabel("Port:"))
         input_layout.addWidget(self.port_input)
+        input_layout.addWidget(QLabel("Camera:"))
+        input_layout.addWidget(self.channel_input)
+        input_layout.addWidget(self.tls_check)
         input_layout.addWidget(self.connect_button)
         main_layout.addLayout(input_layout)
 
@@ -120,8 +186,13 @@ class VideoClient(QMainWindow):
         except ValueError:
             self.video_label.setText("Error: Invalid port number")
             return
+        try:
+            channel = int(self.channel_input.text() or "-1")
+        except ValueError:
+            self.video_label.setText("Error: Invalid camera number")
+            return
 
-        self.stream_thread = StreamThread(host, port)
+        self.stream_thread = StreamThread(host, port, self.tls_check.isChecked(), channel)
         self.stream_thread.frame_received.connect(self.update_frame)
         self.stream_thread.error_occurred.connect(self.handle_error)
         self.stream_thread.start()
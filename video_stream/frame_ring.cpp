@@ -0,0 +1,249 @@
+#include "frame_ring.h"
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#include "log.h"
+
+// The ring is only sound if these atomics need no lock, which would not be
+// shared between processes
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "lock-free atomics required");
+
+static const uint32_t RING_MAGIC = 0x4e4c5852; // "NLXR"
+static const int READ_ATTEMPTS = 8;
+
+static size_t align64(size_t n) {
+    return (n + 63) & ~static_cast<size_t>(63);
+}
+
+struct FrameRing::Header {
+    uint32_t magic;
+    uint32_t cameras;
+    uint32_t slots;
+    uint32_t reserved;
+    uint64_t frame_capacity;
+    uint64_t slot_stride; // Slot header plus frame data, cache-line aligned
+};
+
+struct FrameRing::CameraState {
+    std::atomic<uint64_t> latest;      // Sequence number of the newest frame; 0 before the first
+    std::atomic<uint64_t> latest_slot; // Write count at which it was stored
+    std::atomic<uint32_t> futex;       // Bumped with every frame
+    std::atomic<uint32_t> lost;
+    std::atomic<int32_t> consumers[MAX_WORKERS];
+    std::atomic<int32_t> fps[MAX_WORKERS];
+};
+
+struct FrameRing::Slot {
+    std::atomic<uint64_t> version; // Odd while the writer fills the slot
+    uint64_t seq;
+    uint64_t pts_ns;
+    uint32_t size;
+    int32_t width;
+    int32_t height;
+    // Frame data follows at the next cache line
+};
+
+static size_t layout_size(size_t cameras, size_t slots, size_t slot_stride, size_t header, size_t state) {
+    return align64(header) + cameras * align64(state) + cameras * slots * slot_stride;
+}
+
+FrameRing::FrameRing() : fd_(-1), memory_(nullptr), size_(0), header_(nullptr) {}
+
+FrameRing::~FrameRing() {
+    if (memory_) munmap(memory_, size_);
+    if (fd_ >= 0) close(fd_);
+}
+
+bool FrameRing::create(size_t cameras, size_t slots, size_t frame_capacity) {
+    size_t slot_stride = align64(sizeof(Slot)) + align64(frame_capacity);
+    size_ = layout_size(cameras, slots, slot_stride, sizeof(Header), sizeof(CameraState));
+    // Not close-on-exec: the workers find the ring behind this fd
+    fd_ = static_cast<int>(syscall(SYS_memfd_create, "nlx-frame-ring", 0));
+    if (fd_ < 0 || ftruncate(fd_, size_) < 0) {
+        LOG_ERROR("Frame ring: cannot create %zu bytes of shared memory: %s", size_, strerror(errno));
+        return false;
+    }
+    void* memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (memory == MAP_FAILED) {
+        LOG_ERROR("Frame ring: mmap failed: %s", strerror(errno));
+        return false;
+    }
+    memory_ = static_cast<uint8_t*>(memory);
+
+    header_ = new (memory_) Header();
+    header_->magic = RING_MAGIC;
+    header_->cameras = static_cast<uint32_t>(cameras);
+    header_->slots = static_cast<uint32_t>(slots);
+    header_->frame_capacity = frame_capacity;
+    header_->slot_stride = slot_stride;
+    for (size_t c = 0; c < cameras; ++c) {
+        CameraState* state = new (&camera_state(c)) CameraState();
+        state->latest = 0;
+        state->latest_slot = 0;
+        state->futex = 0;
+        state->lost = 0;
+        for (int w = 0; w < MAX_WORKERS; ++w) {
+            state->consumers[w] = 0;
+            state->fps[w] = 0;
+        }
+        for (size_t i = 0; i < slots; ++i) {
+            Slot* s = new (&slot(c, i)) Slot();
+            s->version = 0;
+        }
+    }
+    LOG_INFO("Frame ring: %zu camera(s) x %zu slots of %zu bytes in shared memory", cameras, slots, frame_capacity);
+    return true;
+}
+
+bool FrameRing::attach(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        LOG_ERROR("Frame ring: fd %d is not the capture process's ring", fd);
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    void* memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        LOG_ERROR("Frame ring: mmap failed: %s", strerror(errno));
+        return false;
+    }
+    fd_ = fd;
+    memory_ = static_cast<uint8_t*>(memory);
+    header_ = reinterpret_cast<Header*>(memory_);
+    if (header_->magic != RING_MAGIC ||
+        layout_size(header_->cameras, header_->slots, header_->slot_stride, sizeof(Header), sizeof(CameraState)) !=
+            size_) {
+        LOG_ERROR("Frame ring: fd %d has an unexpected layout", fd);
+        return false;
+    }
+    return true;
+}
+
+size_t FrameRing::cameras() const {
+    return header_->cameras;
+}
+
+size_t FrameRing::frame_capacity() const {
+    return header_->frame_capacity;
+}
+
+FrameRing::CameraState& FrameRing::camera_state(size_t camera) const {
+    uint8_t* p = memory_ + align64(sizeof(Header)) + camera * align64(sizeof(CameraState));
+    return *reinterpret_cast<CameraState*>(p);
+}
+
+FrameRing::Slot& FrameRing::slot(size_t camera, uint64_t index) const {
+    uint8_t* base = memory_ + align64(sizeof(Header)) + header_->cameras * align64(sizeof(CameraState));
+    size_t n = camera * header_->slots + index % header_->slots;
+    return *reinterpret_cast<Slot*>(base + n * header_->slot_stride);
+}
+
+void FrameRing::write(size_t camera, const FrameBuffer& jpeg) {
+    if (jpeg.size > header_->frame_capacity) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Frame ring: %zu-byte frame does not fit", jpeg.size);
+        return;
+    }
+    CameraState& state = camera_state(camera);
+    // Readers take the newest slot, so the next one round is the oldest
+    uint64_t index = state.latest_slot.load(std::memory_order_relaxed) + 1;
+    Slot& s = slot(camera, index);
+    uint8_t* data = reinterpret_cast<uint8_t*>(&s) + align64(sizeof(Slot));
+
+    uint64_t version = s.version.load(std::memory_order_relaxed);
+    s.version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.seq = jpeg.seq;
+    s.pts_ns = jpeg.pts_ns;
+    s.size = static_cast<uint32_t>(jpeg.size);
+    s.width = jpeg.width;
+    s.height = jpeg.height;
+    memcpy(data, jpeg.data(), jpeg.size);
+    s.version.store(version + 2, std::memory_order_release);
+
+    state.latest_slot.store(index, std::memory_order_release);
+    state.latest.store(jpeg.seq, std::memory_order_release);
+    state.futex.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state.futex), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void FrameRing::set_lost(size_t camera, bool lost) {
+    camera_state(camera).lost.store(lost ? 1 : 0, std::memory_order_relaxed);
+}
+
+bool FrameRing::lost(size_t camera) const {
+    return camera_state(camera).lost.load(std::memory_order_relaxed) != 0;
+}
+
+uint64_t FrameRing::wait(size_t camera, uint64_t after, int timeout_ms) const {
+    CameraState& state = camera_state(camera);
+    uint32_t futex = state.futex.load(std::memory_order_acquire);
+    uint64_t latest = state.latest.load(std::memory_order_acquire);
+    if (latest > after) return latest;
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state.futex), FUTEX_WAIT, futex, &timeout, nullptr, 0);
+    latest = state.latest.load(std::memory_order_acquire);
+    return latest > after ? latest : after;
+}
+
+bool FrameRing::read_latest(size_t camera, FrameBuffer& out) const {
+    CameraState& state = camera_state(camera);
+    for (int attempt = 0; attempt < READ_ATTEMPTS; ++attempt) {
+        if (attempt > 0) sched_yield();
+        Slot& s = slot(camera, state.latest_slot.load(std::memory_order_acquire));
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(&s) + align64(sizeof(Slot));
+
+        uint64_t version = s.version.load(std::memory_order_acquire);
+        if (version & 1) continue;
+        size_t size = s.size;
+        if (size > out.capacity()) return false;
+        out.seq = s.seq;
+        out.pts_ns = s.pts_ns;
+        out.width = s.width;
+        out.height = s.height;
+        memcpy(out.data(), data, size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.version.load(std::memory_order_relaxed) != version) continue;
+
+        out.format = FRAME_JPEG;
+        out.size = size;
+        out.stride = 0;
+        return true;
+    }
+    return false;
+}
+
+void FrameRing::set_demand(int worker, size_t camera, int consumers, int fps) {
+    CameraState& state = camera_state(camera);
+    state.consumers[worker].store(consumers, std::memory_order_relaxed);
+    state.fps[worker].store(fps, std::memory_order_relaxed);
+}
+
+bool FrameRing::demand(size_t camera, int& fps) const {
+    CameraState& state = camera_state(camera);
+    bool watched = false, full_rate = false;
+    fps = 0;
+    for (int w = 0; w < MAX_WORKERS; ++w) {
+        if (state.consumers[w].load(std::memory_order_relaxed) <= 0) continue;
+        watched = true;
+        int rate = state.fps[w].load(std::memory_order_relaxed);
+        if (rate == 0) full_rate = true;
+        else if (rate > fps) fps = rate;
+    }
+    if (full_rate) fps = 0;
+    return watched;
+}
+
+void FrameRing::clear_worker(int worker) {
+    for (size_t c = 0; c < header_->cameras; ++c) set_demand(worker, c, 0, 0);
+}
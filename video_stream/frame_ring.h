@@ -0,0 +1,73 @@
+#ifndef NLX_VIDEO_FRAME_RING_H
+#define NLX_VIDEO_FRAME_RING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "frame_pool.h"
+
+// Encoded frames of every camera in shared memory, written by the capture
+// process and read by its worker processes (--workers).
+//
+// The memory is a memfd that the workers inherit across exec. Each camera
+// has a ring of slots, each guarded by a seqlock: the single writer makes a
+// slot's version odd while it fills the slot, so a reader copies the frame
+// out and keeps the copy only if the version was even and unchanged around
+// it. A reader never blocks the writer, and a worker that crashes mid-copy
+// leaves nothing behind. New frames are signalled with a shared futex.
+//
+// Workers report their viewers per camera in the same memory, so capture
+// runs (and is decimated) for the viewers of every worker; the capture
+// process clears a dead worker's entries.
+class FrameRing {
+public:
+    static const int MAX_WORKERS = 64;
+
+    FrameRing();
+    ~FrameRing();
+
+    // Capture process: creates the memory. Returns false on failure.
+    bool create(size_t cameras, size_t slots, size_t frame_capacity);
+    // Worker: maps the memory behind an inherited fd
+    bool attach(int fd);
+
+    int fd() const { return fd_; }
+    size_t cameras() const;
+    size_t frame_capacity() const;
+
+    // Writer side, one thread per camera
+    void write(size_t camera, const FrameBuffer& jpeg);
+    void set_lost(size_t camera, bool lost);
+
+    // Reader side: waits up to timeout_ms for a frame newer than `after` and
+    // returns the newest sequence number (`after` on timeout)
+    uint64_t wait(size_t camera, uint64_t after, int timeout_ms) const;
+    // Copies the newest frame into `out`; false if it was overwritten while
+    // being copied or does not fit
+    bool read_latest(size_t camera, FrameBuffer& out) const;
+    bool lost(size_t camera) const;
+
+    // Viewers per worker and camera, and the frame rate they need (0: all)
+    void set_demand(int worker, size_t camera, int consumers, int fps);
+    // Totals over the workers: false when nobody watches `camera`
+    bool demand(size_t camera, int& fps) const;
+    void clear_worker(int worker);
+
+private:
+    FrameRing(const FrameRing&);
+    FrameRing& operator=(const FrameRing&);
+
+    struct Header;
+    struct CameraState;
+    struct Slot;
+
+    CameraState& camera_state(size_t camera) const;
+    Slot& slot(size_t camera, uint64_t index) const;
+
+    int fd_;
+    uint8_t* memory_;
+    size_t size_;
+    Header* header_;
+};
+
+#endif
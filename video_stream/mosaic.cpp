@@ -0,0 +1,158 @@
+#include "mosaic.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "clock.h"
+#include "log.h"
+#include "rt_profile.h"
+
+MosaicCompositor::MosaicCompositor(int cols, int rows, int width, int height)
+    : cols_(cols), rows_(rows), canvas_(height, width, CV_8UC3, cv::Scalar::all(0)), tiles_(cols * rows) {
+    for (int i = 0; i < cols * rows; ++i) {
+        Tile& tile = tiles_[i];
+        int col = i % cols, row = i / cols;
+        // Spread the remainder so the cells cover the canvas exactly
+        int x0 = col * width / cols, x1 = (col + 1) * width / cols;
+        int y0 = row * height / rows, y1 = (row + 1) * height / rows;
+        tile.cell = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+        tile.dst = cv::Rect();
+        tile.src_width = 0;
+        tile.src_height = 0;
+        tile.seq = 0;
+        tile.snap_width = 0;
+        tile.snap_height = 0;
+    }
+}
+
+void MosaicCompositor::layout(Tile& tile, int src_width, int src_height) {
+    int cell_w = tile.cell.width, cell_h = tile.cell.height;
+    int w, h;
+    // Shrinking by a whole factor that divides the source exactly keeps the
+    // aspect ratio and lets INTER_AREA average fixed k x k blocks
+    int k = std::max((src_width + cell_w - 1) / cell_w, (src_height + cell_h - 1) / cell_h);
+    if (k > 1 && src_width % k == 0 && src_height % k == 0) {
+        w = src_width / k;
+        h = src_height / k;
+    } else {
+        double scale = std::min(static_cast<double>(cell_w) / src_width, static_cast<double>(cell_h) / src_height);
+        w = std::max(1, std::min(cell_w, static_cast<int>(src_width * scale + 0.5)));
+        h = std::max(1, std::min(cell_h, static_cast<int>(src_height * scale + 0.5)));
+    }
+    tile.dst = cv::Rect(tile.cell.x + (cell_w - w) / 2, tile.cell.y + (cell_h - h) / 2, w, h);
+    tile.src_width = src_width;
+    tile.src_height = src_height;
+    canvas_(tile.cell).setTo(cv::Scalar::all(0));
+    LOG_INFO("Mosaic tile %d,%d: %dx%d -> %dx%d", tile.cell.x, tile.cell.y, src_width, src_height, w, h);
+}
+
+void MosaicCompositor::set_snapshot_size(size_t index, int width, int height) {
+    if (index >= tiles_.size()) return;
+    tiles_[index].snap_width = width;
+    tiles_[index].snap_height = height;
+}
+
+bool MosaicCompositor::compose(const std::vector<FrameChannel*>& sources) {
+    bool changed = false;
+    size_t n = std::min(sources.size(), tiles_.size());
+    for (size_t i = 0; i < n; ++i) {
+        Tile& tile = tiles_[i];
+        FrameRef raw = sources[i]->latest_raw();
+        if (!raw || raw->seq == tile.seq || raw->format != FRAME_BGR) continue;
+
+        if (raw->width != tile.src_width || raw->height != tile.src_height) {
+            bool snapshot = raw->width == tile.snap_width && raw->height == tile.snap_height;
+            if (snapshot && tile.src_width > 0) continue;
+            layout(tile, raw->width, raw->height);
+        }
+        cv::Mat src(raw->height, raw->width, CV_8UC3, raw->data(), raw->stride);
+        cv::Mat dst = canvas_(tile.dst);
+        if (src.size() == dst.size()) src.copyTo(dst);
+        else cv::resize(src, dst, dst.size(), 0, 0, cv::INTER_AREA);
+        tile.seq = raw->seq;
+        changed = true;
+    }
+    return changed;
+}
+
+// Only the first `n` sources have a tile; the rest are never drawn
+static void set_source_consumers(const std::vector<FrameChannel*>& sources, size_t n, int fps, bool add) {
+    for (size_t i = 0; i < n; ++i) {
+        if (add) sources[i]->add_consumer(fps);
+        else sources[i]->remove_consumer(fps);
+    }
+}
+
+void mosaic_loop(MosaicCompositor& mosaic, const std::vector<FrameChannel*>& sources, FramePool& raw_pool,
+                 EncodeQueue& encoder, FrameChannel& channel, const CaptureConfig& config,
+                 const std::atomic<bool>& running) {
+    rt_profile_apply("mosaic");
+    uint64_t next_ns = 0;
+    uint64_t seq = 0;
+    bool active = false;
+    const size_t tiled = std::min(sources.size(), static_cast<size_t>(mosaic.cols()) * mosaic.rows());
+    int source_fps = 0; // Rate the sources are asked for while active
+
+    while (running) {
+        if (!channel.has_consumers()) {
+            if (active) {
+                set_source_consumers(sources, tiled, source_fps, false);
+                active = false;
+                LOG_INFO("No mosaic consumers, compositing paused");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+
+        // Composing is paced to what the mosaic's consumers need, and the
+        // sources to what composing needs
+        int demand = channel.demand_fps();
+        int fps = demand > 0 ? std::min(demand, config.fps) : config.fps;
+        if (!active) {
+            set_source_consumers(sources, tiled, fps, true);
+            source_fps = fps;
+            active = true;
+            next_ns = monotonic_ns();
+            channel.arm_watchdog();
+        } else if (fps != source_fps) {
+            set_source_consumers(sources, tiled, fps, true);
+            set_source_consumers(sources, tiled, source_fps, false);
+            source_fps = fps;
+        }
+        const uint64_t period_ns = 1000000000ull / std::max(fps, 1);
+
+        uint64_t now = monotonic_ns();
+        if (now < next_ns) std::this_thread::sleep_for(std::chrono::nanoseconds(next_ns - now));
+        next_ns += period_ns;
+        // Fell behind (e.g. preempted): restart the schedule rather than burst
+        if (monotonic_ns() > next_ns + period_ns) next_ns = monotonic_ns() + period_ns;
+
+        // Only the tiles that changed are redrawn; with every camera stalled
+        // nothing is encoded and the channel's own watchdog takes over
+        if (!mosaic.compose(sources)) continue;
+
+        FrameRef raw = raw_pool.acquire(config.pool_wait_ms);
+        if (!raw) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Raw frame pool exhausted, dropping mosaic frame");
+            continue;
+        }
+        const cv::Mat& canvas = mosaic.canvas();
+        size_t stride = static_cast<size_t>(canvas.cols) * 3;
+        cv::Mat dst(canvas.rows, canvas.cols, CV_8UC3, raw->data(), stride);
+        canvas.copyTo(dst);
+        raw->format = FRAME_BGR;
+        raw->width = canvas.cols;
+        raw->height = canvas.rows;
+        raw->stride = stride;
+        raw->size = stride * canvas.rows;
+        raw->seq = ++seq;
+        raw->pts_ns = monotonic_ns();
+
+        if (!encoder.submit(raw, channel, config.quality, config.roi.get())) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Encoder queue full, dropping mosaic frame");
+        }
+    }
+
+    if (active) set_source_consumers(sources, tiled, source_fps, false);
+}
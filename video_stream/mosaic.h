@@ -0,0 +1,70 @@
+#ifndef NLX_VIDEO_MOSAIC_H
+#define NLX_VIDEO_MOSAIC_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "capture.h"
+#include "frame_pool.h"
+
+// Overview of several cameras in one frame: each camera's newest raw frame
+// is scaled into its tile of a cols x rows grid, and the composite is
+// encoded once for all its viewers.
+//
+// The canvas persists between composites and a tile is redrawn only when its
+// camera published a new frame, so a stalled or lost camera simply keeps its
+// last picture. Tile placement (aspect-preserving, centred in the cell) is
+// worked out once per source resolution and cached. Scaling is OpenCV's
+// INTER_AREA into the tile ROI; the layout prefers an integer shrink factor
+// when one fits, which takes its vectorised fast path.
+class MosaicCompositor {
+public:
+    MosaicCompositor(int cols, int rows, int width, int height);
+
+    int cols() const { return cols_; }
+    int rows() const { return rows_; }
+    int width() const { return canvas_.cols; }
+    int height() const { return canvas_.rows; }
+
+    // The snapshot resolution of tile `index`'s source. Once the tile is laid
+    // out for the stream, frames of this size are skipped rather than drawn,
+    // which would relayout and blank the cell twice per snapshot.
+    void set_snapshot_size(size_t index, int width, int height);
+
+    // Redraws the tiles whose source has a newer frame; sources beyond the
+    // grid are ignored. Returns false when nothing changed.
+    bool compose(const std::vector<FrameChannel*>& sources);
+
+    const cv::Mat& canvas() const { return canvas_; }
+
+private:
+    struct Tile {
+        cv::Rect cell;    // Grid cell, cleared when the layout changes
+        cv::Rect dst;     // Scaled picture within the cell
+        int src_width;    // Source resolution `dst` was computed for
+        int src_height;
+        uint64_t seq;     // Last source frame drawn
+        int snap_width;   // Source snapshot resolution, skipped once laid out
+        int snap_height;
+    };
+
+    void layout(Tile& tile, int src_width, int src_height);
+
+    int cols_;
+    int rows_;
+    cv::Mat canvas_;
+    std::vector<Tile> tiles_;
+};
+
+// Composes at config.fps, or the slower rate all its consumers asked for,
+// while the mosaic channel has consumers, holding a consumer reference at
+// that rate on every tiled source meanwhile so their capture runs, and
+// queues each changed composite for encoding. Only config.fps, quality and
+// pool_wait_ms are used.
+void mosaic_loop(MosaicCompositor& mosaic, const std::vector<FrameChannel*>& sources, FramePool& raw_pool,
+                 EncodeQueue& encoder, FrameChannel& channel, const CaptureConfig& config,
+                 const std::atomic<bool>& running);
+
+#endif
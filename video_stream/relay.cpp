@@ -0,0 +1,258 @@
+#include "relay.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include "clock.h"
+#include "log.h"
+#include "rt_profile.h"
+
+static const int CONNECT_MS = 2000;
+static const int RECV_POLL_MS = 100;
+
+bool parse_relay(const std::string& device, RelayUpstream& upstream) {
+    static const std::string scheme = "tcp://";
+    if (device.compare(0, scheme.size(), scheme) != 0) return false;
+    std::string address = device.substr(scheme.size());
+    char extra;
+    upstream.channel = -1;
+    size_t slash = address.find('/');
+    if (slash != std::string::npos) {
+        if (sscanf(address.c_str() + slash + 1, "%d%c", &upstream.channel, &extra) != 1 || upstream.channel < 0) {
+            throw std::invalid_argument(device);
+        }
+        address.resize(slash);
+    }
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0 ||
+        sscanf(address.c_str() + colon + 1, "%d%c", &upstream.port, &extra) != 1 || upstream.port <= 0 ||
+        upstream.port > 65535) {
+        throw std::invalid_argument(device);
+    }
+    upstream.host = address.substr(0, colon);
+    return true;
+}
+
+// Connects and sends the stream request; returns the socket or -1
+static int connect_upstream(const RelayUpstream& upstream, int fps) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    int gai = getaddrinfo(upstream.host.c_str(), std::to_string(upstream.port).c_str(), &hints, &res);
+    if (gai != 0) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Relay: cannot resolve %s: %s", upstream.host.c_str(), gai_strerror(gai));
+        return -1;
+    }
+
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int ret = fd < 0 ? -1 : connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (ret < 0 && fd >= 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ret = poll(&pfd, 1, CONNECT_MS);
+        if (ret == 0) errno = ETIMEDOUT;
+        if (ret > 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) ret = 0;
+        else if (ret > 0) errno = err, ret = -1;
+        else ret = -1;
+    }
+    if (ret < 0) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Relay: cannot connect to %s:%d: %s", upstream.host.c_str(),
+                     upstream.port, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    // A dead uplink shows up within seconds rather than at the kernel's
+    // two-hour keepalive default
+    int flag = 1, idle = 5, interval = 2, count = 3;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+
+    // An empty line spares the upstream its wait for a request
+    char request[64];
+    int len = 0;
+    if (upstream.channel >= 0) len += snprintf(request + len, sizeof(request) - len, "CHANNEL %d ", upstream.channel);
+    if (fps > 0) len += snprintf(request + len, sizeof(request) - len, "FPS %d ", fps);
+    if (len > 0) --len;
+    request[len++] = '\n';
+    if (send(fd, request, len, MSG_NOSIGNAL) != len) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "Relay: request to %s:%d failed: %s", upstream.host.c_str(),
+                     upstream.port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Incremental parser of the size-prefixed stream, so the loop never blocks
+// in the middle of a frame and still notices shutdown or departed consumers
+class UpstreamReader {
+public:
+    UpstreamReader(FramePool& jpeg_pool, int pool_wait_ms)
+        : jpeg_pool_(jpeg_pool), pool_wait_ms_(pool_wait_ms), header_len_(0), size_(0), received_(0) {}
+
+    void reset() {
+        header_len_ = 0;
+        frame_.reset();
+    }
+
+    enum Result { NONE, FRAME, LOST_MARKER, DROPPED, ERROR };
+
+    // Reads what the socket has. FRAME leaves the completed frame in `frame`.
+    Result read(int fd, FrameRef& frame) {
+        if (header_len_ < sizeof(header_)) {
+            ssize_t n = recv(fd, header_ + header_len_, sizeof(header_) - header_len_, MSG_DONTWAIT);
+            if (n <= 0) return failed(n);
+            header_len_ += n;
+            if (header_len_ < sizeof(header_)) return NONE;
+            uint32_t size;
+            memcpy(&size, header_, sizeof(size));
+            size_ = ntohl(size);
+            received_ = 0;
+            if (size_ == 0) {
+                header_len_ = 0;
+                return LOST_MARKER;
+            }
+            if (size_ > jpeg_pool_.buffer_bytes()) {
+                LOG_ERROR("Relay: %zu-byte frame exceeds the pool buffers; give the camera a larger size=", size_);
+                return ERROR;
+            }
+            // Without a buffer the frame is still read, into nothing
+            frame_ = jpeg_pool_.acquire(pool_wait_ms_);
+            if (!frame_) LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "JPEG frame pool exhausted, dropping relayed frame");
+        }
+
+        uint8_t discard[16384];
+        uint8_t* dst = frame_ ? frame_->data() + received_ : discard;
+        size_t want = frame_ ? size_ - received_ : std::min(size_ - received_, sizeof(discard));
+        ssize_t n = recv(fd, dst, want, MSG_DONTWAIT);
+        if (n <= 0) return failed(n);
+        received_ += n;
+        if (received_ < size_) return NONE;
+
+        header_len_ = 0;
+        if (!frame_) return DROPPED;
+        frame_->size = size_;
+        frame = std::move(frame_);
+        return FRAME;
+    }
+
+private:
+    static Result failed(ssize_t n) {
+        if (n == 0) {
+            LOG_ERROR("Relay: upstream closed the connection");
+            return ERROR;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return NONE;
+        LOG_ERROR("Relay: receive failed: %s", strerror(errno));
+        return ERROR;
+    }
+
+    FramePool& jpeg_pool_;
+    int pool_wait_ms_;
+    uint8_t header_[4];
+    size_t header_len_;
+    size_t size_;     // Payload of the frame being received
+    size_t received_;
+    FrameRef frame_;  // Its buffer; empty while it is being discarded
+};
+
+void relay_loop(const RelayUpstream& upstream, FramePool& jpeg_pool, FrameChannel& channel,
+                const CaptureConfig& config, const std::atomic<bool>& running) {
+    rt_profile_apply("relay");
+    UpstreamReader reader(jpeg_pool, config.pool_wait_ms);
+    int fd = -1;
+    int requested_fps = 0; // Rate asked of the upstream; 0 for all it has
+    bool active = false;
+    int backoff_ms = 100;
+    uint64_t seq = 0;
+
+    while (running) {
+        if (!channel.has_consumers()) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+                LOG_INFO("No consumers, relay from %s:%d disconnected", upstream.host.c_str(), upstream.port);
+            }
+            active = false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+        if (!active) {
+            active = true;
+            channel.arm_watchdog();
+        }
+
+        // A consumer needs more than was asked for: ask again
+        int demand = channel.demand_fps();
+        if (demand >= config.fps) demand = 0;
+        if (fd >= 0 && requested_fps != 0 && (demand == 0 || demand > requested_fps)) {
+            LOG_INFO("Relay: consumers need %d fps now, reconnecting", demand ? demand : config.fps);
+            close(fd);
+            fd = -1;
+        }
+
+        if (fd < 0) {
+            reader.reset();
+            fd = connect_upstream(upstream, demand);
+            if (fd < 0) {
+                channel.mark_lost();
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+                backoff_ms = std::min(backoff_ms * 2, 2000);
+                continue;
+            }
+            requested_fps = demand;
+            backoff_ms = 100;
+            LOG_INFO("Relaying %s:%d%s", upstream.host.c_str(), upstream.port,
+                     requested_fps ? (" at " + std::to_string(requested_fps) + " fps").c_str() : "");
+        }
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, RECV_POLL_MS) <= 0) continue;
+        FrameRef jpeg;
+        switch (reader.read(fd, jpeg)) {
+            case UpstreamReader::FRAME:
+                jpeg->format = FRAME_JPEG;
+                jpeg->width = config.width;
+                jpeg->height = config.height;
+                jpeg->stride = 0;
+                jpeg->seq = ++seq;
+                jpeg->pts_ns = monotonic_ns();
+                channel.publish(FrameRef(), jpeg);
+                break;
+            case UpstreamReader::LOST_MARKER:
+                channel.mark_lost();
+                break;
+            case UpstreamReader::ERROR:
+                close(fd);
+                fd = -1;
+                channel.mark_lost();
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (fd >= 0) close(fd);
+}
@@ -0,0 +1,36 @@
+#ifndef NLX_VIDEO_RELAY_H
+#define NLX_VIDEO_RELAY_H
+
+#include <atomic>
+#include <string>
+
+#include "capture.h"
+#include "frame_pool.h"
+
+// Another video server's stream, served as a local camera
+// ("tcp://<host>:<port>[/<channel>]" in place of a device)
+struct RelayUpstream {
+    std::string host;
+    int port;
+    int channel; // Requested with "CHANNEL <n>"; -1 for the upstream's default
+};
+
+// Returns false if `device` is not a relay address
+bool parse_relay(const std::string& device, RelayUpstream& upstream);
+
+// Stands in for capture_loop: while the channel has consumers, keeps one
+// connection to the upstream and publishes each size-prefixed frame as it
+// arrives. The JPEG is received straight into a pooled buffer and handed to
+// every viewer as is, so a relay never decodes or re-encodes, and dozens of
+// viewers cost the uplink one stream. Without consumers the connection is
+// closed; the uplink carries nothing while nobody watches.
+//
+// When every consumer is rate-limited the upstream is asked for just that
+// rate ("FPS <n>"), and reconnected if a faster consumer arrives. An
+// upstream "source lost" marker or a broken connection marks the channel
+// lost; viewers bridge the gap per --on-source-lost while it reconnects with
+// backoff. Only config.fps and pool_wait_ms are used.
+void relay_loop(const RelayUpstream& upstream, FramePool& jpeg_pool, FrameChannel& channel,
+                const CaptureConfig& config, const std::atomic<bool>& running);
+
+#endif
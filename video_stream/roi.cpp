@@ -0,0 +1,194 @@
+#include "roi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// A block's mean may drift this much per channel (sensor noise, exposure)
+// before it counts as motion
+static const int MOTION_THRESHOLD = 10;
+// Frames a block stays sharp after it last moved, so a pausing object does
+// not blur in and out
+static const uint8_t MOTION_HOLD = 15;
+
+// Means of `scale` x `scale` cells of a BGR image into the cells of `out`
+// (already sized); edge cells that run past the image average what they
+// cover
+static void cell_means(const uint8_t* src, size_t stride, int width, int height, int scale, cv::Mat& out) {
+    for (int oy = 0; oy < out.rows; ++oy) {
+        int y0 = oy * scale, y1 = std::min(y0 + scale, height);
+        uint8_t* dst = out.ptr<uint8_t>(oy);
+        for (int ox = 0; ox < out.cols; ++ox) {
+            int x0 = ox * scale, x1 = std::min(x0 + scale, width);
+            uint32_t sum[3] = {0, 0, 0};
+            for (int y = y0; y < y1; ++y) {
+                const uint8_t* p = src + y * stride + x0 * 3;
+                for (int x = x0; x < x1; ++x, p += 3) {
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                }
+            }
+            uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+            for (int c = 0; c < 3; ++c) dst[ox * 3 + c] = static_cast<uint8_t>((sum[c] + count / 2) / count);
+        }
+    }
+}
+
+// Source of each of `n` pixels scaled up `scale` times from `source_n`,
+// pixel centres aligned: the two neighbours and the second's weight
+static void upscale_taps(int n, int source_n, int scale, std::vector<RoiCoarsener::Tap>& taps) {
+    taps.resize(n);
+    for (int i = 0; i < n; ++i) {
+        int pos = (2 * i + 1 - scale) * 128 / scale;
+        RoiCoarsener::Tap& tap = taps[i];
+        if (pos < 0) {
+            tap.first = tap.second = 0;
+            tap.weight = 0;
+            continue;
+        }
+        tap.first = std::min(pos >> 8, source_n - 1);
+        tap.second = std::min(tap.first + 1, source_n - 1);
+        tap.weight = pos & 255;
+    }
+}
+
+// dst[i] = top[i] and bottom[i] (both in 1/256) mixed with `weight` of
+// `bottom`, in 1/256. 16-bit high multiplies in fixed runs of LANES, so the
+// compiler vectorises it at -O2; the weights sum to 0xffff rather than
+// 0x10000, which costs at most one level of rounding.
+static const size_t LANES = 16;
+
+static inline uint8_t blend(uint16_t top, uint16_t bottom, uint16_t top_weight, uint16_t bottom_weight) {
+    uint16_t sum = static_cast<uint16_t>((static_cast<uint32_t>(top) * top_weight) >> 16) +
+                   static_cast<uint16_t>((static_cast<uint32_t>(bottom) * bottom_weight) >> 16);
+    return static_cast<uint8_t>((sum + 128) >> 8);
+}
+
+static void blend_rows(const uint16_t* __restrict top, const uint16_t* __restrict bottom, int weight, size_t n,
+                       uint8_t* __restrict dst) {
+    uint16_t bottom_weight = static_cast<uint16_t>(weight << 8);
+    uint16_t top_weight = static_cast<uint16_t>(0xffff - bottom_weight);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t k = i; k < i + LANES; ++k) dst[k] = blend(top[k], bottom[k], top_weight, bottom_weight);
+    }
+    for (; i < n; ++i) dst[i] = blend(top[i], bottom[i], top_weight, bottom_weight);
+}
+
+bool parse_roi_rect(const std::string& text, RoiRect& rect) {
+    char extra;
+    return sscanf(text.c_str(), "%d:%d:%dx%d%c", &rect.x, &rect.y, &rect.width, &rect.height, &extra) == 4 &&
+           rect.x >= 0 && rect.y >= 0 && rect.width > 0 && rect.height > 0;
+}
+
+RoiMap::RoiMap(const std::vector<RoiRect>& rects, bool motion, int background_scale, int width, int height)
+    : rects_(rects), motion_(motion), scale_(background_scale), width_(width), height_(height) {}
+
+void RoiMap::mark_blocks(const FrameBuffer& raw, std::vector<uint8_t>& blocks, cv::Mat& thumb) {
+    int cols = (raw.width + BLOCK - 1) / BLOCK, rows = (raw.height + BLOCK - 1) / BLOCK;
+    blocks.assign(static_cast<size_t>(cols) * rows, 0);
+
+    for (size_t i = 0; i < rects_.size(); ++i) {
+        const RoiRect& r = rects_[i];
+        int x0 = static_cast<int>(static_cast<int64_t>(r.x) * raw.width / width_) / BLOCK;
+        int y0 = static_cast<int>(static_cast<int64_t>(r.y) * raw.height / height_) / BLOCK;
+        int x1 = static_cast<int>((static_cast<int64_t>(r.x + r.width) * raw.width / width_ + BLOCK - 1) / BLOCK);
+        int y1 = static_cast<int>((static_cast<int64_t>(r.y + r.height) * raw.height / height_ + BLOCK - 1) / BLOCK);
+        for (int y = y0; y < std::min(y1, rows); ++y) {
+            for (int x = x0; x < std::min(x1, cols); ++x) blocks[y * cols + x] = 1;
+        }
+    }
+    if (!motion_) return;
+
+    // Block means, compared with the previous frame's; a moving block and
+    // its neighbours stay sharp for MOTION_HOLD frames
+    thumb.create(rows, cols, CV_8UC3);
+    cell_means(raw.data(), raw.stride, raw.width, raw.height, BLOCK, thumb);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (previous_.rows != thumb.rows || previous_.cols != thumb.cols) {
+        thumb.copyTo(previous_);
+        hold_.assign(blocks.size(), 0);
+        return;
+    }
+    for (int y = 0; y < rows; ++y) {
+        const uint8_t* now = thumb.ptr<uint8_t>(y);
+        const uint8_t* before = previous_.ptr<uint8_t>(y);
+        for (int x = 0; x < cols; ++x) {
+            bool moved = false;
+            for (int c = 0; c < 3; ++c) moved |= std::abs(now[x * 3 + c] - before[x * 3 + c]) > MOTION_THRESHOLD;
+            if (!moved) continue;
+            for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, rows - 1); ++ny) {
+                for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, cols - 1); ++nx) {
+                    hold_[ny * cols + nx] = MOTION_HOLD;
+                }
+            }
+        }
+    }
+    thumb.copyTo(previous_);
+    for (size_t i = 0; i < hold_.size(); ++i) {
+        if (hold_[i] == 0) continue;
+        --hold_[i];
+        blocks[i] = 1;
+    }
+}
+
+const uint8_t* RoiCoarsener::apply(const FrameBuffer& raw, RoiMap& map, size_t& stride) {
+    map.mark_blocks(raw, blocks_, thumb_);
+
+    cv::Mat src(raw.height, raw.width, CV_8UC3, raw.data(), raw.stride);
+    int scale = map.background_scale();
+
+    // Box-filter down by the integer scale and bilinear back up, by hand
+    // into the reused scratch images: cv::resize allocates per call
+    small_.create(std::max(raw.height / scale, 1), std::max(raw.width / scale, 1), CV_8UC3);
+    cell_means(raw.data(), raw.stride, raw.width, raw.height, scale, small_);
+    coarse_.create(raw.height, raw.width, CV_8UC3);
+    upscale_taps(raw.width, small_.cols, scale, x_taps_);
+    upscale_taps(raw.height, small_.rows, scale, y_taps_);
+
+    // The upscale is separable: each small row is widened once, in 1/256,
+    // and every output row then blends two of those full-width rows
+    size_t row_bytes = static_cast<size_t>(raw.width) * 3;
+    wide_.resize(row_bytes * small_.rows);
+    for (int sy = 0; sy < small_.rows; ++sy) {
+        const uint8_t* s = small_.ptr<uint8_t>(sy);
+        uint16_t* wide = &wide_[sy * row_bytes];
+        for (int x = 0; x < raw.width; ++x) {
+            const Tap& tx = x_taps_[x];
+            int l = tx.first * 3, r = tx.second * 3;
+            for (int c = 0; c < 3; ++c) {
+                wide[x * 3 + c] = static_cast<uint16_t>(s[l + c] * (256 - tx.weight) + s[r + c] * tx.weight);
+            }
+        }
+    }
+
+    // Each output row in runs of like blocks: sharp runs are copied from
+    // `raw`, background runs blended, so every pixel is written once
+    int cols = (raw.width + RoiMap::BLOCK - 1) / RoiMap::BLOCK;
+    for (int y = 0; y < raw.height; ++y) {
+        const uint8_t* row_blocks = &blocks_[(y / RoiMap::BLOCK) * cols];
+        const Tap& ty = y_taps_[y];
+        const uint16_t* top = &wide_[ty.first * row_bytes];
+        const uint16_t* bottom = &wide_[ty.second * row_bytes];
+        const uint8_t* sharp = src.ptr<uint8_t>(y);
+        uint8_t* dst = coarse_.ptr<uint8_t>(y);
+        for (int bx = 0; bx < cols;) {
+            uint8_t keep = row_blocks[bx];
+            int run_end = bx + 1;
+            while (run_end < cols && row_blocks[run_end] == keep) ++run_end;
+            size_t x0 = static_cast<size_t>(bx) * RoiMap::BLOCK * 3;
+            size_t x1 = static_cast<size_t>(std::min(run_end * RoiMap::BLOCK, raw.width)) * 3;
+            if (keep) {
+                memcpy(dst + x0, sharp + x0, x1 - x0);
+            } else {
+                blend_rows(top + x0, bottom + x0, ty.weight, x1 - x0, dst + x0);
+            }
+            bx = run_end;
+        }
+    }
+
+    stride = coarse_.step;
+    return coarse_.data;
+}
@@ -0,0 +1,89 @@
+#ifndef NLX_VIDEO_ROI_H
+#define NLX_VIDEO_ROI_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "frame_pool.h"
+
+// Region-of-interest encoding: the regions that matter stay sharp while the
+// rest of the frame costs few bytes. A JPEG has one set of quantization
+// tables per image and libjpeg offers no per-block scaling, so the
+// background is coarsened instead: scaled down and back up before encoding,
+// which leaves its 8x8 blocks with little high-frequency content to spend
+// bytes on. Regions are whole 16x16 blocks (a 4:2:0 MCU), so their pixels
+// reach the encoder untouched.
+
+// Rectangle in the camera's stream resolution
+struct RoiRect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Parses "<x>:<y>:<W>x<H>"; false if malformed
+bool parse_roi_rect(const std::string& text, RoiRect& rect);
+
+// A camera's regions: fixed rectangles and, optionally, the blocks where the
+// picture moves. Shared by the encoder threads, which may run frames of one
+// camera concurrently; the motion state is locked.
+class RoiMap {
+public:
+    static const int BLOCK = 16;
+
+    // `width` x `height` is the stream resolution the rectangles refer to;
+    // frames of another size (snapshots) get the rectangles scaled.
+    // `background_scale` is how far the background is scaled down.
+    RoiMap(const std::vector<RoiRect>& rects, bool motion, int background_scale, int width, int height);
+
+    int background_scale() const { return scale_; }
+
+    // Sets blocks[row * cols + col] to 1 for each block of this frame to
+    // keep sharp. `thumb` is caller scratch for the motion comparison.
+    void mark_blocks(const FrameBuffer& raw, std::vector<uint8_t>& blocks, cv::Mat& thumb);
+
+private:
+    RoiMap(const RoiMap&);
+    RoiMap& operator=(const RoiMap&);
+
+    std::vector<RoiRect> rects_;
+    bool motion_;
+    int scale_;
+    int width_;
+    int height_;
+
+    std::mutex mutex_;
+    cv::Mat previous_;          // Block means of the last frame
+    std::vector<uint8_t> hold_; // Frames each block stays sharp after it last moved
+};
+
+// Per encoder thread: builds the image to encode. Scratch images are reused,
+// so only a resolution change allocates.
+class RoiCoarsener {
+public:
+    // Bilinear source of one output column or row
+    struct Tap {
+        int first;
+        int second;
+        int weight; // Of `second`, in 1/256
+    };
+
+    // Returns the pixels to encode (`stride` bytes per row): a scratch copy
+    // of `raw` with everything outside the map's blocks coarsened
+    const uint8_t* apply(const FrameBuffer& raw, RoiMap& map, size_t& stride);
+
+private:
+    cv::Mat small_;
+    std::vector<uint16_t> wide_; // small_ widened to full rows, in 1/256
+    cv::Mat coarse_;
+    cv::Mat thumb_;
+    std::vector<uint8_t> blocks_;
+    std::vector<Tap> x_taps_;
+    std::vector<Tap> y_taps_;
+};
+
+#endif
@@ -10,6 +10,7 @@
 #include <getopt.h>
 #include <stdexcept>
 #include <ctime>
+#include <cstdio>
 #include <fcntl.h>
 #include <termios.h>
 #include <signal.h>
@@ -17,118 +18,882 @@
 #include <netinet/tcp.h>
 #include <poll.h>
 #include <chrono>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sstream>
+
+#include "log.h"
+#include "alloc_check.h"
+#include "frame_pool.h"
+#include "jpeg_encoder.h"
+#include "jpeg_crop.h"
+#include "qoi_codec.h"
+#include "delta_codec.h"
+#include "capture.h"
+#include "mosaic.h"
+#include "frame_ring.h"
+#include "relay.h"
+#include "clock.h"
+#include "socket_activation.h"
+#include "rt_profile.h"
+#include "tls.h"
+#include "token_bucket.h"
 
 // Global state
 std::atomic<bool> running(true);
-int current_client = -1; // Single client socket
 
-// Get current timestamp
-std::string get_timestamp() {
-    std::time_t now = std::time(nullptr);
-    std::string ts = std::ctime(&now);
-    ts.pop_back();
-    return ts;
-}
+// What viewers get while the camera is being recovered
+enum LostMode {
+    LOST_REPEAT, // Resend the last frame
+    LOST_MARKER, // Send an empty (size 0) frame as a "source lost" marker
+    LOST_NONE,   // Send nothing; the connection just goes quiet
+};
+static const int LOST_RESEND_MS = 500;
+static const int TLS_HANDSHAKE_MS = 5000;
+static const int REQUEST_MS = 200;
 
-// Handle serial communication
-void handle_serial(int serial_fd, std::atomic<bool>& snapshot_signal) {
+// Handle serial communication; a snapshot request goes to every camera
+void handle_serial(int serial_fd, const std::vector<std::atomic<bool>*>& snapshot_signals) {
+    rt_profile_apply("serial");
     char buffer[1];
     while (running) {
         ssize_t bytes_read = read(serial_fd, buffer, 1);
         if (bytes_read > 0) {
             unsigned char byte = buffer[0];
-            std::cout << "[" << get_timestamp() << "] Serial received byte: " << (int)byte 
-                      << " (char: " << (isprint(byte) ? std::string(1, byte) : "non-printable") << ")\n";
+            if (isprint(byte)) {
+                LOG_DEBUG("Serial received byte: %d (char: %c)", (int)byte, byte);
+            } else {
+                LOG_DEBUG("Serial received byte: %d (char: non-printable)", (int)byte);
+            }
             if (byte == 'S') {
-                snapshot_signal = true;
-                std::cout << "[" << get_timestamp() << "] Snapshot signal received\n";
+                for (size_t i = 0; i < snapshot_signals.size(); ++i) *snapshot_signals[i] = true;
+                LOG_INFO("Snapshot signal received");
             }
         } else if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            std::cerr << "[" << get_timestamp() << "] Serial read error: " << strerror(errno) << "\n";
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Serial read error: %s", strerror(errno));
         }
     }
 }
 
-// Handle single client
-void handle_client(int client_socket, cv::VideoCapture& cap, std::atomic<bool>& snapshot_signal,
-                  int width, int height, int snapw, int snaph) {
-    // Enable TCP_NODELAY
-    int flag = 1;
-    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+struct ClientSlot {
+    int fd;
+    std::atomic<bool> evicted;
 
-    // Pre-allocate buffer
-    std::vector<uchar> buffer(100000);
-    std::vector<int> encode_params = {cv::IMWRITE_JPEG_QUALITY, 70};
-
-    try {
-        while (running && client_socket == current_client) {
-            cv::Mat frame;
-            if (snapshot_signal) {
-                // Measure time for setting snapshot resolution
-                auto start = std::chrono::high_resolution_clock::now();
-                cap.set(cv::CAP_PROP_FRAME_WIDTH, snapw);
-                cap.set(cv::CAP_PROP_FRAME_HEIGHT, snaph);
-                auto end = std::chrono::high_resolution_clock::now();
-                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-                std::cout << "[" << get_timestamp() << "] cap.set (snapshot resolution) time: " << duration << " us\n";
-
-                start = std::chrono::high_resolution_clock::now();
-                if (!cap.read(frame) || frame.empty()) {
-                    std::cerr << "[" << get_timestamp() << "] Failed to capture snapshot\n";
-                    break;
-                }
-                end = std::chrono::high_resolution_clock::now();
-                duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-                std::cout << "[" << get_timestamp() << "] cap.read (snapshot) time: " << duration << " us\n";
-
-                // Measure time for reverting to default resolution
-                start = std::chrono::high_resolution_clock::now();
-                cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
-                cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
-                end = std::chrono::high_resolution_clock::now();
-                duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-                std::cout << "[" << get_timestamp() << "] cap.set (revert resolution) time: " << duration << " us\n";
-
-                snapshot_signal = false;
-            } else {
-                if (!cap.read(frame) || frame.empty()) {
-                    std::cerr << "[" << get_timestamp() << "] Failed to capture frame\n";
-                    break;
-                }
+    explicit ClientSlot(int fd) : fd(fd), evicted(false) {}
+};
+
+// Connected viewers. When full, a new connection replaces the oldest one,
+// which with the default limit of 1 keeps the original single-client behaviour.
+class ClientList {
+public:
+    explicit ClientList(size_t max_clients) : max_clients_(max_clients) {}
+
+    std::shared_ptr<ClientSlot> add(int fd) {
+        std::shared_ptr<ClientSlot> slot = std::make_shared<ClientSlot>(fd);
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!slots_.empty() && slots_.size() >= max_clients_) {
+            evict(slots_.front());
+            slots_.erase(slots_.begin());
+            LOG_INFO("Closed previous client");
+        }
+        slots_.push_back(slot);
+        return slot;
+    }
+
+    void remove(const std::shared_ptr<ClientSlot>& slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            if (slots_[i] == slot) {
+                slots_.erase(slots_.begin() + i);
+                break;
             }
+        }
+    }
+
+    void evict_all() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < slots_.size(); ++i) evict(slots_[i]);
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return slots_.size();
+    }
+
+private:
+    // Wakes the owning thread out of a blocking send; it closes the fd itself
+    static void evict(const std::shared_ptr<ClientSlot>& slot) {
+        slot->evicted = true;
+        shutdown(slot->fd, SHUT_RDWR);
+    }
+
+    std::mutex mutex_;
+    size_t max_clients_;
+    std::vector<std::shared_ptr<ClientSlot> > slots_;
+};
+
+// Response times of pull requests, from the request line to the answer sent
+class PullStats {
+public:
+    PullStats() : requests_(0), timeouts_(0), total_us_(0), max_us_(0) {}
+
+    void record(uint64_t us, bool answered) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++requests_;
+        if (!answered) ++timeouts_;
+        total_us_ += us;
+        if (us > max_us_) max_us_ = us;
+    }
+
+    void get(uint64_t& requests, uint64_t& timeouts, uint64_t& mean_us, uint64_t& max_us) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests = requests_;
+        timeouts = timeouts_;
+        mean_us = requests_ ? total_us_ / requests_ : 0;
+        max_us = max_us_;
+    }
+
+private:
+    std::mutex mutex_;
+    uint64_t requests_;
+    uint64_t timeouts_; // Answered with the size-0 marker
+    uint64_t total_us_;
+    uint64_t max_us_;
+};
+
+// One capture device, the mosaic of several, or a relayed upstream stream,
+// and everything serving it
+struct Camera {
+    size_t index;
+    CaptureConfig config;
+    int port;      // Dedicated listener for this camera alone; 0 for the shared port only
+    int listen_fd;
+    FrameSource source;
+    FrameChannel channel;
+    ClientList clients;
+    PullStats pull_stats;
+    std::atomic<uint64_t> send_skipped; // Frames passed over while a client's socket was behind
+    std::atomic<bool> snapshot;
+    std::thread thread;
+    std::unique_ptr<MosaicCompositor> mosaic; // Set for the overview, which has no device
+    std::unique_ptr<RelayUpstream> relay;     // Set for a relay, which has JPEG frames only
+    size_t history; // Encoded frames kept for "DROP queue" viewers
+
+    Camera(size_t index, const CaptureConfig& config, int port, size_t max_clients)
+        : index(index), config(config), port(port), listen_fd(-1), clients(max_clients), send_skipped(0),
+          snapshot(false), history(0) {}
+};
+
+typedef std::vector<std::unique_ptr<Camera> > CameraList;
+
+// Parses --camera <device>[,size=<W>x<H>][,fps=<n>][,port=<n>][,history=<n>]
+// [,roi=<x>:<y>:<W>x<H>|motion]...[,roi-scale=<n>]; fields left out keep the
+// values from `base` (--width, --height, --fps). A device
+// "tcp://<host>:<port>[/<channel>]" relays another server.
+Camera* parse_camera(const std::string& spec, size_t index, const CaptureConfig& base, size_t max_clients) {
+    CaptureConfig config = base;
+    int port = 0, history = 0;
+    std::vector<RoiRect> roi_rects;
+    bool roi_motion = false;
+    int roi_scale = 4;
+    std::stringstream ss(spec);
+    std::string item;
+    std::getline(ss, config.device, ',');
+    if (config.device.empty()) throw std::invalid_argument(spec);
+    RoiRect rect;
+    while (std::getline(ss, item, ',')) {
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq), value = eq == std::string::npos ? "" : item.substr(eq + 1);
+        if (key == "size" && sscanf(value.c_str(), "%dx%d", &config.width, &config.height) == 2) continue;
+        else if (key == "fps") config.fps = std::stoi(value);
+        else if (key == "port") port = std::stoi(value);
+        else if (key == "history") history = std::stoi(value);
+        else if (key == "roi" && value == "motion") roi_motion = true;
+        else if (key == "roi" && parse_roi_rect(value, rect) && roi_rects.size() < 16) roi_rects.push_back(rect);
+        else if (key == "roi-scale") roi_scale = std::stoi(value);
+        else throw std::invalid_argument(spec);
+    }
+    if (config.width <= 0 || config.height <= 0 || config.fps <= 0 || history < 0 || history > 64 ||
+        roi_scale < 2 || roi_scale > 16) {
+        throw std::invalid_argument(spec);
+    }
+    if (!roi_rects.empty() || roi_motion) {
+        config.roi = std::make_shared<RoiMap>(roi_rects, roi_motion, roi_scale, config.width, config.height);
+    }
+    std::unique_ptr<Camera> camera(new Camera(index, config, port, max_clients));
+    camera->history = static_cast<size_t>(history);
+    RelayUpstream upstream;
+    if (parse_relay(config.device, upstream)) {
+        // A relay passes the upstream's JPEG on; there is nothing to coarsen
+        if (config.roi) throw std::invalid_argument(spec);
+        camera->relay.reset(new RelayUpstream(upstream));
+    }
+    return camera.release();
+}
+
+// Parses --mosaic <cols>x<rows>[,size=<W>x<H>][,fps=<n>][,port=<n>], the
+// same options as a camera; the output size defaults to --width x --height
+Camera* parse_mosaic(const std::string& spec, size_t index, const CaptureConfig& base, size_t max_clients) {
+    std::unique_ptr<Camera> camera(parse_camera(spec, index, base, max_clients));
+    int cols, rows;
+    char extra;
+    if (sscanf(camera->config.device.c_str(), "%dx%d%c", &cols, &rows, &extra) != 2 || cols < 1 || rows < 1 ||
+        cols * rows > 16 || camera->config.width < cols || camera->config.height < rows) {
+        throw std::invalid_argument(spec);
+    }
+    camera->config.device = "mosaic";
+    camera->mosaic.reset(new MosaicCompositor(cols, rows, camera->config.width, camera->config.height));
+    return camera.release();
+}
+
+// Settings shared by every client thread
+struct ClientOptions {
+    LostMode lost_mode;
+    const TlsServer* tls;
+    FramePool* jpeg_pool; // Variant frames come from the shared JPEG pool
+    int pool_wait_ms;
+    size_t max_variants;  // Distinct variants per camera with subscribers
+    int pull_timeout_ms;  // Longest a pull request waits for a frame
+    int send_lowat;       // TCP_NOTSENT_LOWAT, and the unsent bytes a frame may start behind; 0: off
+    int sndbuf;           // SO_SNDBUF; 0 leaves the kernel's autotuning
+    int keyframe_interval; // Frames per keyframe of a "CODEC delta" stream
+    bool raw_frames;       // Raw frames to encode variants from; workers only get the encoded stream
+};
+
+// What a push client loses when it cannot keep up
+enum DropPolicy {
+    DROP_LATEST, // Skip to the newest frame
+    DROP_QUEUE,  // Every frame in order, from the camera's history; the oldest go when it overflows
+    DROP_CLOSE,  // Every frame in order, or the connection is closed
+};
+
+// What a client asked for; zero fields mean "as the camera streams anyway"
+struct StreamRequest {
+    int channel;
+    VariantKey variant;
+    int fps;      // Frames per second the client needs at most
+    int max_kbps; // Send-rate cap in kbit/s
+    bool pull;    // Frames only on request
+    DropPolicy drop;
+    int crop_x;   // One lossless crop of the last snapshot instead of a stream; crop_w 0 for none
+    int crop_y;
+    int crop_w;
+    int crop_h;
+};
+
+// Reads one line, a byte at a time so nothing past the newline is consumed,
+// for at most timeout_ms. Returns its length (what arrived in time, if the
+// wait expired), or -1 once the peer is gone.
+int read_line(int fd, char* line, size_t size, int timeout_ms) {
+    size_t len = 0;
+    uint64_t deadline = monotonic_ns() + timeout_ms * 1000000ull;
+    while (len < size - 1) {
+        uint64_t now = monotonic_ns();
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (now >= deadline || poll(&pfd, 1, static_cast<int>((deadline - now) / 1000000) + 1) <= 0) break;
+        if (recv(fd, line + len, 1, 0) != 1) return -1;
+        if (line[len] == '\n') break;
+        if (line[len] != '\r') ++len;
+    }
+    line[len] = '\0';
+    return static_cast<int>(len);
+}
+
+// Applies the space-separated fields of a request line on top of `request`
+bool parse_fields(const char* line, StreamRequest& request) {
+    std::istringstream fields(line);
+    std::string field, value;
+    while (fields >> field) {
+        bool ok = static_cast<bool>(fields >> value);
+        char extra;
+        if (ok && field == "CHANNEL") {
+            ok = sscanf(value.c_str(), "%d%c", &request.channel, &extra) == 1 && request.channel >= 0;
+        } else if (ok && field == "SIZE") {
+            ok = sscanf(value.c_str(), "%dx%d%c", &request.variant.width, &request.variant.height, &extra) == 2;
+        } else if (ok && field == "QUALITY") {
+            ok = sscanf(value.c_str(), "%d%c", &request.variant.quality, &extra) == 1 &&
+                 request.variant.quality >= 1 && request.variant.quality <= 100;
+        } else if (ok && field == "CODEC") {
+            ok = value == "jpeg" || value == "qoi" || value == "delta";
+            request.variant.codec = value == "qoi" ? CODEC_QOI : value == "delta" ? CODEC_DELTA : CODEC_JPEG;
+        } else if (ok && field == "FPS") {
+            ok = sscanf(value.c_str(), "%d%c", &request.fps, &extra) == 1 && request.fps > 0;
+        } else if (ok && field == "MAXRATE") {
+            ok = sscanf(value.c_str(), "%d%c", &request.max_kbps, &extra) == 1 && request.max_kbps > 0;
+        } else if (ok && field == "MODE") {
+            ok = value == "pull" || value == "push";
+            request.pull = value == "pull";
+        } else if (ok && field == "DROP") {
+            ok = value == "latest" || value == "queue" || value == "close";
+            request.drop = value == "queue" ? DROP_QUEUE : value == "close" ? DROP_CLOSE : DROP_LATEST;
+        } else if (ok && field == "CROP") {
+            ok = sscanf(value.c_str(), "%d:%d:%dx%d%c", &request.crop_x, &request.crop_y, &request.crop_w,
+                        &request.crop_h, &extra) == 4 &&
+                 request.crop_x >= 0 && request.crop_y >= 0 && request.crop_w > 0 && request.crop_h > 0;
+        } else {
+            ok = false;
+        }
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Right after connecting (after the TLS handshake) a client may send one
+// request line of space-separated fields, all optional:
+//   CHANNEL <n>      camera, on the shared port (default: camera 0)
+//   SIZE <W>x<H>     scale down to this resolution
+//   QUALITY <1-100>  JPEG quality
+//   CODEC <codec>    "jpeg" (default); "qoi", lossless and larger, for
+//                    consumers that cannot tolerate compression artifacts;
+//                    or "delta", exact pixels as keyframes and LZ4-packed
+//                    differences, small while the scene is static (push
+//                    mode at the captured size only)
+//   FPS <n>          send at most this many frames per second
+//   MAXRATE <kbit/s> cap the send rate; frames are skipped to stay under it
+//   MODE pull        send frames only when asked, see pull_session()
+//   DROP <policy>    when behind: "latest" skips to the newest frame
+//                    (default), "queue" sends every frame the camera's
+//                    history still holds, "close" disconnects rather than
+//                    skip one
+//   CROP <x>:<y>:<W>x<H>  instead of a stream, one frame: this region of
+//                    the camera's last snapshot, see crop_session()
+// e.g. "CHANNEL 1 SIZE 320x240 QUALITY 50\n". A client that sends nothing
+// gets the default stream once the wait expires, so existing clients keep
+// working; an empty line skips the wait.
+bool read_request(int fd, StreamRequest& request) {
+    request.channel = -1;
+    request.variant.width = 0;
+    request.variant.height = 0;
+    request.variant.quality = 0;
+    request.variant.codec = CODEC_JPEG;
+    request.fps = 0;
+    request.max_kbps = 0;
+    request.pull = false;
+    request.drop = DROP_LATEST;
+    request.crop_x = request.crop_y = request.crop_w = request.crop_h = 0;
+
+    char line[128];
+    if (read_line(fd, line, sizeof(line), REQUEST_MS) < 0) return false;
+    if (!parse_fields(line, request)) {
+        LOG_ERROR("Invalid stream request \"%s\"", line);
+        return false;
+    }
+    return true;
+}
+
+// Fills in the camera's defaults. Variants only scale down, which keeps them
+// within the pooled buffer size. Returns true for the stream the encoders
+// produce anyway, which needs no variant.
+bool resolve_variant(VariantKey& key, const CaptureConfig& config) {
+    if (key.width == config.width && key.height == config.height) key.width = key.height = 0;
+    if (key.codec != CODEC_JPEG) key.quality = 0;
+    else if (key.quality == 0) key.quality = config.quality;
+    return key.width == 0 && key.quality == config.quality && key.codec == CODEC_JPEG;
+}
+
+bool valid_variant(const VariantKey& key, const CaptureConfig& config) {
+    return key.width == 0 ||
+           (key.width >= 16 && key.height >= 16 && key.width <= config.width && key.height <= config.height);
+}
+
+// Next frame of the stream a subscriber chose; `variant_encoder` is null for
+// the default stream
+FrameRef next_frame(FrameChannel& channel, const VariantKey& key, VariantEncoder* variant_encoder, uint64_t after,
+                    int timeout_ms = 100) {
+    if (!variant_encoder) return channel.wait_jpeg(after, timeout_ms);
+    return channel.wait_variant(key, after, timeout_ms, *variant_encoder);
+}
+
+// Next frame of a "CODEC delta" stream: the newest raw frame, encoded
+// against the viewer's keyframe into a pooled buffer
+FrameRef next_delta(FrameChannel& channel, DeltaEncoder& encoder, uint64_t after, const ClientOptions& options) {
+    FrameRef raw = channel.wait_raw(after, 100);
+    if (!raw || raw->format != FRAME_BGR) return FrameRef();
+    FrameRef out = options.jpeg_pool->acquire(options.pool_wait_ms);
+    if (!out) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "JPEG frame pool exhausted, dropping delta frame");
+        return FrameRef();
+    }
+    size_t size = encoder.encode(raw->data(), raw->width, raw->height, raw->stride, out->data(), out->capacity());
+    if (size == 0) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 1000, "Failed to encode %dx%d delta frame", raw->width, raw->height);
+        return FrameRef();
+    }
+    out->format = FRAME_DELTA;
+    out->size = size;
+    out->width = raw->width;
+    out->height = raw->height;
+    out->stride = 0;
+    out->seq = raw->seq;
+    out->pts_ns = raw->pts_ns;
+    return out;
+}
+
+// Write a 4-byte big-endian size followed by the JPEG, the wire and file format
+bool write_frame(int fd, const FrameBuffer& frame, bool is_socket) {
+    uint32_t size = htonl(frame.size);
+    struct iovec iov[2];
+    iov[0].iov_base = &size;
+    iov[0].iov_len = sizeof(size);
+    iov[1].iov_base = frame.data();
+    iov[1].iov_len = frame.size;
+    struct iovec* cur = iov;
+    int iovcnt = 2;
+    while (iovcnt > 0) {
+        ssize_t n;
+        if (is_socket) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = cur;
+            msg.msg_iovlen = iovcnt;
+            n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } else {
+            n = writev(fd, cur, iovcnt);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (iovcnt > 0 && static_cast<size_t>(n) >= cur->iov_len) {
+            n -= cur->iov_len;
+            ++cur;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            cur->iov_base = static_cast<uint8_t*>(cur->iov_base) + n;
+            cur->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// A zero size prefix with no payload: "source lost, frames will resume"
+bool write_lost_marker(int fd) {
+    uint32_t size = 0;
+    return send(fd, &size, sizeof(size), MSG_NOSIGNAL) == sizeof(size);
+}
+
+// True while more than `lowat` bytes of earlier frames have not left this
+// host yet. SIOCOUTQ counts the in-flight (sent, unacked) bytes as well,
+// which grow with the link's bandwidth-delay product, so gating on it would
+// cap the frame rate by the round trip; only the unsent part (SIOCOUTQNSD)
+// delays a new frame.
+bool send_queue_behind(int fd, int lowat, int* queued) {
+    int unsent = 0;
+    if (ioctl(fd, SIOCOUTQ, queued) < 0) *queued = 0;
+    if (ioctl(fd, SIOCOUTQNSD, &unsent) < 0) return false;
+    return unsent > lowat;
+}
+
+// Push mode: send the newest frame of `key` as it comes, within the client's
+// frame-rate and byte-rate limits. While the source is lost the session
+// stays open and the gap is bridged per lost_mode. The DROP policies other
+// than "latest" apply to the default stream at the camera's rate, where
+// every frame is meant to be sent.
+void stream_session(int client_socket, Camera& camera, const VariantKey& key, bool is_variant, int fps,
+                    int max_kbps, DropPolicy drop, const ClientOptions& options, ClientSlot& slot) {
+    FrameChannel& channel = camera.channel;
+    std::unique_ptr<VariantEncoder> variant_encoder;
+    // A delta stream is this viewer's own: its keyframe is the first frame
+    // the viewer got, so it is encoded here rather than shared as a variant
+    std::unique_ptr<DeltaEncoder> delta_encoder;
+    if (key.codec == CODEC_DELTA) {
+        delta_encoder.reset(new DeltaEncoder(options.keyframe_interval));
+    } else if (is_variant) {
+        if (!channel.subscribe(key, options.max_variants)) {
+            LOG_ERROR("Camera %zu already serves %zu variants", camera.index, options.max_variants);
+            return;
+        }
+        variant_encoder.reset(new VariantEncoder(*options.jpeg_pool, options.pool_wait_ms));
+    }
 
-            // Encode frame
-            cv::imencode(".jpg", frame, buffer, encode_params);
+    // The token bucket spaces whole frames; the kernel paces the packets of
+    // each frame to the same rate (TCP's internal pacing, or the fq qdisc),
+    // so a frame does not leave as a line-rate burst either
+    double rate = max_kbps * 125.0;
+    TokenBucket bucket(rate, rate / 10);
+    if (bucket.enabled()) {
+        unsigned int pacing_rate = static_cast<unsigned int>(rate);
+        setsockopt(client_socket, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing_rate, sizeof(pacing_rate));
+    }
+    const uint64_t frame_period_ns = fps ? 1000000000ull / fps : 0;
+    uint64_t next_due_ns = 0;
+    const bool in_order = drop != DROP_LATEST && !is_variant && !fps;
+
+    AllocCheck alloc_check("video send", 30, 300);
+    uint64_t last_seq = 0;
+    uint64_t published = 0;      // In-order viewers: publish count of the frame taken
+    uint64_t last_published = 0; // and of the one before
+    uint64_t last_sent_ns = 0;
+    bool behind = false;
+    int max_queued = 0;
+
+    while (running && !slot.evicted) {
+        // Wait until the frame rate and byte budget allow another frame, then
+        // take the newest one; a variant's skipped frames are never encoded
+        uint64_t now = monotonic_ns();
+        uint64_t wait_ns = std::max(next_due_ns > now ? next_due_ns - now : 0, bucket.wait_ns(now));
+        if (wait_ns > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<uint64_t>(wait_ns, 100000000ull)));
+            continue;
+        }
 
-            // Send frame size
-            uint32_t size = htonl(buffer.size());
-            if (send(client_socket, &size, sizeof(size), MSG_NOSIGNAL) < 0) {
-                std::cerr << "[" << get_timestamp() << "] Send failed (size)\n";
+        // Backpressure, checked before a variant is encoded: anything still
+        // unsent would only delay the next frame, so wait for the socket to
+        // drain (TCP_NOTSENT_LOWAT makes that POLLOUT) and send the newest
+        // frame then. The picture's age stays about one frame's transmit
+        // time, however fast or slow the link.
+        int queued = 0;
+        if (options.send_lowat > 0 && send_queue_behind(client_socket, options.send_lowat, &queued)) {
+            behind = true;
+            max_queued = std::max(max_queued, queued);
+            struct pollfd pfd = {client_socket, POLLOUT, 0};
+            poll(&pfd, 1, 100);
+            continue;
+        }
+
+        FrameRef frame;
+        if (delta_encoder) frame = next_delta(channel, *delta_encoder, last_seq, options);
+        else if (in_order) frame = channel.next_jpeg(last_seq, 100, &published);
+        else frame = next_frame(channel, key, variant_encoder.get(), last_seq);
+        if (!frame) {
+            if (options.lost_mode == LOST_NONE || !channel.source_lost() ||
+                monotonic_ns() - last_sent_ns < LOST_RESEND_MS * 1000000ull) {
+                continue;
+            }
+            bool sent = true;
+            if (options.lost_mode == LOST_MARKER) {
+                sent = write_lost_marker(client_socket);
+            } else {
+                // A delta viewer's frames are gone once sent; it gets nothing
+                FrameRef previous = delta_encoder     ? FrameRef()
+                                    : variant_encoder ? channel.latest_variant(key)
+                                                      : channel.latest_jpeg();
+                if (previous) {
+                    sent = write_frame(client_socket, *previous, true);
+                    bucket.consume(sizeof(uint32_t) + previous->size, monotonic_ns());
+                }
+            }
+            if (!sent) {
+                if (!slot.evicted) LOG_ERROR("Send failed: %s", strerror(errno));
+                break;
+            }
+            last_sent_ns = monotonic_ns();
+            continue;
+        }
+        uint64_t gap = last_seq != 0 && frame->seq > last_seq + 1 ? frame->seq - last_seq - 1 : 0;
+        if (in_order) {
+            // Capture numbers also skip frames the server dropped itself
+            // (full encode queue or pool), which this viewer never missed;
+            // its losses are gaps in what the channel published
+            gap = last_published != 0 && published > last_published + 1 ? published - last_published - 1 : 0;
+            last_published = published;
+        }
+        if (in_order && gap) {
+            // Fell behind by more than the history holds
+            camera.send_skipped += gap;
+            if (drop == DROP_CLOSE) {
+                LOG_INFO("Client on camera %zu missed %llu frames, closing (DROP close)", camera.index,
+                         static_cast<unsigned long long>(gap));
                 break;
             }
+            LOG_EVERY_MS(LOG_LEVEL_INFO, 10000, "Client on camera %zu lost %llu frames past the history",
+                         camera.index, static_cast<unsigned long long>(gap));
+        } else if (behind) {
+            camera.send_skipped += gap;
+            LOG_EVERY_MS(LOG_LEVEL_INFO, 10000, "Client on camera %zu behind, %d bytes queued; skipping frames",
+                         camera.index, max_queued);
+        }
+        behind = false;
+        max_queued = 0;
+        last_seq = frame->seq;
+
+        if (!write_frame(client_socket, *frame, true)) {
+            if (!slot.evicted) LOG_ERROR("Send failed: %s", strerror(errno));
+            break;
+        }
+        last_sent_ns = monotonic_ns();
+        bucket.consume(sizeof(uint32_t) + frame->size, last_sent_ns);
+        if (frame_period_ns) {
+            // Fell behind (slow link, lost source): restart the schedule
+            // rather than catch up with a burst
+            next_due_ns = last_sent_ns > next_due_ns + frame_period_ns ? last_sent_ns + frame_period_ns
+                                                                       : next_due_ns + frame_period_ns;
+        }
+        alloc_check.iteration();
+    }
+
+    if (variant_encoder) channel.unsubscribe(key);
+}
+
+// Pull mode ("MODE pull"): the client sends a line per frame it wants,
+// "GET", optionally followed by SIZE and QUALITY for that frame alone, and
+// gets the newest frame: from the channel's cache when someone encoded it
+// already, otherwise encoded on the spot. A request the source cannot meet
+// within options.pull_timeout_ms (lost, or no frame yet) is answered with the
+// size-0 marker instead, so every answer arrives within that bound. The
+// session stays a consumer meanwhile (at its FPS, if given) so a current
+// frame is always at hand.
+void pull_session(int client_socket, Camera& camera, const StreamRequest& request, const ClientOptions& options,
+                  ClientSlot& slot) {
+    FrameChannel& channel = camera.channel;
+    VariantKey key = request.variant;
+    bool subscribed = false;
+    std::unique_ptr<VariantEncoder> variant_encoder;
+    char line[128];
+
+    while (running && !slot.evicted) {
+        struct pollfd pfd = {client_socket, POLLIN, 0};
+        int ready = poll(&pfd, 1, 100);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+        if (ready < 0 || read_line(client_socket, line, sizeof(line), REQUEST_MS) < 0) break;
+        uint64_t start_ns = monotonic_ns();
 
-            // Send frame data
-            if (send(client_socket, buffer.data(), buffer.size(), MSG_NOSIGNAL) < 0) {
-                std::cerr << "[" << get_timestamp() << "] Send failed (data)\n";
+        StreamRequest get = request;
+        if (strncmp(line, "GET", 3) != 0 || (line[3] != '\0' && line[3] != ' ') || !parse_fields(line + 3, get)) {
+            LOG_ERROR("Invalid pull request \"%s\"", line);
+            break;
+        }
+        VariantKey wanted = get.variant;
+        bool is_variant = !resolve_variant(wanted, camera.config);
+        if (!valid_variant(wanted, camera.config)) {
+            LOG_ERROR("Invalid size %dx%d for camera %zu", wanted.width, wanted.height, camera.index);
+            break;
+        }
+        if (is_variant && camera.relay) {
+            LOG_ERROR("Camera %zu relays its upstream unchanged, no SIZE/QUALITY/CODEC variants", camera.index);
+            break;
+        }
+        if (is_variant && !options.raw_frames) {
+            LOG_ERROR("Workers serve the encoded streams only, no SIZE/QUALITY/CODEC variants");
+            break;
+        }
+        if (wanted.codec == CODEC_DELTA) {
+            LOG_ERROR("CODEC delta streams the captured size in push mode only");
+            break;
+        }
+        // The subscription follows the last variant asked for, so repeated
+        // requests of one variant share its cache with everyone else's
+        if (subscribed && !(wanted == key)) {
+            channel.unsubscribe(key);
+            subscribed = false;
+        }
+        key = wanted;
+        if (is_variant && !subscribed) {
+            if (!channel.subscribe(key, options.max_variants)) {
+                LOG_ERROR("Camera %zu already serves %zu variants", camera.index, options.max_variants);
                 break;
             }
+            subscribed = true;
+            if (!variant_encoder) variant_encoder.reset(new VariantEncoder(*options.jpeg_pool, options.pool_wait_ms));
         }
-    } catch (const std::exception& e) {
-        std::cerr << "[" << get_timestamp() << "] Client thread exception: " << e.what() << "\n";
+
+        FrameRef frame;
+        if (!channel.source_lost()) {
+            FrameRef raw = channel.latest_raw();
+            uint64_t after = raw ? raw->seq - 1 : 0;
+            frame = next_frame(channel, key, is_variant ? variant_encoder.get() : nullptr, after,
+                               options.pull_timeout_ms);
+        }
+        bool sent = frame ? write_frame(client_socket, *frame, true) : write_lost_marker(client_socket);
+        camera.pull_stats.record((monotonic_ns() - start_ns) / 1000, static_cast<bool>(frame));
+        if (!sent) {
+            if (!slot.evicted) LOG_ERROR("Send failed: %s", strerror(errno));
+            break;
+        }
+    }
+
+    if (subscribed) channel.unsubscribe(key);
+}
+
+// "CROP": answers with one frame, the requested region of the camera's last
+// snapshot (its newest frame if it has taken none), and returns. The crop is
+// lossless and done on the JPEG's coefficients (jpeg_crop.h), so it takes
+// milliseconds even for a full-sensor snapshot and loses nothing to a second
+// encode. Its corner snaps to the MCU grid; the answer's header has the
+// actual size. An empty answer (size 0) means there was nothing to crop.
+// Workers get the stream through the ring but no snapshots, so they answer
+// empty rather than crop the low-resolution stream.
+void crop_session(int client_socket, Camera& camera, const StreamRequest& request, const ClientOptions& options) {
+    uint64_t start_ns = monotonic_ns();
+    if (!options.raw_frames) {
+        LOG_ERROR("Cannot crop from camera %zu: workers keep no snapshots, run without --workers", camera.index);
+        write_lost_marker(client_socket);
+        return;
     }
+    FrameRef source = camera.channel.latest_snapshot();
+    bool snapshot = static_cast<bool>(source);
+    if (!source) source = camera.channel.latest_jpeg();
+    FrameRef out = source ? options.jpeg_pool->acquire(options.pool_wait_ms) : FrameRef();
 
-    if (client_socket == current_client) {
-        current_client = -1;
+    int x = request.crop_x, y = request.crop_y, width = request.crop_w, height = request.crop_h;
+    size_t size = 0;
+    if (out && source->format == FRAME_JPEG) {
+        JpegCropper cropper;
+        size = cropper.crop(source->data(), source->size, x, y, width, height, out->data(), out->capacity());
+    }
+    if (size == 0) {
+        LOG_ERROR("Cannot crop %dx%d+%d+%d from camera %zu%s", request.crop_w, request.crop_h, request.crop_x,
+                  request.crop_y, camera.index, source ? "" : ": no frame yet");
+        write_lost_marker(client_socket);
+        return;
     }
+    out->format = FRAME_JPEG;
+    out->size = size;
+    out->width = width;
+    out->height = height;
+    out->stride = 0;
+    out->seq = source->seq;
+    out->pts_ns = source->pts_ns;
+    if (!write_frame(client_socket, *out, true)) {
+        LOG_ERROR("Send failed: %s", strerror(errno));
+        return;
+    }
+    LOG_INFO("Cropped %dx%d+%d+%d from the %dx%d %s of camera %zu in %.2f ms", width, height, x, y, source->width,
+             source->height, snapshot ? "snapshot" : "frame", camera.index, (monotonic_ns() - start_ns) / 1e6);
+}
+
+// Serve one client until it goes away. `camera` is null for the shared port,
+// where the client selects one.
+void handle_client(int client_socket, Camera* camera, CameraList& cameras, const ClientOptions& options) {
+    rt_profile_apply("client");
+
+    // Enable TCP_NODELAY
+    int flag = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    // After the handshake the kernel encrypts and decrypts, so the stream
+    // request and write_frame are unchanged
+    std::string tls_error;
+    if (options.tls && !options.tls->accept(client_socket, TLS_HANDSHAKE_MS, tls_error)) {
+        LOG_ERROR("TLS: %s", tls_error.c_str());
+        close(client_socket);
+        return;
+    }
+    StreamRequest request;
+    if (!read_request(client_socket, request)) {
+        close(client_socket);
+        return;
+    }
+    if (!camera) {
+        if (request.channel >= static_cast<int>(cameras.size())) {
+            LOG_ERROR("Invalid channel %d", request.channel);
+            close(client_socket);
+            return;
+        }
+        camera = cameras[request.channel < 0 ? 0 : request.channel].get();
+    }
+    if (request.crop_w > 0) {
+        crop_session(client_socket, *camera, request, options);
+        close(client_socket);
+        return;
+    }
+    VariantKey key = request.variant;
+    bool is_variant = !resolve_variant(key, camera->config);
+    if (!valid_variant(key, camera->config)) {
+        LOG_ERROR("Invalid size %dx%d for camera %zu", key.width, key.height, camera->index);
+        close(client_socket);
+        return;
+    }
+    if (is_variant && camera->relay) {
+        LOG_ERROR("Camera %zu relays its upstream unchanged, no SIZE/QUALITY/CODEC variants", camera->index);
+        close(client_socket);
+        return;
+    }
+    if (is_variant && !options.raw_frames) {
+        LOG_ERROR("Workers serve the encoded streams only, no SIZE/QUALITY/CODEC variants");
+        close(client_socket);
+        return;
+    }
+    if (request.drop != DROP_LATEST && !options.raw_frames) {
+        // The ring passes workers the newest frame only, without a history
+        LOG_ERROR("Workers cannot serve every frame in order, no DROP queue/close");
+        close(client_socket);
+        return;
+    }
+    if (key.codec == CODEC_DELTA && (key.width != 0 || request.pull)) {
+        LOG_ERROR("CODEC delta streams the captured size in push mode only");
+        close(client_socket);
+        return;
+    }
+    // A rate at or above the camera's is no limit
+    int fps = request.fps < camera->config.fps ? request.fps : 0;
+    static const char* const drop_names[] = {"latest", "queue", "close"};
+    char codec[8];
+    if (key.codec == CODEC_QOI) snprintf(codec, sizeof(codec), "qoi");
+    else if (key.codec == CODEC_DELTA) snprintf(codec, sizeof(codec), "delta");
+    else snprintf(codec, sizeof(codec), "q%d", key.quality);
+    LOG_INFO("Client on camera %zu (%s), %s %dx%d %s, %d fps, %d kbit/s, drop %s", camera->index,
+             camera->config.device.c_str(), request.pull ? "pull" : "push",
+             key.width ? key.width : camera->config.width, key.width ? key.height : camera->config.height,
+             codec, fps ? fps : camera->config.fps, request.max_kbps, drop_names[request.drop]);
+
+    // A stalled viewer must not hold pooled frames forever
+    struct timeval timeout = {2, 0};
+    setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    // Keep the kernel from buffering seconds of video: POLLOUT only once the
+    // unsent bytes drop below the low-water mark, and optionally a send
+    // buffer sized for a few frames rather than autotuned to megabytes
+    if (options.send_lowat > 0) {
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &options.send_lowat, sizeof(options.send_lowat));
+    }
+    if (options.sndbuf > 0) {
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDBUF, &options.sndbuf, sizeof(options.sndbuf));
+    }
+
+    ClientList& clients = camera->clients;
+    std::shared_ptr<ClientSlot> slot = clients.add(client_socket);
+    camera->channel.add_consumer(fps);
+
+    if (request.pull) pull_session(client_socket, *camera, request, options, *slot);
+    else stream_session(client_socket, *camera, key, is_variant, fps, request.max_kbps, request.drop, options, *slot);
+
+    camera->channel.remove_consumer(fps);
+    clients.remove(slot);
     close(client_socket);
-    std::cout << "[" << get_timestamp() << "] Client disconnected\n";
+    LOG_INFO("Client disconnected");
+}
+
+// Append every encoded frame to a file, as one more holder of pooled frames.
+// A `key` other than the default stream is subscribed to as a variant.
+void record_loop(int fd, FrameChannel& channel, VariantKey key, bool is_variant, FramePool& jpeg_pool,
+                 int pool_wait_ms) {
+    rt_profile_apply("record");
+    channel.add_consumer();
+    std::unique_ptr<VariantEncoder> variant_encoder;
+    if (is_variant) variant_encoder.reset(new VariantEncoder(jpeg_pool, pool_wait_ms));
+    uint64_t last_seq = 0, written = 0, skipped = 0;
+
+    while (running) {
+        FrameRef frame = next_frame(channel, key, variant_encoder.get(), last_seq);
+        if (!frame) continue;
+        if (last_seq != 0 && frame->seq > last_seq + 1) skipped += frame->seq - last_seq - 1;
+        last_seq = frame->seq;
+        if (!write_frame(fd, *frame, false)) {
+            LOG_ERROR("Recording write failed: %s", strerror(errno));
+            break;
+        }
+        ++written;
+    }
+
+    channel.remove_consumer();
+    if (is_variant) channel.unsubscribe(key);
+    close(fd);
+    LOG_INFO("Recording stopped: %llu frames written, %llu skipped", (unsigned long long)written,
+             (unsigned long long)skipped);
 }
 
 // Initialize serial port
 int init_serial(const std::string& serial, int baudrate) {
     int fd = open(serial.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (fd < 0) {
-        std::cerr << "[" << get_timestamp() << "] Failed to open serial: " << serial << " (" << strerror(errno) << ")\n";
+        LOG_ERROR("Failed to open serial: %s (%s)", serial.c_str(), strerror(errno));
         return -1;
     }
 
@@ -137,7 +902,7 @@ int init_serial(const std::string& serial, int baudrate) {
 
     struct termios tty;
     if (tcgetattr(fd, &tty) != 0) {
-        std::cerr << "[" << get_timestamp() << "] Failed to get serial attributes: " << strerror(errno) << "\n";
+        LOG_ERROR("Failed to get serial attributes: %s", strerror(errno));
         close(fd);
         return -1;
     }
@@ -151,7 +916,7 @@ int init_serial(const std::string& serial, int baudrate) {
         case 57600: baud = B57600; break;
         case 115200: baud = B115200; break;
         default:
-            std::cerr << "[" << get_timestamp() << "] Unsupported baud rate: " << baudrate << "\n";
+            LOG_ERROR("Unsupported baud rate: %d", baudrate);
             close(fd);
             return -1;
     }
@@ -176,7 +941,7 @@ int init_serial(const std::string& serial, int baudrate) {
     tty.c_cc[VTIME] = 1;
 
     if (tcsetattr(fd, TCSANOW, &tty) != 0) {
-        std::cerr << "[" << get_timestamp() << "] Failed to set serial attributes: " << strerror(errno) << "\n";
+        LOG_ERROR("Failed to set serial attributes: %s", strerror(errno));
         close(fd);
         return -1;
     }
@@ -187,6 +952,92 @@ int init_serial(const std::string& serial, int baudrate) {
     return fd;
 }
 
+// Rewrite a key=value snapshot of the server's health counters. With several
+// cameras the per-camera keys get a camN_ prefix.
+void write_stats_file(const std::string& path, CameraList& cameras, const FramePool& raw_pool,
+                      const FramePool& jpeg_pool, const EncodeQueue& encoder) {
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        LOG_EVERY_MS(LOG_LEVEL_ERROR, 60000, "Cannot write stats file %s: %s", tmp.c_str(), strerror(errno));
+        return;
+    }
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        FrameChannel& channel = cameras[i]->channel;
+        RecoveryStats recovery = channel.recovery_stats();
+        std::string prefix = cameras.size() > 1 ? "cam" + std::to_string(i) + "_" : "";
+        const char* p = prefix.c_str();
+        fprintf(f, "%ssource_lost=%d\n", p, channel.source_lost() ? 1 : 0);
+        fprintf(f, "%srecoveries=%llu\n", p, static_cast<unsigned long long>(recovery.count));
+        fprintf(f, "%srecovery_last_ms=%llu\n", p, static_cast<unsigned long long>(recovery.last_ms));
+        fprintf(f, "%srecovery_max_ms=%llu\n", p, static_cast<unsigned long long>(recovery.max_ms));
+        fprintf(f, "%srecovery_mean_ms=%llu\n", p,
+                static_cast<unsigned long long>(recovery.count ? recovery.total_ms / recovery.count : 0));
+        fprintf(f, "%sclients=%zu\n", p, cameras[i]->clients.size());
+        fprintf(f, "%ssend_skipped=%llu\n", p, static_cast<unsigned long long>(cameras[i]->send_skipped));
+        uint64_t pulls, pull_timeouts, pull_mean_us, pull_max_us;
+        cameras[i]->pull_stats.get(pulls, pull_timeouts, pull_mean_us, pull_max_us);
+        fprintf(f, "%spull_requests=%llu\n", p, static_cast<unsigned long long>(pulls));
+        fprintf(f, "%spull_timeouts=%llu\n", p, static_cast<unsigned long long>(pull_timeouts));
+        fprintf(f, "%spull_latency_mean_us=%llu\n", p, static_cast<unsigned long long>(pull_mean_us));
+        fprintf(f, "%spull_latency_max_us=%llu\n", p, static_cast<unsigned long long>(pull_max_us));
+    }
+    fprintf(f, "encode_dropped=%llu\n", static_cast<unsigned long long>(encoder.dropped()));
+    fprintf(f, "raw_pool_in_use=%zu\n", raw_pool.in_use());
+    fprintf(f, "jpeg_pool_in_use=%zu\n", jpeg_pool.in_use());
+    fclose(f);
+    rename(tmp.c_str(), path.c_str());
+}
+
+// Create a listening socket on host:port; with reuse_port every worker
+// process binds the same port and the kernel spreads connections over them
+int bind_listener(const std::string& host, int port, bool reuse_port = false) {
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (server_fd < 0) {
+        LOG_ERROR("Failed to create socket");
+        return -1;
+    }
+
+    int sock_opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
+    if (reuse_port) setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &sock_opt, sizeof(sock_opt));
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
+        LOG_ERROR("Invalid host: %s", host.c_str());
+        close(server_fd);
+        return -1;
+    }
+
+    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        LOG_ERROR("Bind failed");
+        close(server_fd);
+        return -1;
+    }
+
+    if (listen(server_fd, 1) < 0) {
+        LOG_ERROR("Listen failed");
+        close(server_fd);
+        return -1;
+    }
+    LOG_INFO("Server: %s:%d", host.c_str(), port);
+    return server_fd;
+}
+
+// Create the shared listening socket, unless systemd passed one in
+int open_listener(const std::string& host, int port, bool& activated) {
+    int server_fd = activated_listen_fd();
+    activated = server_fd >= 0;
+    if (activated) {
+        fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+        LOG_INFO("Server: socket-activated listener");
+        return server_fd;
+    }
+    return bind_listener(host, port);
+}
+
 // Signal handler
 void signal_handler(int sig) {
     running = false;
@@ -197,29 +1048,298 @@ void print_usage(const char* prog_name) {
     std::cerr << "Usage: " << prog_name 
               << " [options]\n"
               << "Options:\n"
-              << "  --device <device>    Video device (default: /dev/video8)\n"
+              << "  --device <device>    Video device, or \"synthetic\" for a test pattern (default: /dev/video8)\n"
               << "  --width <width>      Frame width (default: 320)\n"
               << "  --height <height>    Frame height (default: 240)\n"
               << "  --snaph <height>     Snapshot height (default: 480)\n"
               << "  --snapw <width>      Snapshot width (default: 640)\n"
               << "  --fps <fps>          Frames per second (default: 30)\n"
+              << "  --camera <spec>      Serve this camera; repeat for several. Replaces --device:\n"
+              << "                       <device>[,size=<W>x<H>][,fps=<n>][,port=<n>]. Clients on --port\n"
+              << "                       pick one by sending \"CHANNEL <n>\\n\" (default: camera 0); with\n"
+              << "                       port=<n> the camera also gets a listener of its own. A device\n"
+              << "                       tcp://<host>:<port>[/<channel>] relays another server's stream\n"
+              << "                       unchanged (size= must cover its resolution); history=<n> keeps\n"
+              << "                       n frames for viewers that ask for every one (\"DROP queue\")\n"
+              << "                       roi=<x>:<y>:<W>x<H> (repeatable) keeps a region sharp and coarsens\n"
+              << "                       the rest of the stream before encoding, for far fewer bytes;\n"
+              << "                       roi=motion keeps whatever moves sharp; roi-scale=<n> is how far\n"
+              << "                       the background is scaled down (2-16, default: 4)\n"
+              << "  --quality <q>        JPEG quality of the cameras' streams (default: 70)\n"
+              << "  --max-variants <n>   Other sizes/qualities a camera encodes at once for clients that ask\n"
+              << "                       with \"SIZE <W>x<H> QUALITY <q>\\n\" or lossless \"CODEC qoi\\n\"; each\n"
+              << "                       costs at most one encode per frame, shared by its viewers\n"
+              << "                       (default: 4)\n"
+              << "  --pull-timeout <ms>  Longest a client in pull mode (\"MODE pull\", then \"GET\\n\" per\n"
+              << "                       frame) waits for a frame before an empty answer (default: 500)\n"
+              << "  --mosaic <spec>      Also serve an overview of the cameras tiled into one frame, as the\n"
+              << "                       channel after the last camera: <cols>x<rows>[,size=<W>x<H>]\n"
+              << "                       [,fps=<n>][,port=<n>]. A stalled camera keeps its last tile\n"
+              << "  --encoders <n>       JPEG encoder threads shared by all cameras\n"
+              << "                       (default: one per camera, up to the CPU count)\n"
               << "  --host <host>        Host address (default: 0.0.0.0)\n"
               << "  --port <port>        Port number (default: 40917)\n"
               << "  --serial <serial>    Serial device (default: empty)\n"
               << "  --baudrate <baud>    Baud rate (default: 115200)\n"
-              << " _TS <baud>    Baud rate (default: 115200)\n"
+              << "  --max-clients <n>    Concurrent viewers per camera; a new one replaces the oldest (default: 1)\n"
+              << "  --workers <n>        Serve viewers from n processes sharing the port (SO_REUSEPORT), fed\n"
+              << "                       encoded frames through shared memory; this process only captures.\n"
+              << "                       No SIZE/QUALITY/CODEC variants, CROP or DROP queue/close then\n"
+              << "                       (default: 0, serve in-process)\n"
+              << "  --send-lowat <bytes> Start a frame only when a viewer's unsent data is below this, else\n"
+              << "                       skip to a newer frame (TCP_NOTSENT_LOWAT; default: 16384, 0: off)\n"
+              << "  --sndbuf <bytes>     Socket send buffer per viewer (default: 0, kernel autotuning)\n"
+              << "  --keyframe-interval <n>\n"
+              << "                       Frames per keyframe for viewers of \"CODEC delta\" (default: 60)\n"
+              << "  --record <file>      Append every encoded frame of camera 0 to a file (size-prefixed JPEG)\n"
+              << "  --record-quality <q> JPEG quality of the recording, encoded separately if it differs\n"
+              << "                       from --quality (default: --quality)\n"
+              << "  --pool-frames <n>    Buffers per camera in each of the raw and JPEG frame pools (default: 6)\n"
+              << "  --pool-wait <ms>     Wait for a free buffer before dropping a frame (default: 33)\n"
+              << "  --idle-fps <fps>     Keep the camera warm at this rate while nobody watches (default: 0, off)\n"
+              << "  --idle-timeout <s>   Release the camera after this long without viewers; when\n"
+              << "                       socket-activated, exit instead (default: 0, never)\n"
+              << "  --stall-timeout <ms> Treat the camera as lost after this long without a frame (default: 2000)\n"
+              << "  --on-source-lost <repeat|marker|none>\n"
+              << "                       While the camera recovers, resend the last frame or an empty\n"
+              << "                       \"source lost\" frame every 500 ms, or send nothing (default: repeat)\n"
+              << "  --stats-file <file>  Rewrite health counters (recoveries, pool use) here every 10 s\n"
+              << "  --rt-profile <spec>  Scheduling, CPU pinning and memory locking per thread role\n"
+              << "                       (capture, encode, mosaic, relay, client, serial, record, ring),\n"
+              << "                       e.g. capture=fifo:80@2,encode=fifo:70@2-3,client=rr:60@3,mlock\n"
+              << "  --tls-cert <pem>     Serve over TLS with this certificate chain; encryption runs in\n"
+              << "                       the kernel (kTLS, needs `modprobe tls`)\n"
+              << "  --tls-key <pem>      Private key for --tls-cert\n"
               << "  --help               Show this help\n";
 }
 
+// Accept one connection and hand it to a client thread; `camera` is null on
+// the shared port
+void accept_client(int listen_fd, Camera* camera, CameraList& cameras, const ClientOptions& options) {
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    int client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &client_len);
+    if (client_fd < 0) {
+        if (running) LOG_ERROR("Accept failed");
+        return;
+    }
+
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+    LOG_INFO("New client: %s", client_ip);
+
+    std::thread client_thread(handle_client, client_fd, camera, std::ref(cameras), std::cref(options));
+    client_thread.detach();
+}
+
+void install_signal_handlers() {
+    struct sigaction sa;
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+}
+
+// Listeners for the cameras that have a port of their own, added after
+// whatever `pfds` already polls
+bool add_camera_listeners(const std::string& host, CameraList& cameras, bool reuse_port,
+                          std::vector<struct pollfd>& pfds, std::vector<Camera*>& pfd_cameras) {
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        Camera& camera = *cameras[i];
+        if (camera.port == 0) continue;
+        camera.listen_fd = bind_listener(host, camera.port, reuse_port);
+        if (camera.listen_fd < 0) return false;
+        struct pollfd pfd = {camera.listen_fd, POLLIN, 0};
+        pfds.push_back(pfd);
+        pfd_cameras.push_back(&camera);
+    }
+    return true;
+}
+
+// Client threads are detached; give them a moment to let go of their frames
+void wait_for_clients(CameraList& cameras) {
+    for (int i = 0; i < 50; ++i) {
+        size_t connected = 0;
+        for (size_t j = 0; j < cameras.size(); ++j) connected += cameras[j]->clients.size();
+        if (connected == 0) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+// Capture process with --workers: copies one camera's encoded frames into
+// the ring, holding a consumer on its channel (at the rate they need) while
+// any worker has viewers for it
+void ring_write_loop(FrameRing& ring, size_t camera, FrameChannel& channel) {
+    rt_profile_apply("ring");
+    bool registered = false;
+    int registered_fps = 0;
+    uint64_t last_seq = 0;
+
+    while (running) {
+        int fps;
+        bool watched = ring.demand(camera, fps);
+        if (registered && (!watched || fps != registered_fps)) {
+            channel.remove_consumer(registered_fps);
+            registered = false;
+        }
+        if (watched && !registered) {
+            channel.add_consumer(fps);
+            registered = true;
+            registered_fps = fps;
+        }
+        ring.set_lost(camera, channel.source_lost());
+        if (!registered) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+
+        FrameRef jpeg = channel.wait_jpeg(last_seq, 100);
+        if (!jpeg) continue;
+        last_seq = jpeg->seq;
+        ring.write(camera, *jpeg);
+    }
+
+    if (registered) channel.remove_consumer(registered_fps);
+}
+
+// Worker process: mirrors one camera of the ring into the worker's own
+// channel, so the client sessions run unchanged, and reports its viewers
+void ring_read_loop(FrameRing& ring, size_t camera, int worker, FramePool& jpeg_pool, int pool_wait_ms,
+                    FrameChannel& channel) {
+    rt_profile_apply("ring");
+    uint64_t last_seq = 0;
+
+    while (running) {
+        ring.set_demand(worker, camera, channel.has_consumers() ? 1 : 0, channel.demand_fps());
+        if (!channel.has_consumers()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+        if (ring.lost(camera)) channel.mark_lost();
+
+        if (ring.wait(camera, last_seq, 100) <= last_seq) continue;
+        FrameRef jpeg = jpeg_pool.acquire(pool_wait_ms);
+        if (!jpeg) {
+            LOG_EVERY_MS(LOG_LEVEL_ERROR, 5000, "JPEG frame pool exhausted, dropping frame");
+            continue;
+        }
+        // Overwritten while being copied: the newer frame follows at once
+        if (!ring.read_latest(camera, *jpeg) || jpeg->seq <= last_seq) continue;
+        last_seq = jpeg->seq;
+        channel.publish(FrameRef(), jpeg);
+    }
+
+    ring.set_demand(worker, camera, 0, 0);
+}
+
+// Starts worker `index` as a fresh exec of this binary with the same
+// options, so it shares nothing with the capture process but the ring.
+// It gets SIGTERM if the capture process dies.
+pid_t spawn_worker(const std::vector<std::string>& args, int index, int ring_fd) {
+    std::vector<std::string> worker_args(args);
+    worker_args.push_back("--worker=" + std::to_string(index) + ":" + std::to_string(ring_fd));
+    std::vector<char*> argv;
+    for (size_t i = 0; i < worker_args.size(); ++i) argv.push_back(const_cast<char*>(worker_args[i].c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        execv("/proc/self/exe", argv.data());
+        _exit(127);
+    }
+    if (pid < 0) LOG_ERROR("Failed to start worker %d: %s", index, strerror(errno));
+    else LOG_INFO("Worker %d started, pid %d", index, static_cast<int>(pid));
+    return pid;
+}
+
+// Body of a worker process: takes connections on the shared ports
+// (SO_REUSEPORT spreads them over the workers) and serves them from the
+// ring. Without raw frames there are no variants (SIZE, QUALITY, CODEC)
+// here.
+int run_worker(int index, int ring_fd, CameraList& cameras, const std::string& host, int port, int pool_frames,
+               ClientOptions options) {
+    FrameRing ring;
+    if (!ring.attach(ring_fd)) return -1;
+    if (ring.cameras() != cameras.size()) {
+        LOG_ERROR("Worker %d: ring has %zu cameras, expected %zu", index, ring.cameras(), cameras.size());
+        return -1;
+    }
+    FramePool jpeg_pool("jpeg", static_cast<size_t>(pool_frames) * cameras.size(), ring.frame_capacity());
+    options.jpeg_pool = &jpeg_pool;
+    options.max_variants = 0;
+    options.raw_frames = false;
+    install_signal_handlers();
+
+    int server_fd = bind_listener(host, port, true);
+    if (server_fd < 0) return -1;
+    std::vector<struct pollfd> pfds(1);
+    std::vector<Camera*> pfd_cameras(1, nullptr);
+    pfds[0].fd = server_fd;
+    pfds[0].events = POLLIN;
+    if (!add_camera_listeners(host, cameras, true, pfds, pfd_cameras)) return -1;
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        readers.push_back(std::thread(ring_read_loop, std::ref(ring), i, index, std::ref(jpeg_pool),
+                                      options.pool_wait_ms, std::ref(cameras[i]->channel)));
+    }
+    rt_profile_lock_memory();
+
+    while (running) {
+        if (poll(pfds.data(), pfds.size(), 100) <= 0) continue;
+        for (size_t i = 0; i < pfds.size(); ++i) {
+            if (pfds[i].revents & POLLIN) accept_client(pfds[i].fd, pfd_cameras[i], cameras, options);
+        }
+    }
+
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cameras[i]->channel.wake_all();
+        cameras[i]->clients.evict_all();
+    }
+    for (size_t i = 0; i < readers.size(); ++i) readers[i].join();
+    wait_for_clients(cameras);
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cameras[i]->channel.clear();
+        if (cameras[i]->listen_fd >= 0) close(cameras[i]->listen_fd);
+    }
+    close(server_fd);
+    LOG_INFO("Worker %d stopped", index);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     // Default parameters
     std::string device = "/dev/video8";
     int fwidth = 320, fheight = 240, snaph = 480, snapw = 640;
     int fps = 30;
+    std::vector<std::string> camera_specs;
+    std::string mosaic_spec;
+    int encoders = 0;
+    int quality = 70;
+    int max_variants = 4;
+    int pull_timeout_ms = 500;
+    int send_lowat = 16384;
+    int sndbuf = 0;
+    int keyframe_interval = 60;
+    int workers = 0;
+    int worker_index = -1, worker_fd = -1;
     std::string host = "0.0.0.0";
     int port = 40917;
     std::string serial = "";
     int baudrate = 115200;
+    int max_clients = 1;
+    std::string record_path;
+    int record_quality = 0;
+    int pool_frames = 6;
+    int pool_wait_ms = 33;
+    int idle_fps = 0;
+    int idle_timeout_s = 0;
+    int stall_ms = 2000;
+    LostMode lost_mode = LOST_REPEAT;
+    std::string tls_cert, tls_key;
+    std::string stats_path;
 
     // Parse arguments
     static struct option long_options[] = {
@@ -229,14 +1349,41 @@ int main(int argc, char* argv[]) {
         {"snaph", required_argument, 0, 'P'},
         {"snapw", required_argument, 0, 'O'},
         {"fps", required_argument, 0, 'f'},
+        {"camera", required_argument, 0, 'c'},
+        {"mosaic", required_argument, 0, 'M'},
+        {"encoders", required_argument, 0, 'e'},
+        {"quality", required_argument, 0, 'q'},
+        {"max-variants", required_argument, 0, 'V'},
+        {"pull-timeout", required_argument, 0, 'G'},
+        {"send-lowat", required_argument, 0, 'l'},
+        {"sndbuf", required_argument, 0, 'B'},
+        {"keyframe-interval", required_argument, 0, 'Y'},
+        {"workers", required_argument, 0, 'k'},
+        {"worker", required_argument, 0, 'Z'}, // Internal: <index>:<ring fd>
         {"host", required_argument, 0, 'H'},
         {"port", required_argument, 0, 'p'},
         {"serial", required_argument, 0, 's'},
         {"baudrate", required_argument, 0, 'b'},
+        {"max-clients", required_argument, 0, 'm'},
+        {"record", required_argument, 0, 'r'},
+        {"record-quality", required_argument, 0, 'Q'},
+        {"pool-frames", required_argument, 0, 'n'},
+        {"pool-wait", required_argument, 0, 'W'},
+        {"idle-fps", required_argument, 0, 'i'},
+        {"idle-timeout", required_argument, 0, 'I'},
+        {"stall-timeout", required_argument, 0, 'T'},
+        {"on-source-lost", required_argument, 0, 'L'},
+        {"stats-file", required_argument, 0, 'S'},
+        {"rt-profile", required_argument, 0, 'R'},
+        {"tls-cert", required_argument, 0, 'C'},
+        {"tls-key", required_argument, 0, 'K'},
         {"help", no_argument, 0, 'x'},
         {0, 0, 0, 0}
     };
 
+    // Workers run with the same options, before getopt permutes them
+    std::vector<std::string> worker_args(argv, argv + argc);
+
     int opt;
     while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
         try {
@@ -247,10 +1394,45 @@ int main(int argc, char* argv[]) {
                 case 'P': snaph = std::stoi(optarg); break;
                 case 'O': snapw = std::stoi(optarg); break;
                 case 'f': fps = std::stoi(optarg); break;
+                case 'c': camera_specs.push_back(optarg); break;
+                case 'M': mosaic_spec = optarg; break;
+                case 'e': encoders = std::stoi(optarg); break;
+                case 'q': quality = std::stoi(optarg); break;
+                case 'V': max_variants = std::stoi(optarg); break;
+                case 'G': pull_timeout_ms = std::stoi(optarg); break;
+                case 'l': send_lowat = std::stoi(optarg); break;
+                case 'B': sndbuf = std::stoi(optarg); break;
+                case 'Y': keyframe_interval = std::stoi(optarg); break;
+                case 'k': workers = std::stoi(optarg); break;
+                case 'Z':
+                    if (sscanf(optarg, "%d:%d", &worker_index, &worker_fd) != 2) throw std::invalid_argument(optarg);
+                    break;
                 case 'H': host = optarg; break;
                 case 'p': port = std::stoi(optarg); break;
                 case 's': serial = optarg; break;
                 case 'b': baudrate = std::stoi(optarg); break;
+                case 'm': max_clients = std::stoi(optarg); break;
+                case 'r': record_path = optarg; break;
+                case 'Q': record_quality = std::stoi(optarg); break;
+                case 'n': pool_frames = std::stoi(optarg); break;
+                case 'W': pool_wait_ms = std::stoi(optarg); break;
+                case 'i': idle_fps = std::stoi(optarg); break;
+                case 'I': idle_timeout_s = std::stoi(optarg); break;
+                case 'T': stall_ms = std::stoi(optarg); break;
+                case 'L':
+                    if (std::string(optarg) == "repeat") lost_mode = LOST_REPEAT;
+                    else if (std::string(optarg) == "marker") lost_mode = LOST_MARKER;
+                    else if (std::string(optarg) == "none") lost_mode = LOST_NONE;
+                    else throw std::invalid_argument(optarg);
+                    break;
+                case 'S': stats_path = optarg; break;
+                case 'C': tls_cert = optarg; break;
+                case 'K': tls_key = optarg; break;
+                case 'R': {
+                    std::string error;
+                    if (!rt_profile_parse(optarg, error)) throw std::invalid_argument(error);
+                    break;
+                }
                 case 'x': print_usage(argv[0]); return 0;
                 default: print_usage(argv[0]); return -1;
             }
@@ -261,124 +1443,338 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // Initialize video capture
-    cv::VideoCapture cap(device, cv::CAP_V4L2);
-    if (!cap.isOpened()) {
-        std::cerr << "[" << get_timestamp() << "] Failed to open video device: " << device << "\n";
+    // Cameras: --camera entries, or the single --device
+    if (max_clients < 1) max_clients = 1;
+    if (max_variants < 0) max_variants = 0;
+    if (quality < 1 || quality > 100 || record_quality < 0 || record_quality > 100) {
+        std::cerr << "Quality must be 1-100\n";
+        return -1;
+    }
+    if (record_quality == 0) record_quality = quality;
+    if (record_quality != quality && max_variants == 0) {
+        std::cerr << "--record-quality needs --max-variants of at least 1\n";
         return -1;
     }
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, fwidth);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, fheight);
-    cap.set(cv::CAP_PROP_FPS, fps);
-    cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
-    std::cout << "[" << get_timestamp() << "] Video: " << fwidth << "x" << fheight << "@" << fps << "fps\n";
+    CaptureConfig base_config = {fwidth, fheight, fps, snapw, snaph, quality, pool_wait_ms,
+                                 std::max(idle_fps, 0), std::max(idle_timeout_s, 0) * 1000, 3, device};
+    CameraList cameras;
+    if (camera_specs.empty()) camera_specs.push_back(device);
+    for (size_t i = 0; i < camera_specs.size(); ++i) {
+        try {
+            cameras.push_back(std::unique_ptr<Camera>(parse_camera(camera_specs[i], i, base_config, max_clients)));
+        } catch (const std::exception&) {
+            std::cerr << "Invalid camera: " << camera_specs[i] << "\n";
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    // The mosaic's tiles are the cameras in order, so it comes last. Relays
+    // have no raw frames to tile and are left out.
+    std::vector<FrameChannel*> mosaic_sources;
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        if (!cameras[i]->relay) mosaic_sources.push_back(&cameras[i]->channel);
+    }
+    if (!mosaic_spec.empty()) {
+        try {
+            cameras.push_back(std::unique_ptr<Camera>(parse_mosaic(mosaic_spec, cameras.size(), base_config,
+                                                                   max_clients)));
+            size_t tile = 0;
+            for (size_t i = 0; i + 1 < cameras.size(); ++i) {
+                const CaptureConfig& source = cameras[i]->config;
+                if (!cameras[i]->relay) cameras.back()->mosaic->set_snapshot_size(tile++, source.snapw, source.snaph);
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid mosaic: " << mosaic_spec << "\n";
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        if (cameras[i]->port == port) {
+            std::cerr << "Camera port " << port << " is already the shared --port\n";
+            return -1;
+        }
+    }
+
+    if (workers < 0 || workers > FrameRing::MAX_WORKERS) {
+        std::cerr << "--workers must be 0-" << FrameRing::MAX_WORKERS << "\n";
+        return -1;
+    }
+
+    TlsServer tls;
+    if (!tls_cert.empty() || !tls_key.empty()) {
+        std::string error;
+        if (!tls.load(tls_cert, tls_key.empty() ? tls_cert : tls_key, error)) {
+            LOG_ERROR("%s", error.c_str());
+            return -1;
+        }
+        LOG_INFO("TLS enabled with %s (kernel TLS)", tls_cert.c_str());
+    }
+    ClientOptions client_options = {lost_mode, tls.enabled() ? &tls : nullptr, nullptr, pool_wait_ms,
+                                     static_cast<size_t>(std::max(max_variants, 0)), std::max(pull_timeout_ms, 1),
+                                     std::max(send_lowat, 0), std::max(sndbuf, 0), std::max(keyframe_interval, 1),
+                                     true};
+    if (worker_index >= 0) {
+        return run_worker(worker_index, worker_fd, cameras, host, port, std::max(pool_frames, 2), client_options);
+    }
+
+    // Initialize video capture
+    int max_w = std::max(0, snapw), max_h = std::max(0, snaph);
+    size_t max_jpeg = JpegEncoder::max_size(snapw, snaph);
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        Camera& camera = *cameras[i];
+        const CaptureConfig& config = camera.config;
+        if (camera.mosaic) {
+            LOG_INFO("Mosaic %zu: %dx%d tiles, %dx%d@%dfps", i, camera.mosaic->cols(), camera.mosaic->rows(),
+                     config.width, config.height, config.fps);
+        } else if (camera.relay) {
+            LOG_INFO("Relay %zu: %s:%d%s, up to %dx%d@%dfps", i, camera.relay->host.c_str(), camera.relay->port,
+                     camera.relay->channel >= 0 ? (" channel " + std::to_string(camera.relay->channel)).c_str() : "",
+                     config.width, config.height, config.fps);
+        } else if (!open_capture(camera.source, config)) {
+            LOG_ERROR("Failed to open video device: %s", config.device.c_str());
+            return -1;
+        } else {
+            LOG_INFO("Video %zu: %s %dx%d@%dfps", i, config.device.c_str(), config.width, config.height,
+                     config.fps);
+        }
+        max_w = std::max(max_w, config.width);
+        max_h = std::max(max_h, config.height);
+        max_jpeg = std::max(max_jpeg, JpegEncoder::max_size(config.width, config.height));
+        // Lossless variants ("CODEC qoi") can take a third more than raw,
+        // and a delta stream's keyframe a little more than raw. Snapshots
+        // go out on the stream too, at their own size.
+        int lossless_w = std::max(config.width, snapw), lossless_h = std::max(config.height, snaph);
+        if (max_variants > 0 && !camera.relay) max_jpeg = std::max(max_jpeg, qoi_max_size(lossless_w, lossless_h));
+        if (!camera.relay) max_jpeg = std::max(max_jpeg, DeltaEncoder::max_size(lossless_w, lossless_h));
+    }
+    if (idle_fps > 0) LOG_INFO("Warm standby at %d fps while idle", idle_fps);
+
+    // Frame pools shared by all cameras, sized for the largest stream or
+    // snapshot resolution; every variant and history frame keeps one more
+    // JPEG
+    if (pool_frames < 2) pool_frames = 2;
+    size_t n_frames = static_cast<size_t>(pool_frames) * cameras.size();
+    size_t n_history = 0;
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cameras[i]->channel.set_history(cameras[i]->history);
+        n_history += cameras[i]->history;
+    }
+    FramePool raw_pool("raw", n_frames, static_cast<size_t>(max_w) * max_h * 3);
+    // plus the last snapshot of each
+    FramePool jpeg_pool("jpeg", n_frames + n_history + static_cast<size_t>(max_variants + 1) * cameras.size(),
+                        max_jpeg);
+
+    // Encoders: a frame per camera can be in flight while the next is captured
+    if (encoders <= 0) {
+        encoders = std::min(static_cast<int>(cameras.size()),
+                            std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+    }
+    EncodeQueue encoder(jpeg_pool, 2 * cameras.size(), pool_wait_ms);
+
+    // Everything the steady state touches exists now; lock it in before the
+    // threads start
+    rt_profile_lock_memory();
+    encoder.start(encoders);
+    LOG_INFO("Encoders: %zu for %zu camera(s)", encoder.workers(), cameras.size());
 
     // Initialize serial
     int serial_fd = -1;
     std::thread serial_thread;
-    std::atomic<bool> snapshot_signal(false);
+    std::vector<std::atomic<bool>*> snapshot_signals;
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        if (!cameras[i]->mosaic && !cameras[i]->relay) snapshot_signals.push_back(&cameras[i]->snapshot);
+    }
     if (!serial.empty()) {
         serial_fd = init_serial(serial, baudrate);
         if (serial_fd < 0) return -1;
-        serial_thread = std::thread(handle_serial, serial_fd, std::ref(snapshot_signal));
-        std::cout << "[" << get_timestamp() << "] Serial: " << serial << "@" << baudrate << "\n";
+        serial_thread = std::thread(handle_serial, serial_fd, std::cref(snapshot_signals));
+        LOG_INFO("Serial: %s@%d", serial.c_str(), baudrate);
     }
 
-    // Setup signal handling
-    struct sigaction sa;
-    sa.sa_handler = signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGINT, &sa, nullptr);
-    sigaction(SIGTERM, &sa, nullptr);
+    install_signal_handlers();
 
-    // Create server socket
-    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-    if (server_fd < 0) {
-        std::cerr << "[" << get_timestamp() << "] Failed to create socket\n";
-        return -1;
+    // Create server sockets: the shared port, then any per-camera ports.
+    // With workers they hold the sockets and this process only captures,
+    // feeding them through the ring; a worker that dies is restarted
+    // without capture noticing.
+    bool socket_activated = false;
+    int server_fd = -1;
+    std::vector<struct pollfd> pfds;
+    std::vector<Camera*> pfd_cameras;
+    FrameRing ring;
+    std::vector<std::thread> ring_writers;
+    std::vector<pid_t> worker_pids(workers, -1);
+    std::vector<std::chrono::steady_clock::time_point> worker_restart(workers);
+    if (workers == 0) {
+        server_fd = open_listener(host, port, socket_activated);
+        if (server_fd < 0) return -1;
+        struct pollfd pfd = {server_fd, POLLIN, 0};
+        pfds.push_back(pfd);
+        pfd_cameras.push_back(nullptr);
+        if (!add_camera_listeners(host, cameras, false, pfds, pfd_cameras)) return -1;
+    } else {
+        if (activated_listen_fd() >= 0) {
+            LOG_ERROR("--workers cannot take a socket-activated listener");
+            return -1;
+        }
+        if (!ring.create(cameras.size(), 4, max_jpeg)) return -1;
+        for (size_t i = 0; i < cameras.size(); ++i) {
+            ring_writers.push_back(std::thread(ring_write_loop, std::ref(ring), i, std::ref(cameras[i]->channel)));
+        }
+        for (int i = 0; i < workers; ++i) worker_pids[i] = spawn_worker(worker_args, i, ring.fd());
     }
 
-    int sock_opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
-
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
-        std::cerr << "[" << get_timestamp() << "] Invalid host: " << host << "\n";
-        close(server_fd);
-        return -1;
+    // Start capture and optional recording
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        Camera& camera = *cameras[i];
+        if (camera.mosaic) {
+            camera.thread = std::thread(mosaic_loop, std::ref(*camera.mosaic), std::cref(mosaic_sources),
+                                        std::ref(raw_pool), std::ref(encoder), std::ref(camera.channel),
+                                        std::cref(camera.config), std::cref(running));
+            continue;
+        }
+        if (camera.relay) {
+            camera.thread = std::thread(relay_loop, std::cref(*camera.relay), std::ref(jpeg_pool),
+                                        std::ref(camera.channel), std::cref(camera.config), std::cref(running));
+            continue;
+        }
+        camera.thread = std::thread(capture_loop, std::ref(camera.source), std::ref(raw_pool), std::ref(encoder),
+                                    std::ref(camera.channel), std::ref(camera.snapshot), std::cref(camera.config),
+                                    std::cref(running));
     }
-
-    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "[" << get_timestamp() << "] Bind failed\n";
-        close(server_fd);
-        return -1;
+    std::thread record_thread;
+    if (!record_path.empty()) {
+        int record_fd = open(record_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (record_fd < 0) {
+            LOG_ERROR("Failed to open recording %s: %s", record_path.c_str(), strerror(errno));
+        } else {
+            // Subscribed here, before any client can take the variant slots
+            VariantKey record_key = {0, 0, record_quality, CODEC_JPEG};
+            bool is_variant = !resolve_variant(record_key, cameras[0]->config);
+            if (is_variant) cameras[0]->channel.subscribe(record_key, max_variants);
+            record_thread = std::thread(record_loop, record_fd, std::ref(cameras[0]->channel), record_key,
+                                        is_variant, std::ref(jpeg_pool), pool_wait_ms);
+            LOG_INFO("Recording camera 0 to %s at quality %d", record_path.c_str(), record_quality);
+        }
     }
 
-    if (listen(server_fd, 1) < 0) {
-        std::cerr << "[" << get_timestamp() << "] Listen failed\n";
-        close(server_fd);
-        return -1;
-    }
-    std::cout << "[" << get_timestamp() << "] Server: " << host << ":" << port << "\n";
+    client_options.jpeg_pool = &jpeg_pool;
 
     // Main loop with poll
-    struct pollfd pfd;
-    pfd.fd = server_fd;
-    pfd.events = POLLIN;
+    std::chrono::steady_clock::time_point next_stats = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_active = next_stats;
+    std::chrono::steady_clock::time_point next_stats_file = next_stats;
 
     while (running) {
-        int ret = poll(&pfd, 1, 100);
-        if (ret < 0) {
-            if (running) std::cerr << "[" << get_timestamp() << "] Poll error\n";
-            continue;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now >= next_stats) {
+            next_stats += std::chrono::seconds(60);
+            raw_pool.log_stats();
+            jpeg_pool.log_stats();
+            if (encoder.dropped()) {
+                LOG_INFO("Encoder queue drops: %llu", static_cast<unsigned long long>(encoder.dropped()));
+            }
+            for (size_t i = 0; i < cameras.size(); ++i) {
+                RecoveryStats recovery = cameras[i]->channel.recovery_stats();
+                if (recovery.count) {
+                    LOG_INFO("Camera %zu source recoveries: %llu, last %llu ms, max %llu ms", i,
+                             static_cast<unsigned long long>(recovery.count),
+                             static_cast<unsigned long long>(recovery.last_ms),
+                             static_cast<unsigned long long>(recovery.max_ms));
+                }
+                uint64_t pulls, pull_timeouts, pull_mean_us, pull_max_us;
+                cameras[i]->pull_stats.get(pulls, pull_timeouts, pull_mean_us, pull_max_us);
+                if (pulls) {
+                    LOG_INFO("Camera %zu pull requests: %llu, %llu timed out, latency mean %.2f ms, max %.2f ms", i,
+                             static_cast<unsigned long long>(pulls), static_cast<unsigned long long>(pull_timeouts),
+                             pull_mean_us / 1000.0, pull_max_us / 1000.0);
+                }
+            }
+        }
+        if (!stats_path.empty() && now >= next_stats_file) {
+            next_stats_file = now + std::chrono::seconds(10);
+            write_stats_file(stats_path, cameras, raw_pool, jpeg_pool, encoder);
         }
-        if (ret == 0) continue;
 
-        if (pfd.revents & POLLIN) {
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
-            if (client_fd < 0) {
-                if (running) std::cerr << "[" << get_timestamp() << "] Accept failed\n";
-                continue;
-            }
+        // Catches a capture read that hangs instead of failing
+        bool active = false;
+        for (size_t i = 0; i < cameras.size(); ++i) {
+            cameras[i]->channel.check_stall(stall_ms);
+            active = active || cameras[i]->channel.has_consumers();
+        }
 
-            char client_ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-            std::cout << "[" << get_timestamp() << "] New client: " << client_ip << "\n";
+        // Socket-activated: systemd holds the port while we are gone and
+        // starts us again on the next connection
+        if (active) {
+            last_active = now;
+        } else if (socket_activated && idle_timeout_s > 0 &&
+                   now - last_active >= std::chrono::seconds(idle_timeout_s)) {
+            LOG_INFO("Idle for %d s, exiting until the next connection", idle_timeout_s);
+            running = false;
+            break;
+        }
 
-            // Close existing client
-            if (current_client != -1) {
-                close(current_client);
-                current_client = -1;
-                std::cout << "[" << get_timestamp() << "] Closed previous client\n";
+        // A crashed worker only loses its own viewers; its demand is dropped
+        // and a new one takes its place on the port
+        for (int i = 0; i < workers; ++i) {
+            int status;
+            if (worker_pids[i] > 0 && waitpid(worker_pids[i], &status, WNOHANG) == worker_pids[i]) {
+                LOG_ERROR("Worker %d (pid %d) %s %d, restarting", i, static_cast<int>(worker_pids[i]),
+                          WIFSIGNALED(status) ? "killed by signal" : "exited with status",
+                          WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+                ring.clear_worker(i);
+                worker_pids[i] = -1;
+                worker_restart[i] = now + std::chrono::seconds(1);
             }
+            if (worker_pids[i] < 0 && now >= worker_restart[i]) {
+                worker_pids[i] = spawn_worker(worker_args, i, ring.fd());
+            }
+        }
 
-            // Set new client
-            current_client = client_fd;
+        int ret = poll(pfds.data(), pfds.size(), 100);
+        if (ret < 0) {
+            if (running) LOG_ERROR("Poll error");
+            continue;
+        }
+        if (ret == 0) continue;
 
-            // Start client thread
-            std::thread client_thread(handle_client, client_fd, std::ref(cap), std::ref(snapshot_signal),
-                                     fwidth, fheight, snapw, snaph);
-            client_thread.detach();
+        for (size_t i = 0; i < pfds.size(); ++i) {
+            if (pfds[i].revents & POLLIN) {
+                accept_client(pfds[i].fd, pfd_cameras[i], cameras, client_options);
+            }
         }
     }
 
     // Cleanup
-    std::cout << "[" << get_timestamp() << "] Shutting down...\n";
-    if (current_client != -1) {
-        close(current_client);
-        current_client = -1;
+    LOG_INFO("Shutting down...");
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cameras[i]->channel.wake_all();
+        cameras[i]->clients.evict_all();
     }
+    for (int i = 0; i < workers; ++i) {
+        if (worker_pids[i] > 0) kill(worker_pids[i], SIGTERM);
+    }
+    for (int i = 0; i < workers; ++i) {
+        if (worker_pids[i] > 0) waitpid(worker_pids[i], nullptr, 0);
+    }
+    for (size_t i = 0; i < ring_writers.size(); ++i) ring_writers[i].join();
+    for (size_t i = 0; i < cameras.size(); ++i) cameras[i]->thread.join();
+    encoder.stop();
+    if (record_thread.joinable()) record_thread.join();
+    wait_for_clients(cameras);
+    for (size_t i = 0; i < cameras.size(); ++i) cameras[i]->channel.clear();
+    raw_pool.log_stats();
+    jpeg_pool.log_stats();
     if (serial_fd >= 0) {
         close(serial_fd);
         if (serial_thread.joinable()) serial_thread.join();
     }
-    close(server_fd);
-    cap.release();
-    std::cout << "[" << get_timestamp() << "] Shutdown complete\n";
-    return 0;
+    if (server_fd >= 0) close(server_fd);
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        if (cameras[i]->listen_fd >= 0) close(cameras[i]->listen_fd);
+        cameras[i]->source.release();
+    }
+    LOG_INFO("Shutdown complete");
+    return alloc_check_failed() ? 2 : 0;
 }